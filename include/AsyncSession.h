@@ -0,0 +1,109 @@
+#pragma once
+#include <string>
+#include <optional>
+#include <vector>
+#include <sys/socket.h>
+#include "EventLoop.h"
+#include "FreiaEncryption.h"
+#include "Task.h"
+
+// A chat session for bots and tools that drive many connections from one
+// thread. Every call is a coroutine on an EventLoop:
+//
+//     Task<void> echo(EventLoop& loop)
+//     {
+//         AsyncSession session(loop);
+//         if (!session.configure(...))
+//             co_return;
+//         if (!co_await session.connect())
+//             co_return;
+//         while (std::optional<AsyncSession::Message> m = co_await session.next())
+//             co_await session.send(m->text);
+//     }
+//
+// It speaks PROT1 over TCP or a UNIX socket ("unix:/path") with the server
+// password transport layer, and nothing more of what ClientConnect does:
+//  - no duplicate suppression, resent frames and the server's echo of our
+//    own messages come out of next() like any other
+//  - no mutes, and no numbered senders (SIDS1, SNDR1 and PROT2 frames are
+//    reported as unknown protocols)
+//  - no TLS, datagrams, multiplexing, history or offline outbox
+//  - host names are resolved on the Resolver's thread, and connect() polls
+//    for the answer every 10 ms instead of being woken by it
+class AsyncSession
+{
+public:
+    struct Message
+    {
+        std::string sender;         // empty for errors, text says what went wrong
+        std::string text;
+    };
+
+    explicit AsyncSession(EventLoop& loop) : loop(loop) {}
+    ~AsyncSession();
+
+    AsyncSession(const AsyncSession&) = delete;
+    AsyncSession& operator=(const AsyncSession&) = delete;
+
+    bool configure(const char* ip, const char* port, const char* user,
+                   const char* chatPassword, const char* serverPassword);
+    // Key derivation is deliberately slow; sessions of one user can share keys
+    bool configure(const char* ip, const char* port, const char* user,
+                   const FreiaEncryption::Key& chatKey, const FreiaEncryption::Key& serverKey);
+
+    // Tries each resolved address in turn; the reason for a failure goes to
+    // stderr. An unreachable address takes the kernel's connect timeout.
+    Task<bool> connect();
+
+    // Done once the frame is handed to the kernel. Concurrent sends from
+    // several tasks go out in call order.
+    Task<bool> send(std::string text);
+
+    // The next chat message, std::nullopt once the connection is gone.
+    // One task at a time.
+    Task<std::optional<Message>> next();
+
+    void close();
+    bool isConnected() const { return sock != -1; }
+
+private:
+    // Suspends a send() while another one is writing
+    struct FlushWait
+    {
+        AsyncSession& session;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> waiter) { session.flushWaiters.push_back(waiter); }
+        void await_resume() const noexcept {}
+    };
+
+    Task<bool> connectTo(int domain, const sockaddr* address, socklen_t addressLen);
+    Task<bool> flush();
+    std::optional<Message> takeMessage();
+
+    EventLoop& loop;
+    int sock = -1;
+
+    std::string ip;
+    int port = 0;
+    std::string user;
+    FreiaEncryption::Key chatKey{};
+    FreiaEncryption::Key serverKey{};
+
+    // Length-prefixed packets not yet sent, from outgoingStart on. The
+    // counters run over the whole connection so a send() can tell when its
+    // bytes went out.
+    std::string outgoing;
+    size_t outgoingStart = 0;
+    uint64_t bytesQueued = 0;
+    uint64_t bytesSent = 0;
+    bool flushing = false;
+    std::vector<std::coroutine_handle<>> flushWaiters;
+
+    // Received bytes not yet parsed, from incomingStart on
+    std::string incoming;
+    size_t incomingStart = 0;
+
+    static constexpr uint32_t maxPacket = 10 * 1024 * 1024;
+    static constexpr size_t readChunk = 16384;
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+// Reusable receive buffers in power-of-two size classes (4 KiB .. 1 MiB).
+// Everything handed out or kept for reuse counts against one global budget;
+// when a request does not fit, acquire() returns an empty Buffer and the
+// caller is expected to stream the frame instead.
+class BufferPool
+{
+public:
+    class Buffer
+    {
+    public:
+        Buffer() = default;
+        Buffer(Buffer&& other) noexcept { *this = std::move(other); }
+        Buffer& operator=(Buffer&& other) noexcept;
+        ~Buffer() { reset(); }
+
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        char* data() const { return bytes; }
+        size_t capacity() const { return size; }
+        explicit operator bool() const { return bytes != nullptr; }
+        void reset();
+
+    private:
+        friend class BufferPool;
+        Buffer(BufferPool* pool, char* bytes, size_t size) : pool(pool), bytes(bytes), size(size) {}
+
+        BufferPool* pool = nullptr;
+        char* bytes = nullptr;
+        size_t size = 0;
+    };
+
+    explicit BufferPool(size_t budget) : budget(budget), freeLists(classCount) {}
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    static BufferPool& global();
+
+    Buffer acquire(size_t size);
+    void setBudget(size_t bytes);
+    static size_t largestClass() { return minClass << (classCount - 1); }
+
+private:
+    static const size_t minClass = 4 * 1024;
+    static const size_t classCount = 9;
+
+    void release(char* bytes, size_t size);
+    bool freeCached(size_t bytes);
+    static int classFor(size_t size);
+
+    std::mutex mutex;
+    size_t budget;
+    size_t inUse = 0;
+    size_t cached = 0;
+    std::vector<std::vector<char*>> freeLists;
+};
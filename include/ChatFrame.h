@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// The PROT1 chat frame, "PROT1\nuser\nlen\n" and then len bytes of E2EE
+// ciphertext. The server relays it inside the transport layer.
+namespace ChatFrame
+{
+    // The header at the front of a decrypted frame, parsed in place
+    struct Header
+    {
+        std::string_view user;
+        size_t cipherLen = 0;
+        size_t size = 0;
+        bool muted = false;         // numbered senders only, see SenderTable
+    };
+
+    std::string build(const std::string& user, const std::string& chatCipher);
+
+    // "" when the header is good, otherwise the error to show
+    std::string parseHeader(std::string_view frame, Header& header);
+}
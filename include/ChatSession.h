@@ -0,0 +1,78 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Everything the UI needs from a chat session. ClientConnect runs the session
+// in this process, DaemonClient views one owned by freia-thiwi-daemon.
+class ChatSession
+{
+public:
+    enum class ConnectState { Idle, Connecting, Connected, Failed };
+
+    virtual ~ChatSession() = default;
+
+    virtual bool configure(const char* ip, const char* port, const char* user,
+                           const char* chatPassword, const char* serverPassword) = 0;
+    virtual void setPersistHistory(bool persist) = 0;
+    virtual void setLazyDecrypt(bool lazy) = 0;
+    virtual void setTlsTransport(bool tls) = 0;
+    virtual void setDatagramTransport(bool datagram) = 0;
+    virtual void setMultiplexing(bool multiplex) = 0;
+    virtual void setNumberedSenders(bool numbered) = 0;
+
+    // Polls instead of sleeping on TCP and UNIX connections: no Nagle,
+    // kernel busy polling where allowed, and a short spin before the receive
+    // thread blocks. cpu >= 0 pins that thread to the core. Costs CPU and is
+    // not shown to lower latency anywhere yet; freia-thiwi-latency-bench
+    // measures it. Takes effect with the next connection.
+    virtual void setLowLatency(bool enabled, int cpu) = 0;
+
+    // The servers given to configure() are nodes of one cluster. Each chat
+    // goes to the node its chat key hashes to on a consistent-hash ring, and
+    // to the next one on the ring while that node is down. Takes effect with
+    // the next connection.
+    virtual void setClusterRouting(bool cluster) = 0;
+
+    // Bulk streams of a multiplexed connection are striped over several
+    // connections to the same server, as many as make them faster; chat stays
+    // on the first. Plain TCP or UNIX without TLS, server support required.
+    // Takes effect with the next connection.
+    virtual void setStripedTransfers(bool striped) = 0;
+
+    // Single-threaded networking for single-core machines: no receive or
+    // writer thread, the owner calls pump() from its own loop instead. TCP and
+    // UNIX connections without TLS or multiplexing; others keep their threads.
+    // Takes effect with the next connection.
+    virtual void setCooperative(bool cooperative) = 0;
+
+    // Whether the current connection is the one pump() drives
+    virtual bool isCooperative() const = 0;
+
+    // Moves whatever the connection is ready for without blocking. Returns
+    // how many ms may pass before the next call.
+    static constexpr int pumpIntervalMs = 20;
+    virtual int pump() = 0;
+
+    // Chat messages beyond `burst` leave at this rate, 0 switches pacing off.
+    // Off unless the user turns it on. queuedMessages() is how many are still waiting.
+    static constexpr unsigned defaultSendRate = 0;
+    static constexpr unsigned defaultSendBurst = 10;
+    virtual void setSendRate(unsigned messagesPerSecond, unsigned burst) = 0;
+    virtual size_t queuedMessages() const = 0;
+
+    virtual bool connectToServer() = 0;
+    virtual void disconnect() = 0;
+    virtual ConnectState connectState() const = 0;
+    virtual std::string connectError() const = 0;
+    virtual bool isConnectedToServer() const = 0;
+
+    virtual void sendMessage(const std::string& text) = 0;
+    virtual size_t messageCount() const = 0;
+    virtual std::string messageAt(size_t index) const = 0;
+    virtual std::vector<size_t> searchMessages(const std::string& query, size_t limit) const = 0;
+
+    virtual void muteSender(const std::string& name) = 0;
+    virtual void unmuteSender(const std::string& name) = 0;
+    virtual std::vector<std::string> mutedSenders() const = 0;
+};
@@ -1,44 +1,292 @@
 #pragma once
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <set>
+#include <unordered_set>
 #include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <condition_variable>
+#include <chrono>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <cstring>
 #include "FreiaEncryption.h"
+#include "MessageStore.h"
+#include "PlaintextCache.h"
+#include "BufferPool.h"
+#include "ChatSession.h"
+#include "DatagramLink.h"
+#include "StreamMux.h"
+#include "StripeSet.h"
+#include "TokenBucket.h"
+#include "OfflineOutbox.h"
+#include "DuplicateFilter.h"
+#include "SenderTable.h"
+#include "Transport.h"
+#include "ChatFrame.h"
+#include "Validation.h"
 
+struct ssl_st;
+struct ssl_ctx_st;
 
-class ClientConnect
+
+class ClientConnect : public ChatSession
 {
 public:
     ClientConnect();
     ClientConnect(const char* ip, const char* port, const char* user, const char* chatPassword);
-    ~ClientConnect();
+    ~ClientConnect() override;
+
+    // Resolves and connects on a background thread, poll connectState()
+    bool connectToServer() override;
+
+    // Runs the session over a stream that is already connected, e.g. one end
+    // of a MemoryTransport pair. TLS needs a socket underneath.
+    bool connectTransport(std::unique_ptr<Transport> stream);
+    ConnectState connectState() const override { return connectStatus; }
+    std::string connectError() const override { return connectFailure; }
+    void disconnect() override;
+    void sendMessage(const std::string& text) override;
+
+    size_t messageCount() const override { return history.size(); }
+    std::string messageAt(size_t index) const override;
+    std::vector<size_t> searchMessages(const std::string& query, size_t limit) const override { return history.search(query, limit); }
+    void setHistoryLimits(size_t memoryBytes, uint64_t diskBytes);
+    void setPersistHistory(bool persist) override { persistHistory = persist; }
+    void setLazyDecrypt(bool lazy) override { lazyDecrypt = lazy; }
+    void setTlsTransport(bool tls) override { useTls = tls; }
+    void setDatagramTransport(bool datagram) override { useDatagram = datagram; }
+    void setMultiplexing(bool multiplex) override { useMux = multiplex; }
+    void setNumberedSenders(bool numbered) override { useNumberedSenders = numbered; }
+    void setLowLatency(bool enabled, int cpu) override { lowLatency = enabled; ioCpu = cpu; }
+    void setClusterRouting(bool cluster) override { useCluster = cluster; }
+    void setStripedTransfers(bool striped) override { useStriping = striped; }
+    void setCooperative(bool cooperative) override { useCooperative = cooperative; }
+    bool isCooperative() const override { return cooperativeMode; }
+    int pump() override;
+    void setSendRate(unsigned messagesPerSecond, unsigned burst) override;
+    size_t queuedMessages() const override;
+
+    // Called with the index and history entry of every new message, on whichever
+    // thread added it. Set before connecting, it is not synchronised. Messages
+    // kept encrypted arrive sealed (see MessageStore), messageAt() decrypts them.
+    void setMessageListener(std::function<void(size_t, const std::string&)> listener) { messageListener = std::move(listener); }
+
+    // Bulk streams next to chat on a multiplexed connection. They get the
+    // link by weight and never hold up chat by more than one chunk. One
+    // message is at most a stream window (StreamMux::initialCredit, or
+    // StripeSet::window when striping). The listener runs on the receive
+    // thread, or a striping lane's, one call at a time; set it before connecting.
+    bool openStream(uint32_t stream, unsigned weight) { return mux.openStream(stream, weight); }
+    bool setStreamRate(uint32_t stream, double bytesPerSecond, double burstBytes) { return mux.setStreamRate(stream, bytesPerSecond, burstBytes); }
+    bool sendOnStream(uint32_t stream, std::string data);
+    void setStreamListener(std::function<void(uint32_t, const std::string&)> listener) { streamListener = std::move(listener); }
 
-    bool connectToServer();
-    void disconnect();
-    void sendMessage(const std::string& text);
+    // Lanes the bulk streams are striped over right now, see setStripedTransfers()
+    size_t stripeLanes() const { return stripes.laneCount(); }
 
-    const std::vector<std::string>& getMessages() const;
-    bool isConnectedToServer() const { return isConnected; }
-    bool configure(const char*, const char*, const char*, const char*, const char*);
+    void muteSender(const std::string& name) override;
+    void unmuteSender(const std::string& name) override;
+    std::vector<std::string> mutedSenders() const override;
+    bool isConnectedToServer() const override { return isConnected; }
+    bool configure(const char*, const char*, const char*, const char*, const char*) override;
 
 private:
-    void handleSystemCallError(const std::string& errorMsg);
-    int createClientSocket(const std::string &serverIP, int serverPort);
+    void startConnector();
+    void runConnect();
+    void connectFromList();
+    void watchServers();
+    void reconnect();
+    void closeSession();
+    void onNetworkChange();
+    void dropStale();
+    void replaceSession();
+    void connectToHost();
+    void retireSession();
+    bool attachStream(std::unique_ptr<Transport> stream);
+    void reapSession();
+    void startSession();
     void receiveMessages();
+    void receiveDatagrams();
+    bool receiveMux(uint32_t len);
+    void startStriping();
+    bool deliverStriped(std::string_view frame);
+    void writeFrames();
+    bool takeOutgoing(std::string& frame, std::chrono::milliseconds& wait);
+    bool flushOffline();
+    void keepUnsent();
+    std::string transportPayload(const std::string& frame) const;
+    bool transmitFrame(const std::string& frame);
+    bool sendPacket(const std::string& payload);
+    bool startTls(int sock);
+    void closeTls();
+    bool recvAll(void* buffer, size_t len, bool* closed = nullptr);
+    void spinForInput();
+    void queueSessionStart();
+    bool queueOutgoing(std::chrono::milliseconds& wait);
+    bool writePending();
+    bool readAvailable();
+    void handlePacket(const char* data, uint32_t len);
+    void finishCooperative();
+    bool sendAll(const char* data, size_t len, size_t* sent = nullptr);
+    bool drain(size_t len);
+    bool receivePooled(uint32_t len, BufferPool::Buffer& cipher, BufferPool::Buffer& plain);
+    bool receiveStreamed(uint32_t len);
     void addMessage(const std::string& message);
-    void handleProtocolPacket(const std::string& encryptedData);
-    std::vector<std::string> splitByNewline(const std::string& s);
+    void handleProtocolPacket(std::string_view frame);
+    std::string parseChatHeader(std::string_view frame, ChatFrame::Header& header) const;
+    std::string bindSender(std::string_view frame);
+    bool isMuted(std::string_view name) const;
+    static std::string seal(std::string_view sender, std::string_view cipher);
+    std::string reveal(const std::string& entry) const;
+    std::string journalPath(const char* extension = ".journal") const;
+
+
+    // Replaced only while no receive or writer thread runs
+    std::unique_ptr<Transport> transport;
+    std::atomic<bool> isConnected{false};
+
+    std::thread connector;
+    std::thread receiver;
+    std::atomic<ConnectState> connectStatus{ConnectState::Idle};
+    std::atomic<bool> cancelConnect{false};
+    std::string connectFailure;     // written before connectStatus turns Failed
+
+    // Optional TLS 1.3 transport; replaces the server-password layer, E2EE stays.
+    // ssl is shared by the receive thread and senders, sslMutex guards it.
+    bool useTls = false;
+    ssl_ctx_st* tlsContext = nullptr;
+    ssl_st* ssl = nullptr;
+    bool ktlsSend = false;
+    bool ktlsRecv = false;
+    std::string tlsError;
+    std::mutex sslMutex;
+    std::mutex sendMutex;
+
+    // Optional UDP transport with its own retransmission, see DatagramLink.
+    // datagramMode is fixed for the lifetime of one connection.
+    bool useDatagram = false;
+    bool datagramMode = false;
+    DatagramLink datagramLink;
 
+    // Optional stream multiplexing on TCP; frames are queued in mux and a
+    // writer thread interleaves them. The buffers belong to the receive thread.
+    bool useMux = false;
+    bool muxMode = false;
+    StreamMux mux;
+    std::thread writer;
+    std::function<void(uint32_t, const std::string&)> streamListener;
+    std::vector<char> muxCipher;
+    std::vector<char> muxPlain;
+    std::vector<StreamMux::Delivery> muxDeliveries;
 
-    int clientSocket = -1;
-    bool isConnected = false;
+    // Optional striping of bulk stream chunks over extra connections to the
+    // same server, see StripeSet. Lanes go to laneAddress, where the session's
+    // own connection went: an IPv4 address, or a socket path with port 0.
+    // stripeMode is fixed for the lifetime of one connection.
+    bool useStriping = false;
+    bool stripeMode = false;
+    StripeSet stripes;
+    std::string laneAddress;
+    int lanePort = 0;
 
-    mutable std::mutex chatMutex;
-    std::vector<std::string> chatMessages;
+    // Chat frames wait here, before the transport layer, until the send
+    // bucket lets them go; the writer thread drains it in every mode
+    mutable std::mutex outboxMutex;
+    std::condition_variable outboxReady;
+    std::deque<std::string> outbox;
+    bool outboxPushed = false;
+    TokenBucket sendBucket{defaultSendRate, defaultSendBurst};
+    static constexpr size_t maxOutbox = 1000;
+
+    // Frames sent while no writer thread runs go to disk instead and are
+    // flushed in one batch when the next one starts. Also guarded by outboxMutex.
+    OfflineOutbox offline;
+    bool writerActive = false;
+
+    // Optional numbered senders: the server sends a varint instead of the name
+    bool useNumberedSenders = false;
+    SenderTable senders;
+
+    // Optional low latency mode, see setLowLatency()
+    bool lowLatency = false;
+    int ioCpu = -1;
+
+    // Optional cooperative mode: pump() does the work of the receive and
+    // writer threads on the caller's thread. The buffers belong to it.
+    bool useCooperative = false;
+    std::atomic<bool> cooperativeMode{false};
+    std::string pumpIn;             // received bytes, up to an incomplete packet
+    std::string pumpOut;            // packets not written yet, from pumpOutStart
+    size_t pumpOutStart = 0;
+    std::vector<size_t> offlineEnds;    // where the offline frames not written yet end in pumpOut
+    size_t offlineSending = 0;          // messages in that batch
+
+    // Several servers in the host field: the connector races them and takes
+    // the fastest, see EndpointProbe. The watcher probes them again every
+    // reprobeInterval and reconnects to the fastest healthy one when the
+    // session drops or its server fails failedProbesBeforeFailover rounds in
+    // a row. connectMutex guards starting the connector, servers,
+    // currentServer and serverHost, which the connector sets (and reads
+    // without it), and stayConnected, which connectToServer() sets and only
+    // disconnect() clears.
+    std::vector<Validation::ServerAddress> servers;
+    size_t currentServer = 0;
+    std::string serverHost;         // the one connected to, TLS verifies it
+    std::mutex connectMutex;
+    std::atomic<bool> stayConnected{false};
+    std::thread watcher;
+    std::mutex watchMutex;
+    std::condition_variable watchWake;
+    bool watchStop = false;
+    bool watchKick = false;         // the session dropped, probe right away
+    std::chrono::steady_clock::time_point sessionSince;     // the last session came up, guarded by watchMutex
+    static constexpr std::chrono::milliseconds probeTimeout{3000};
+    static constexpr std::chrono::seconds reprobeInterval{10};
+    static constexpr int failedProbesBeforeFailover = 2;
+
+    // Optional cluster routing: the list is one cluster and this chat tries
+    // its nodes in HashRing order instead of taking the fastest, moving back
+    // to its owner once that answers again. chatPosition is guarded by
+    // connectMutex.
+    std::atomic<bool> useCluster{false};
+    uint64_t chatPosition = 0;
+
+    // Network changes, see NetworkMonitor. For a session whose route moved
+    // the connector starts again at once, instead of waiting for TCP to give
+    // up on the old path; the old session is closed once the new connection
+    // is open, or the connector gave up. A session the server closed is not
+    // brought back. pathMutex guards the addresses.
+    size_t networkListener = 0;
+    std::mutex pathMutex;
+    bool pathKnown = false;         // an IPv4 socket, the addresses are set
+    sockaddr_in localAddress{};
+    sockaddr_in peerAddress{};
+    std::atomic<bool> sessionStale{false};  // for pump() to drop, cooperative mode
+    std::atomic<bool> replacing{false};     // the connector closes the old session
+    std::atomic<bool> serverClosed{false};  // the last session ended with the server's close
+
+    MessageStore history;
+    DuplicateFilter duplicates;     // our own messages too, so the server's echo is dropped
+    std::function<void(size_t, const std::string&)> messageListener;
+    bool persistHistory = true;
+
+    // Lazy decryption: history keeps the E2EE ciphertext and messages are
+    // decrypted when the chat view asks for them
+    bool lazyDecrypt = false;
+    mutable PlaintextCache plaintextCache{256};
+
+    // Muted senders. The views index the strings in mutedNames, so the
+    // receive thread can look up a name without building a std::string.
+    mutable std::mutex muteMutex;
+    std::set<std::string> mutedNames;
+    std::unordered_set<std::string_view> mutedLookup;
 
     std::string ip;
     int port;
@@ -46,8 +294,6 @@ private:
     std::string chatPassword;
     std::string serverPassword;
 
-    const int bufferSize = 10240;
-
     FreiaEncryption::Key sessionKey{};          //E2EE
     FreiaEncryption::Key serverSessionKey{};    //Transport
     bool hasChatKey = false;
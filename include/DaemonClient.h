@@ -0,0 +1,92 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include "ChatSession.h"
+#include "MessageRing.h"
+#include "DaemonProtocol.h"
+
+// A view of a session owned by freia-thiwi-daemon. New messages arrive through
+// the session's shared-memory ring; older rows are fetched over the control
+// socket when the chat view asks for them and only a window of them is kept.
+// Everything but the attach runs on the UI thread.
+class DaemonClient : public ChatSession
+{
+public:
+    DaemonClient() = default;
+    ~DaemonClient() override;
+
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    static bool available();
+
+    // Attaches to a session the daemon already runs, without passwords or KDF.
+    // nullptr when there is no daemon or no session.
+    static DaemonClient* resume();
+
+    bool configure(const char* ip, const char* port, const char* user,
+                   const char* chatPassword, const char* serverPassword) override;
+    void setPersistHistory(bool persist) override { setFlag(DaemonProtocol::persistHistory, persist); }
+    void setLazyDecrypt(bool lazy) override { setFlag(DaemonProtocol::lazyDecrypt, lazy); }
+    void setTlsTransport(bool tls) override { setFlag(DaemonProtocol::tlsTransport, tls); }
+    void setDatagramTransport(bool datagram) override { setFlag(DaemonProtocol::datagramTransport, datagram); }
+    void setMultiplexing(bool multiplex) override { setFlag(DaemonProtocol::multiplexStreams, multiplex); }
+    void setNumberedSenders(bool numbered) override { setFlag(DaemonProtocol::numberedSenders, numbered); }
+    void setLowLatency(bool enabled, int cpu) override;
+    void setClusterRouting(bool cluster) override { setFlag(DaemonProtocol::clusterRouting, cluster); }
+    void setStripedTransfers(bool striped) override { setFlag(DaemonProtocol::stripedTransfers, striped); }
+    // The daemon keeps running the connection on its own threads
+    void setCooperative(bool) override {}
+    bool isCooperative() const override { return false; }
+    int pump() override { return pumpIntervalMs; }
+    void setSendRate(unsigned messagesPerSecond, unsigned burst) override;
+    size_t queuedMessages() const override { return ring.status() >> 16; }
+
+    bool connectToServer() override;
+    void disconnect() override;
+    ConnectState connectState() const override;
+    std::string connectError() const override;
+    bool isConnectedToServer() const override;
+
+    void sendMessage(const std::string& text) override;
+    size_t messageCount() const override;
+    std::string messageAt(size_t index) const override;
+    std::vector<size_t> searchMessages(const std::string& query, size_t limit) const override;
+
+    void muteSender(const std::string& name) override;
+    void unmuteSender(const std::string& name) override;
+    std::vector<std::string> mutedSenders() const override;
+
+private:
+    void setFlag(unsigned flag, bool on) { flags = on ? (flags | flag) : (flags & ~flag); }
+    bool openSocket();
+    bool request(const std::string& payload, std::string& reply) const;
+    bool attachWith(const std::string& payload);
+    void runAttach();
+    void drainRing() const;
+    void cacheRow(size_t index, std::string text) const;
+
+    mutable std::mutex socketMutex;
+    int fd = -1;
+
+    std::string host, port, user, chatPassword, serverPassword;
+    unsigned flags = DaemonProtocol::persistHistory;
+    unsigned sendRate = defaultSendRate;
+    unsigned sendBurst = defaultSendBurst;
+
+    std::thread attacher;
+    std::atomic<ConnectState> attachStatus{ConnectState::Idle};
+    std::string attachFailure;      // written before attachStatus turns Failed
+
+    // UI thread only
+    mutable MessageRing ring;
+    mutable std::map<size_t, std::string> rows;
+    mutable size_t lastIndex = 0;
+    static const size_t maxRows = 4096;
+    static const size_t fetchBlock = 64;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// Control channel between freia-thiwi-daemon and its UI frontends.
+// Frames are [u32 netLen][payload] like on the server connection; a payload
+// is newline separated fields, the last of which may contain anything:
+//
+//   ATTACH  host port user flags chatPassword serverPassword -> OK id ring
+//   LIST                                                     -> OK (id "\t" name)*
+//   RESUME  id                                               -> OK id ring
+//   SEND    text | READ from count | SEARCH limit query
+//   MUTE name | UNMUTE name | MUTED | ERROR | PACE rate burst | CLOSE
+//
+// Replies start with "OK" or "ERR\n<message>". New messages are not sent
+// here, they go out through the session's MessageRing.
+namespace DaemonProtocol
+{
+    static constexpr uint32_t maxFrame = 16 * 1024 * 1024;
+
+    enum AttachFlags : unsigned
+    {
+        persistHistory = 1,
+        lazyDecrypt = 2,
+        tlsTransport = 4,
+        datagramTransport = 8,
+        multiplexStreams = 16,
+        numberedSenders = 32,
+        lowLatency = 64,
+        clusterRouting = 128,
+        stripedTransfers = 256
+    };
+
+    // The upper half of the attach flags holds the CPU to pin a low latency
+    // session's receive thread to, plus one; 0 leaves it unpinned
+    static constexpr unsigned pinnedCpuShift = 16;
+
+    // $XDG_RUNTIME_DIR/freia-thiwi/daemon.sock, the directory is created 0700.
+    // Empty when the directory exists but is not ours alone.
+    std::string socketPath();
+
+    // The other end of a connected Unix socket runs as our user
+    bool peerIsUs(int fd);
+
+    bool sendFrame(int fd, const std::string& payload);
+    bool recvFrame(int fd, std::string& payload);
+
+    // The first `count` fields; the last one runs to the end of the payload.
+    // Returns false when the payload has fewer fields.
+    bool split(std::string_view payload, size_t count, std::vector<std::string_view>& fields);
+
+    // Messages in a READ reply: "<len>\n<bytes>" each
+    void appendBlob(std::string& out, std::string_view blob);
+    bool nextBlob(std::string_view& in, std::string_view& blob);
+}
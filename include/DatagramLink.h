@@ -0,0 +1,146 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <cstdint>
+
+// Reliable message delivery over UDP, for links where one lost TCP segment
+// would hold back everything behind it. Every datagram carries its own
+// sequence number and is acknowledged selectively; lost ones are resent on a
+// timer or as soon as three later datagrams are acknowledged. A message is
+// handed over once all of its fragments are in, whatever happened to the
+// messages before it, so messages may arrive out of order.
+//
+// Datagrams start with a 12 byte header, numbers in network order:
+//
+//   DATA   u8 1, u8 0, u16 fragCount, u32 seq, u32 firstSeq, payload
+//   ACK    u8 2, u8 rangeCount, u16 0, u32 cumulative, (u32 from, u32 to)*
+//   HELLO  u8 3, u8 0, u16 0, u64 nonce          -> echoed back by the server
+//   PING   u8 4, u8 0, u16 0, u32 0, u32 0       -> answered with an ACK
+//   CLOSE  u8 5, u8 0, u16 0, u32 0, u32 0
+//
+// Both directions number their DATA from 0 after the HELLO. A message's
+// fragments use consecutive sequence numbers starting at firstSeq. ACK says
+// every seq below `cumulative` arrived, plus the ranges [from, to) above it.
+//
+// send() may be called from any thread; open(), poll() and close() belong to
+// one receive thread.
+class DatagramLink
+{
+public:
+    DatagramLink();
+    ~DatagramLink() { close(); }
+
+    DatagramLink(const DatagramLink&) = delete;
+    DatagramLink& operator=(const DatagramLink&) = delete;
+
+    // Connects to address:port, a dotted IPv4 address, and waits for the
+    // server to answer a HELLO
+    bool open(const std::string& address, int port, int timeoutMs);
+    void close();
+    bool isOpen() const { return fd != -1; }
+    const std::string& error() const { return failure; }
+
+    // Queues one message; false once the link is dead or too far behind
+    bool send(std::string_view message);
+
+    // Waits up to timeoutMs for datagrams, acknowledges them, resends what is
+    // due and appends every completed message. False when the link died.
+    bool poll(int timeoutMs, std::vector<std::string>& messages);
+
+    // Test hook, off unless called: drop this share of datagrams in both
+    // directions and hold every received one back for delayMs.
+    // tools/datagram_harness.cpp drives two links through it.
+    void setFaultInjection(double loss, int delayMs);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum Type : uint8_t { Data = 1, Ack = 2, Hello = 3, Ping = 4, Close = 5 };
+
+    struct Outgoing
+    {
+        std::string datagram;
+        Clock::time_point sentAt;
+        int sends = 0;
+        bool fastResent = false;
+    };
+
+    struct Partial
+    {
+        uint16_t fragCount = 0;
+        uint16_t received = 0;
+        std::vector<std::string> parts;
+    };
+
+    struct Delayed
+    {
+        Clock::time_point due;
+        std::string datagram;
+    };
+
+    void transmit(const std::string& datagram);
+    void transmitLocked(Outgoing& out, Clock::time_point now);
+    void handleDatagram(std::string_view datagram, std::vector<std::string>& messages);
+    void handleData(std::string_view datagram, std::vector<std::string>& messages);
+    void handleAck(std::string_view datagram);
+    void sendAck();
+    void flushBacklog(Clock::time_point now);
+    void resendDue(Clock::time_point now);
+    void sampleRtt(Clock::duration rtt);
+    bool dropInjected();
+
+    std::atomic<int> fd{-1};
+    std::string failure;
+    std::atomic<bool> dead{false};
+
+    // Sender side, sendMutex guards all of it
+    std::mutex sendMutex;
+    uint32_t nextSeq = 0;
+    std::map<uint32_t, Outgoing> unacked;
+    std::deque<std::string> backlog;        // built, waiting for window space
+    size_t backlogBytes = 0;
+    Clock::duration srtt{};
+    Clock::duration rttvar{};
+    Clock::duration rto = std::chrono::milliseconds(1000);
+    Clock::time_point lastSend;
+
+    // Receiver side, receive thread only
+    uint32_t cumulative = 0;
+    std::set<uint32_t> receivedAbove;
+    std::map<uint32_t, Partial> partials;
+    size_t partialBytes = 0;
+    bool ackPending = false;
+    Clock::time_point lastHeard;
+    Clock::time_point nextTimer;            // earliest resend or keepalive
+
+    // Fault injection
+    double lossRate = 0.0;
+    std::chrono::milliseconds injectedDelay{0};
+    std::deque<Delayed> delayed;
+    std::mutex randomMutex;
+    std::minstd_rand random;
+
+    static constexpr size_t headerSize = 12;
+    static constexpr size_t maxDatagram = 1200;     // stays under common path MTUs
+    static constexpr size_t maxPayload = maxDatagram - headerSize;
+    static constexpr size_t maxWindow = 256;        // datagrams in flight
+    static constexpr size_t maxBacklog = 16 * 1024 * 1024;
+    static constexpr size_t maxPartialBytes = 32 * 1024 * 1024;
+    static constexpr uint32_t maxReorder = 8192;    // seqs accepted beyond cumulative
+    static constexpr size_t maxAckRanges = 128;     // still fits one datagram
+    static constexpr int maxBackoff = 2;            // resend timer grows to 4x at most
+    static constexpr int socketBuffer = 1024 * 1024;
+
+    static constexpr std::chrono::milliseconds minRto{200};
+    static constexpr std::chrono::milliseconds maxRto{3000};
+    static constexpr std::chrono::seconds keepAlive{5};
+    static constexpr std::chrono::seconds idleTimeout{30};
+};
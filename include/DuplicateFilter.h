@@ -0,0 +1,69 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <string_view>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+// Remembers the IDs of recent messages so a frame that arrives twice, or the
+// server's echo of our own message, is dropped before it is decrypted.
+//
+// Two Bloom filter generations cover the time window: IDs go into the newer
+// one, lookups check both, and every window/2 the older one is wiped and
+// becomes the newer. A small set-associative table of recent IDs backs them:
+// a Bloom hit is believed when the exact ID is in its bucket, or when that
+// bucket had to drop IDs the filters may still hold. Once the table (8192
+// IDs) overflows, the filters carry the rest of the window on their own and a
+// false positive in an overflowed bucket drops a message (about 1 in 200 with
+// 8192 IDs in each generation). Memory is fixed, however much traffic there is.
+// Thread safe.
+class DuplicateFilter
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t ivSize = 16;
+
+    // encryptData() starts every ciphertext with a random IV, so the sender and
+    // the IV identify a message: a resent or echoed frame carries the same pair,
+    // a new message never does. Only the first ivSize bytes of cipher are read.
+    static uint64_t messageId(std::string_view sender, std::string_view cipher);
+
+    explicit DuplicateFilter(std::chrono::seconds window = std::chrono::minutes(10));
+
+    // True when id was seen within the window, otherwise it is recorded
+    bool seen(uint64_t id) { return seen(id, Clock::now()); }
+    bool seen(uint64_t id, Clock::time_point now);
+    void clear();
+
+private:
+    static constexpr size_t filterBits = 1 << 17;
+    static constexpr unsigned hashCount = 4;
+    static constexpr size_t exactBuckets = 2048;
+    static constexpr size_t exactWays = 4;
+
+    using Bits = std::array<uint64_t, filterBits / 64>;
+
+    // The oldest ID of a bucket makes room for a new one
+    struct Bucket
+    {
+        std::array<uint64_t, exactWays> ids{};
+        uint8_t next = 0;
+        uint32_t evictedAt = 0;     // generation count when an ID was last dropped
+    };
+
+    void rotate(Clock::time_point now);
+    static bool test(const Bits& bits, uint64_t id);
+    static void set(Bits& bits, uint64_t id);
+    void record(uint64_t id);
+    bool recorded(uint64_t id) const;
+    bool evictedLately(uint64_t id) const;
+
+    std::mutex mutex;
+    Clock::duration halfWindow;
+    std::array<Bits, 2> generations{};
+    size_t current = 0;
+    uint32_t generationCount = 1;
+    Clock::time_point generationStart;
+    std::vector<Bucket> recent;
+};
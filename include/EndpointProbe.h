@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "SocketTransport.h"
+#include "Validation.h"
+
+// Measures several servers at once. Every server is looked up at once, and
+// as soon as its own answer is in a non-blocking connect goes out to each of
+// its addresses; one poll() waits for all of them, so a round takes as long
+// as the slowest answer (or the timeout), not the sum. The TCP handshake is the
+// ping: the chat protocol has no echo frame a server would answer without a
+// login.
+namespace EndpointProbe
+{
+    struct Result
+    {
+        bool healthy = false;               // one of its addresses accepted
+        std::chrono::microseconds rtt{0};   // handshake time of the quickest one
+        std::string error;                  // set when not healthy
+    };
+
+    // "host:port", or the socket path
+    std::string describe(const Validation::ServerAddress& server, int defaultPort);
+
+    // Indexed like servers. A port of 0 in the list means defaultPort.
+    std::vector<Result> probeAll(const std::vector<Validation::ServerAddress>& servers, int defaultPort,
+                                 std::chrono::milliseconds timeout);
+
+    // Same race, but the first connection to complete wins and is kept: all
+    // of them started together, so it is the fastest. nullptr when nothing
+    // accepted within the timeout, errors has the reasons.
+    std::unique_ptr<SocketTransport> connectFastest(const std::vector<Validation::ServerAddress>& servers, int defaultPort,
+                                                    std::chrono::milliseconds timeout, size_t& index,
+                                                    std::chrono::microseconds& rtt, std::string& errors);
+
+    // Same race, but servers are in order of preference: the first one that
+    // accepts wins, as soon as every one ahead of it has failed. Slower
+    // servers further down are not waited for.
+    std::unique_ptr<SocketTransport> connectPreferred(const std::vector<Validation::ServerAddress>& servers, int defaultPort,
+                                                      std::chrono::milliseconds timeout, size_t& index,
+                                                      std::chrono::microseconds& rtt, std::string& errors);
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/epoll.h>
+#include "Task.h"
+
+// A single-threaded epoll loop for coroutines. A task suspends on
+// co_await loop.readable(fd), writable(fd) or sleep(d) and is resumed from
+// run() once that happens, so thousands of sessions share one thread without
+// a thread or a blocking call each. Not thread-safe: spawn and await only
+// from the thread that calls run().
+//
+// Descriptors are watched edge-triggered, so await readable() or writable()
+// only after the call on that fd came back with EAGAIN or EINPROGRESS.
+class EventLoop
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Starts the task on the next turn of run(); its frame is freed when it
+    // returns. An exception escaping it ends the program.
+    void spawn(Task<void> task);
+
+    // Until stop(), or until no task is waiting on anything
+    void run();
+    void stop() { stopping = true; }
+
+    struct IoAwaiter
+    {
+        EventLoop& loop;
+        int fd;
+        uint32_t events;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> waiter) { loop.watch(fd, events, waiter); }
+        void await_resume() const noexcept {}
+    };
+
+    struct SleepAwaiter
+    {
+        EventLoop& loop;
+        Clock::time_point until;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> waiter) { loop.schedule(until, waiter); }
+        void await_resume() const noexcept {}
+    };
+
+    // Resumes on readiness, error or hangup; retry the call to find out which
+    IoAwaiter readable(int fd) { return {*this, fd, EPOLLIN}; }
+    IoAwaiter writable(int fd) { return {*this, fd, EPOLLOUT}; }
+    SleepAwaiter sleep(Clock::duration delay) { return {*this, Clock::now() + delay}; }
+
+    // Resume a suspended task on the next turn, for tasks that wait on each other
+    void post(std::coroutine_handle<> waiter) { ready.push_back(waiter); }
+
+    // Call before closing fd. Tasks waiting on it are resumed and see the error.
+    void forget(int fd);
+
+private:
+    struct Watch
+    {
+        std::coroutine_handle<> reader;
+        std::coroutine_handle<> writer;
+        bool registered = false;
+    };
+
+    struct Timer
+    {
+        Clock::time_point when;
+        uint64_t order;
+        std::coroutine_handle<> waiter;
+
+        bool operator>(const Timer& other) const
+        {
+            return when != other.when ? when > other.when : order > other.order;
+        }
+    };
+
+    // The coroutine that owns a spawned task
+    struct Root;
+    static Root start(EventLoop& loop, Task<void> task);
+
+    void watch(int fd, uint32_t events, std::coroutine_handle<> waiter);
+    void schedule(Clock::time_point when, std::coroutine_handle<> waiter);
+    void poll(int timeoutMs);
+
+    int epollFd = -1;
+    std::unordered_map<int, Watch> watches;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::deque<std::coroutine_handle<>> ready;
+    std::unordered_set<void*> roots;        // frames of spawned tasks still running
+    size_t ioWaiters = 0;
+    uint64_t timerOrder = 0;
+    bool stopping = false;
+};
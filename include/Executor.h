@@ -0,0 +1,117 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// The thread pool for CPU-heavy and blocking jobs: key derivation, bulk
+// decryption, file I/O. One worker per core, started on the first job.
+//
+// Every worker has its own queues. A job posted from a worker stays on that
+// worker's queue, others are spread round robin, and an idle worker steals
+// from the front of a busy one's queue. Interactive jobs start before any bulk
+// job anywhere in the pool, so a history preload cannot delay a login.
+//
+// Do not wait on a future from inside a job: with every worker waiting,
+// nothing is left to run what they wait for.
+class Executor
+{
+public:
+    enum class Priority
+    {
+        Interactive,
+        Bulk
+    };
+    static constexpr size_t priorityCount = 2;
+
+    struct Metrics
+    {
+        size_t threads = 0;
+        uint64_t steals = 0;
+
+        // Indexed by Priority
+        struct Queue
+        {
+            size_t queued = 0;                      // waiting to start
+            uint64_t completed = 0;
+            std::chrono::microseconds meanWait{0};  // posted to started
+            std::chrono::microseconds maxWait{0};
+            std::chrono::microseconds meanRun{0};
+        } queues[priorityCount];
+    };
+
+    explicit Executor(size_t threads = 0);  // 0 = one per core
+    ~Executor();                            // runs what is queued, then joins
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    static Executor& global();
+
+    void post(Priority priority, std::function<void()> job);
+
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(Priority priority, F&& function)
+    {
+        using Result = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(function));
+        std::future<Result> result = task->get_future();
+        post(priority, [task] { (*task)(); });
+        return result;
+    }
+
+    size_t threads() const { return threadCount; }
+    Metrics metrics() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job
+    {
+        std::function<void()> run;
+        Clock::time_point posted;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Job> queues[priorityCount];
+        std::thread thread;
+    };
+
+    struct Counters
+    {
+        std::atomic<size_t> queued{0};
+        std::atomic<uint64_t> completed{0};
+        std::atomic<uint64_t> waitNs{0};
+        std::atomic<uint64_t> maxWaitNs{0};
+        std::atomic<uint64_t> runNs{0};
+    };
+
+    void start();
+    void workerLoop(size_t self);
+    bool take(size_t self, Job& job, size_t& priority);
+    void finish(size_t priority, const Job& job, Clock::time_point started);
+
+    size_t threadCount;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::once_flag started;
+    std::atomic<size_t> nextWorker{0};
+
+    // Idle workers sleep here until something is posted
+    std::mutex idleMutex;
+    std::condition_variable idle;
+    std::atomic<size_t> pending{0};
+    bool stopping = false;
+
+    Counters counters[priorityCount];
+    std::atomic<uint64_t> steals{0};
+};
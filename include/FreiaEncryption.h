@@ -1,6 +1,9 @@
 #pragma once
 #include <string>
 #include <array>
+#include <cstddef>
+
+struct evp_cipher_ctx_st;
 
 namespace FreiaEncryption
 {
@@ -10,8 +13,38 @@ namespace FreiaEncryption
 
     std::string encryptData(const std::string& data, const Key& key);
     std::string decryptData(const std::string& data, const Key& key);
+    std::string decryptData(const char* data, size_t len, const Key& key);
+    // Decrypt into a caller-owned buffer of at least len bytes
+    bool decryptInto(const char* data, size_t len, const Key& key, char* out, size_t& outLen);
     std::string base64_encode(const std::string& in);
     std::string base64_decode(const std::string& in);
     Key deriveKey(const std::string& password);
+    std::string hashHex(const std::string& data);
+
+    // Incremental decryption of an encryptData() payload that arrives in pieces
+    class Decryptor
+    {
+    public:
+        explicit Decryptor(const Key& key) : key(key) {}
+        ~Decryptor();
+
+        Decryptor(const Decryptor&) = delete;
+        Decryptor& operator=(const Decryptor&) = delete;
+
+        // Plaintext is appended to out
+        bool update(const char* data, size_t len, std::string& out);
+        bool finish(std::string& out);
+
+        // Plaintext is written at out + outLen, which has room for len + 16 more bytes
+        bool update(const char* data, size_t len, char* out, size_t& outLen);
+        bool finish(char* out, size_t& outLen);
+
+    private:
+        Key key;
+        evp_cipher_ctx_st* ctx = nullptr;
+        unsigned char iv[16];
+        size_t ivHave = 0;
+        bool failed = false;
+    };
 
 }
@@ -4,6 +4,7 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 #include <GLFW/glfw3.h>
+#include <thread>
 
 class FreiaUI
 {
@@ -12,13 +13,17 @@ public:
     ~FreiaUI();
 
     bool render();
-    ClientConnect* getClient() const { return client; }
-    void setClient(ClientConnect* c) {client = c;}
+    ChatSession* getClient() const { return client; }
+    void setClient(ChatSession* c) {client = c;}
 
 private:
     void renderConnectionPanel();
     void renderChatPanel();
+    void renderSearchBar();
+    void messageContextMenu(int index, const std::string& msg);
+    void runSearch();
     void connectButton();
+    void pollConnect();
     void disconnectButton();
     void clearInputFields();
     void renderMenuBar();
@@ -26,18 +31,39 @@ private:
     void openPopup(const std::string& message);
 
     static const int bufferSize = 1024;
+    static const size_t maxSearchHits = 1000;
 
     char inputBuffer[bufferSize] = "";
-    char IP[20] = "";
+    char IP[256] = "";      // IPv4 address or host name, or a comma separated list
     char Port[10] = "";
     char User[50] = "";
     char ChatPassword[1000] = "";
     char ServerPassword[1000] = "";
+    char searchBuffer[128] = "";
 
+    bool keepHistory = true;
+    bool lazyDecrypt = false;
+    bool tlsTransport = false;
+    bool datagramTransport = false;
+    bool multiplexStreams = false;
+    bool stripedTransfers = false;
+    bool numberedSenders = false;
+    bool clusterRouting = false;
+    bool lowLatency = false;
+    int ioCpu = -1;                                     // -1 = not pinned
+    bool cooperative = std::thread::hardware_concurrency() <= 1;   // on by default on one core
+    int nextPumpMs = ChatSession::pumpIntervalMs;
+    int sendRate = ChatSession::defaultSendRate;      // messages per second, 0 = unpaced
+    int sendBurst = ChatSession::defaultSendBurst;
     bool focusInput = false;
     bool quitRequested = false;
 
-    ClientConnect* client = nullptr;
+    //Search Variables
+    std::vector<size_t> searchHits;     // message indices, oldest first
+    int searchCursor = -1;
+    bool jumpToHit = false;
+
+    ChatSession* client = nullptr;
     ImGuiIO* io = nullptr;
     ImFont* customFont = nullptr;
     GLFWwindow* window = nullptr;
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Consistent hashing of chats onto cluster nodes. Every node gets
+// pointsPerNode points on a 64-bit ring and a key belongs to the first point
+// at or after it, so adding or removing one node only moves the keys next to
+// its points, about 1/N of them.
+//
+// Positions are SHA-256 based: every client that is given the same node
+// names puts every key on the same node.
+class HashRing
+{
+public:
+    static constexpr size_t pointsPerNode = 100;
+
+    HashRing() = default;
+    explicit HashRing(const std::vector<std::string>& nodes);
+
+    // Node indices in the order `key` tries them: its owner first, then
+    // whoever takes over while the ones before are down. Each node once.
+    std::vector<size_t> route(uint64_t key) const;
+
+    size_t size() const { return nodeCount; }
+    static uint64_t position(const std::string& data);
+
+private:
+    struct Point
+    {
+        uint64_t position;
+        size_t node;
+    };
+
+    std::vector<Point> points;      // sorted by position
+    size_t nodeCount = 0;
+};
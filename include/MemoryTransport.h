@@ -0,0 +1,65 @@
+#pragma once
+#include <memory>
+#include <utility>
+#include <vector>
+#include <chrono>
+#include "Transport.h"
+
+// Two endpoints joined in memory, for benchmarks and tests that should depend
+// on neither the kernel network stack nor the wall clock.
+//
+// Time on the link is virtual. A write arrives `latency` after it went out,
+// and with a rate set it first takes size / bytesPerSecond to go out, behind
+// whatever that direction is still sending. A reader that finds nothing
+// deliverable yet moves the clock straight to the next delivery, so a run
+// takes as long as the CPU needs and now() tells how long it would have taken
+// on the simulated link. advance() moves the clock by hand.
+//
+// Reads and writes can be scripted to come back short: with a script of
+// {1, 5, 4096} the next calls move at most 1, then 5, then 4096 bytes and the
+// script starts over. A 0 makes that call fail with EINTR. Set scripts before
+// the endpoint is in use.
+class MemoryTransport : public Transport
+{
+public:
+    using Duration = std::chrono::nanoseconds;
+
+    struct LinkOptions
+    {
+        Duration latency{0};
+        double bytesPerSecond = 0;      // 0 = unlimited
+    };
+
+    using Pair = std::pair<std::unique_ptr<MemoryTransport>, std::unique_ptr<MemoryTransport>>;
+    static Pair pair(LinkOptions options);
+    static Pair pair() { return pair(LinkOptions()); }
+    ~MemoryTransport() override;
+
+    MemoryTransport(const MemoryTransport&) = delete;
+    MemoryTransport& operator=(const MemoryTransport&) = delete;
+
+    ssize_t read(void* buffer, size_t len) override;
+    ssize_t write(const void* data, size_t len) override;
+    bool wait(short events, int timeoutMs) override;
+    void shutdown() override;
+
+    void setReadScript(std::vector<size_t> sizes) { readScript = std::move(sizes); readStep = 0; }
+    void setWriteScript(std::vector<size_t> sizes) { writeScript = std::move(sizes); writeStep = 0; }
+
+    // Virtual time since the pair was made, shared by both ends
+    Duration now() const;
+    void advance(Duration step);
+
+private:
+    struct Link;
+
+    MemoryTransport(std::shared_ptr<Link> link, int side) : link(std::move(link)), side(side) {}
+    static bool nextLimit(const std::vector<size_t>& script, size_t& step, size_t& len);
+
+    std::shared_ptr<Link> link;
+    int side;
+    std::vector<size_t> readScript;
+    std::vector<size_t> writeScript;
+    size_t readStep = 0;
+    size_t writeStep = 0;
+};
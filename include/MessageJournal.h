@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <list>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "SegmentFile.h"
+#include "FreiaEncryption.h"
+
+// Chat history on disk as a run of SegmentFiles, oldest first.
+// Only the newest segment is appended to; once it holds segmentRecords messages
+// it is sealed and a new one is started. Messages carry absolute sequence
+// numbers, so dropping the oldest segment for retention renumbers nothing.
+//
+// A sealed segment of a persistent journal is only open while in use: the last
+// maxOpenSealed of them read stay open, the rest are reopened from disk when
+// needed, so a long history does not hold two descriptors per segment.
+class MessageJournal
+{
+public:
+    struct Segment
+    {
+        uint64_t firstSeq = 0;
+        uint64_t bytes = 0;                     // once sealed
+        std::shared_ptr<SegmentFile> file;      // null while a sealed segment is closed
+    };
+
+    MessageJournal() = default;
+    ~MessageJournal() { close(); }
+
+    MessageJournal(const MessageJournal&) = delete;
+    MessageJournal& operator=(const MessageJournal&) = delete;
+
+    bool open(const std::string& basePath, const FreiaEncryption::Key& key);
+    bool openTemp(const FreiaEncryption::Key& key);
+    void close();
+    bool isOpen() const { return !segments.empty(); }
+
+    bool append(const std::string& record);
+    bool read(uint64_t seq, std::string& out);
+
+    uint64_t firstSeq() const { return segments.empty() ? 0 : segments.front().firstSeq; }
+    uint64_t endSeq() const;
+    uint64_t bytes() const;
+    void enforceLimit(uint64_t maxBytes);
+
+    // Sealed segments, newest first. They never change again, so they can be
+    // decrypted on other threads while the journal keeps appending. Their file
+    // may be null, sealedFile() opens it.
+    std::vector<Segment> sealedSegments() const;
+    std::shared_ptr<SegmentFile> sealedFile(uint64_t firstSeq);
+    Segment activeSegment() const { return segments.empty() ? Segment() : segments.back(); }
+    bool dupActiveFds(int& logFd, int& indexFd) const;
+
+private:
+    bool openSegment(uint64_t firstSeq);
+    bool roll();
+    std::deque<Segment>::iterator segmentFor(uint64_t seq);
+    std::shared_ptr<SegmentFile> fileOf(Segment& segment);
+    void release(uint64_t firstSeq);
+    std::string segmentPath(uint64_t firstSeq) const;
+
+    std::string basePath;       // empty for an anonymous spill journal
+    FreiaEncryption::Key key{};
+    std::deque<Segment> segments;
+    uint64_t sealedBytes = 0;
+    std::list<uint64_t> openSealed;     // firstSeq of open sealed segments, most recent first
+
+    static const size_t segmentRecords = 8192;
+    static const size_t maxOpenSealed = 8;
+};
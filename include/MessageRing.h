@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <cstdint>
+
+// New messages of one daemon session, broadcast through POSIX shared memory.
+// The daemon is the only writer and never waits for readers: every frontend
+// keeps its own cursor, and one that falls a whole ring behind is told so and
+// refetches over the control socket. Readers map the ring read-only.
+//
+// The header also carries the session's message count and connection status,
+// so a frontend polls those every frame without a syscall.
+class MessageRing
+{
+public:
+    enum class ReadResult { Empty, Message, Overrun };
+
+    MessageRing() = default;
+    ~MessageRing() { close(); }
+
+    MessageRing(const MessageRing&) = delete;
+    MessageRing& operator=(const MessageRing&) = delete;
+
+    // Writer side; the owner unlinks the name again in close()
+    bool create(const std::string& name, size_t capacity);
+    void publish(uint64_t index, std::string_view text, uint64_t count);
+    // A message without its text, readers fetch it over the control socket
+    void announce(uint64_t index, uint64_t count) { publish(index, std::string_view(), count, true); }
+    void setStatus(uint32_t status);
+    void setCount(uint64_t count);
+
+    // Reader side, starts at the newest message
+    bool attach(const std::string& name);
+    ReadResult next(uint64_t& index, std::string& text, bool& truncated);
+    uint64_t count() const { return header ? header->count.load(std::memory_order_acquire) : 0; }
+    uint32_t status() const { return header ? header->status.load(std::memory_order_acquire) : 0; }
+
+    void close();
+    bool isOpen() const { return header != nullptr; }
+    const std::string& name() const { return shmName; }
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint64_t capacity;                  // data bytes, a power of two
+        std::atomic<uint64_t> head;         // bytes published so far
+        std::atomic<uint64_t> reserve;      // bytes the writer may have started writing
+        std::atomic<uint64_t> count;
+        std::atomic<uint32_t> status;
+        uint32_t reserved;
+    };
+
+    struct RecordHeader
+    {
+        uint64_t index;
+        uint32_t len;
+        uint32_t flags;
+    };
+
+    static const uint32_t truncatedFlag = 1;
+
+    void publish(uint64_t index, std::string_view text, uint64_t count, bool truncated);
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring needs lock-free 64-bit atomics");
+
+    static size_t recordSize(size_t len) { return (sizeof(RecordHeader) + len + 7) & ~size_t(7); }
+    void copyIn(uint64_t offset, const void* src, size_t len);
+    void copyOut(uint64_t offset, void* dst, size_t len) const;
+
+    Header* header = nullptr;
+    char* data = nullptr;
+    size_t mappedBytes = 0;
+    uint64_t cursor = 0;
+    bool owner = false;
+    std::string shmName;
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <deque>
+#include <map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include "MessageJournal.h"
+#include "SearchIndex.h"
+#include "FreiaEncryption.h"
+
+// Chat history backed by an encrypted MessageJournal.
+// Every message is written through to disk, memory only keeps the newest ones,
+// a cache of decrypted older pages and the search index, together bounded by
+// the memory limit.
+// With open() the journal is persistent, otherwise an anonymous spill file.
+class MessageStore
+{
+public:
+    // Entries starting with this byte still hold the E2EE ciphertext of a message
+    // ("\x01" sender "\n" ciphertext) and are only decrypted for display.
+    // They are stored as they are and never indexed, so search does not see them.
+    static constexpr char sealedPrefix = '\x01';
+    static bool isSealed(const std::string& message) { return !message.empty() && message[0] == sealedPrefix; }
+
+    MessageStore() { searchIndex.setLimit(memoryLimit / indexShare); }
+    ~MessageStore();
+
+    bool open(const std::string& path, const FreiaEncryption::Key& key);
+    void setKey(const FreiaEncryption::Key& key);
+    void setMemoryLimit(size_t bytes);
+    void setDiskLimit(uint64_t bytes);
+
+    size_t append(const std::string& message);     // returns the message's index
+    size_t size() const;
+    std::string at(size_t index) const;
+    bool isPreloading() const { return preloadersActive > 0; }
+    std::vector<size_t> search(const std::string& query, size_t limit) const;
+
+private:
+    void appendLocked(const std::string& message);
+    void attachDisk();
+    void loadTail();
+    void trimMemory();
+    bool cachePage(uint64_t seq, std::string text, bool evict) const;
+    void enforceRetention();
+    void indexBatch(uint64_t firstSeq, const std::vector<std::string>& texts) const;
+    void startPreload() const;
+    void preloadSegment(uint64_t firstSeq) const;
+    void indexActive(uint64_t firstSeq, uint64_t endSeq) const;
+    void flushLoop();
+
+    mutable std::mutex mutex;
+
+    // Newest messages. With a journal attached these are also its last records.
+    std::deque<std::string> recent;
+    size_t recentBytes = 0;
+    size_t memoryLimit = 4 * 1024 * 1024;
+    static const size_t screenful = 64;
+
+    mutable MessageJournal journal;
+    uint64_t diskLimit = 64 * 1024 * 1024;
+
+    // Decrypted older messages, keyed by sequence number
+    mutable std::map<uint64_t, std::string> pages;
+    mutable size_t pageBytes = 0;
+
+    // Word index, keyed by sequence number like `pages`. It gets a share of
+    // the memory limit; past it search only covers the newer history.
+    mutable SearchIndex searchIndex;
+    static const size_t indexShare = 4;     // a quarter of memoryLimit
+
+    // History from earlier runs, below preloadEnd, is decrypted by bulk jobs
+    // on all cores, newest first, once the first search needs it. They feed
+    // the search index and fill `pages` while the memory limit allows.
+    mutable std::condition_variable preloadDone;
+    mutable bool preloadCacheFull = false;
+    mutable bool preloadPending = false;
+    uint64_t preloadEnd = 0;
+    mutable std::atomic<int> preloadersActive{0};
+
+    // Batched fsync of the journal
+    std::thread flusher;
+    std::condition_variable flushCv;
+    size_t unsynced = 0;
+    bool stopping = false;
+    static const size_t syncBatch = 64;
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <netinet/in.h>
+
+// Tells listeners that the machine's IPv4 addresses, routes or links changed:
+// another Wi-Fi network, a VPN coming up, a cable pulled. One rtnetlink
+// socket and one thread for the whole process, started with the first
+// listener. A burst of kernel messages (an address, then its routes) is
+// reported once, after it settles.
+//
+// A change does not mean a connection is broken. Listeners check whether
+// their own socket is affected, see routeChanged().
+class NetworkMonitor
+{
+public:
+    NetworkMonitor() = default;
+    ~NetworkMonitor();
+
+    NetworkMonitor(const NetworkMonitor&) = delete;
+    NetworkMonitor& operator=(const NetworkMonitor&) = delete;
+
+    static NetworkMonitor& global();
+
+    // Listeners run on the monitor thread. Once unsubscribe() returns, the
+    // listener is not running and will not run again. 0 when netlink is
+    // not available.
+    size_t subscribe(std::function<void()> listener);
+    void unsubscribe(size_t id);
+
+    // True when the kernel would no longer send from `local` to `peer` (both
+    // IPv4, from getsockname / getpeername): the address is gone, or the
+    // route to the peer now leaves through another one.
+    static bool routeChanged(const sockaddr_in& local, const sockaddr_in& peer);
+
+private:
+    bool start();
+    void workerLoop();
+    bool readEvents();
+
+    std::mutex mutex;               // listeners, and held while they run
+    std::map<size_t, std::function<void()>> listeners;
+    size_t nextId = 1;
+
+    int netlinkFd = -1;
+    int wakeFd = -1;                // eventfd, stops the worker
+    std::thread worker;
+
+    static constexpr std::chrono::milliseconds settleTime{50};
+};
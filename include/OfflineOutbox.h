@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "FreiaEncryption.h"
+
+// Chat frames written while there is no connection, kept until the next one
+// sends them. On disk it is a single append-only file: a header with the
+// offset of the first frame not sent yet, then records with the layout of
+// SegmentFile, [uint32 length, network order][encryptData(frame)], encrypted
+// with the chat key. Sending frames only moves the offset; the file is cut
+// back to its header once everything went out. A record torn by a crash is
+// cut off when the file is opened again. Without a file, by choice or because
+// it could not be opened, the frames are only kept in memory.
+// Not thread safe, the owner serialises access.
+class OfflineOutbox
+{
+public:
+    OfflineOutbox() = default;
+    ~OfflineOutbox() { close(); }
+
+    OfflineOutbox(const OfflineOutbox&) = delete;
+    OfflineOutbox& operator=(const OfflineOutbox&) = delete;
+
+    // Loads whatever an earlier run left behind
+    bool open(const std::string& path, const FreiaEncryption::Key& key);
+    void close();
+
+    // False when writing the file failed; the frame is still kept in memory
+    bool append(const std::string& frame);
+
+    const std::vector<std::string>& frames() const { return pending; }
+    size_t size() const { return pending.size(); }
+    bool empty() const { return pending.empty(); }
+
+    // The first `count` frames went out, the rest stays
+    void drop(size_t count);
+    void clear() { drop(pending.size()); }
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint64_t head;      // offset of the first record not sent yet
+    };
+
+    bool load();
+    bool write(const std::string& frame, uint32_t& recordSize);
+    bool writeHead(uint64_t offset);
+
+    int fd = -1;
+    uint64_t fileSize = 0;
+    uint64_t head = sizeof(Header);
+    std::vector<std::string> pending;
+    std::vector<uint32_t> recordSizes;      // on disk, 0 for frames only in memory
+    FreiaEncryption::Key key{};
+};
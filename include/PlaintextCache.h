@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+// Small LRU of decrypted messages for lazy decryption.
+// Keyed by a hash of the sealed entry, sender and whole ciphertext, which
+// stays valid when history indices shift. Evicted plaintext is wiped.
+class PlaintextCache
+{
+public:
+    explicit PlaintextCache(size_t capacity) : capacity(capacity) {}
+    ~PlaintextCache() { clear(); }
+
+    bool get(const std::string& key, std::string& out);
+    void put(const std::string& key, const std::string& plaintext);
+    void clear();
+
+private:
+    using Entry = std::pair<std::string, std::string>;
+    void evict(std::list<Entry>::iterator it);
+
+    std::mutex mutex;
+    size_t capacity;
+    std::list<Entry> entries;    // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+// Host name -> IPv4 addresses, looked up on a background thread so nothing on
+// the UI thread ever waits for DNS. Answers are cached for their record TTL,
+// so reconnecting to the same host within it skips resolution entirely.
+class Resolver
+{
+public:
+    struct Result
+    {
+        std::vector<std::string> addresses;     // dotted IPv4, in resolver order
+        std::string error;                      // set when addresses is empty
+    };
+
+    Resolver() = default;
+    ~Resolver();
+
+    Resolver(const Resolver&) = delete;
+    Resolver& operator=(const Resolver&) = delete;
+
+    static Resolver& global();
+
+    // IP literals and cached names come back as a ready future.
+    // Concurrent requests for the same name share one lookup.
+    std::shared_future<Result> resolve(const std::string& host);
+
+    // Drop a cached answer, e.g. when none of its addresses accepted a connection
+    void forget(const std::string& host);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        std::vector<std::string> addresses;
+        Clock::time_point expires;
+    };
+
+    struct Pending
+    {
+        std::string host;
+        std::promise<Result> promise;
+    };
+
+    void workerLoop();
+    static Result lookup(const std::string& host, std::chrono::seconds& ttl);
+    static bool queryTtl(const std::string& host, std::chrono::seconds& ttl);
+    static std::string normalize(const std::string& host);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<std::string, Entry> cache;
+    std::map<std::string, std::shared_future<Result>> inFlight;
+    std::deque<Pending> queue;
+    std::thread worker;
+    bool stopping = false;
+
+    // Used when the answer did not come from DNS (hosts file, mDNS, ...)
+    static constexpr std::chrono::seconds defaultTtl{60};
+    static constexpr std::chrono::seconds minTtl{5};
+    static constexpr std::chrono::seconds maxTtl{3600};
+};
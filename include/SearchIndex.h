@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+// Inverted index over chat history: lowercase word -> message sequence numbers.
+// Words live in a sorted map, so a prefix query is a range scan.
+// Fed on the receive path and by the history preloaders, queried by the UI.
+//
+// The index holds at most its limit in bytes (estimated): past it the oldest
+// quarter of what it covers is dropped, and nothing older is taken again.
+class SearchIndex
+{
+public:
+    void add(uint64_t seq, const std::string& text);
+    void prune(uint64_t firstSeq);
+    void clear();
+
+    void setLimit(size_t bytes);
+    size_t size() const;                // bytes, estimated
+    uint64_t coveredFrom() const;       // older messages are not indexed
+
+    // Messages matching every word of the query as a prefix, oldest first.
+    // Only the newest `limit` hits are returned.
+    std::vector<uint64_t> find(const std::string& query, size_t limit);
+
+    static std::vector<std::string> tokenize(const std::string& text);
+
+private:
+    struct Posting
+    {
+        std::vector<uint64_t> seqs;
+        bool sorted = true;
+    };
+
+    void insert(const std::string& text, uint64_t seq);
+    void dropBelow(uint64_t seq);
+    void shrink();
+    std::vector<uint64_t> lookupPrefix(const std::string& prefix);
+
+    // A map node and an empty vector, roughly
+    static constexpr size_t wordOverhead = 96;
+
+    mutable std::mutex mutex;
+    std::map<std::string, Posting> words;
+    size_t bytes = 0;
+    size_t limit = SIZE_MAX;
+    uint64_t floor = 0;                 // nothing older is indexed
+    uint64_t lowest = UINT64_MAX;       // oldest and newest seq indexed
+    uint64_t highest = 0;
+};
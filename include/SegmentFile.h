@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "FreiaEncryption.h"
+
+// Append-only file of records encrypted with the chat key.
+// Layout per record: [uint32 length, network order][encryptData(record)]
+// Next to the log lives an index file of record offsets. Both are mmap'd, so
+// opening a segment costs the same no matter how many records it holds.
+class SegmentFile
+{
+public:
+    SegmentFile() = default;
+    ~SegmentFile();
+
+    SegmentFile(const SegmentFile&) = delete;
+    SegmentFile& operator=(const SegmentFile&) = delete;
+
+    bool open(const std::string& path, const FreiaEncryption::Key& key);
+    bool openTemp(const FreiaEncryption::Key& key);
+    static void removeFiles(const std::string& path);
+    void close();
+    bool isOpen() const { return fd != -1; }
+    bool isTemp() const { return path.empty(); }
+    const std::string& filePath() const { return path; }
+
+    bool append(const std::string& record);
+    bool read(size_t index, std::string& out);
+
+    size_t count() const { return recordCount; }
+    uint64_t bytes() const { return fileSize; }
+    uint64_t offsetOf(size_t index) const;
+
+    // Decrypt every record. Only reads through pread and the index mapping, so it
+    // may run on another thread once the segment is sealed (no more appends).
+    bool decryptAll(std::vector<std::string>& out) const;
+
+    // Descriptors that stay valid after this segment is closed, so syncing can
+    // run without holding the owner's lock.
+    bool dupFds(int& logFd, int& indexFd) const;
+    static bool syncFds(int logFd, int indexFd);
+
+private:
+    struct IndexHeader
+    {
+        char magic[8];
+        uint64_t count;
+        uint32_t checkLen;
+        uint32_t reserved;
+        unsigned char check[40];
+    };
+
+    bool attach(int logFd, int indexFd, bool fresh);
+    bool writeHeader();
+    bool verifyKey() const;
+    bool recover();
+    bool pushOffset(uint64_t offset);
+    bool growIndex(uint64_t capacity);
+    bool remap(uint64_t needed);
+    void unmap();
+    IndexHeader* header() const { return reinterpret_cast<IndexHeader*>(indexMap); }
+    uint64_t* offsets() const { return reinterpret_cast<uint64_t*>(indexMap + sizeof(IndexHeader)); }
+
+    std::string path;
+    int fd = -1;
+    int indexFd = -1;
+
+    unsigned char* map = nullptr;
+    size_t mapSize = 0;
+    uint64_t fileSize = 0;
+
+    unsigned char* indexMap = nullptr;
+    size_t indexMapSize = 0;
+    uint64_t indexCapacity = 0;
+    size_t recordCount = 0;
+
+    FreiaEncryption::Key key{};
+};
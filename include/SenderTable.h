@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+// Sender names the server numbered for this session. With numbered senders a
+// chat frame carries a varint instead of the name, and the table turns it back
+// into the interned name and whether that sender is muted, both by index.
+//
+//   SIDS1\n                                  client asks for numbered senders
+//   SNDR1\n varint id, name                  server binds id to name
+//   PROT2\n varint id, varint len, cipher    like PROT1, sender by number
+//
+// Varints are LEB128. Bindings last until the connection ends; names stay
+// interned across connections, up to maxSenders of them. Thread safe.
+class SenderTable
+{
+public:
+    static constexpr size_t maxSenders = 65536;
+
+    static bool readVarint(std::string_view& in, uint64_t& value);
+    static void writeVarint(std::string& out, uint64_t value);
+
+    // False for an id or name that cannot be used, or a new name once
+    // maxSenders are interned
+    bool bind(uint64_t id, std::string_view name, bool muted);
+
+    // The view stays valid as long as the table
+    bool lookup(uint64_t id, std::string_view& name, bool& muted) const;
+
+    void setMuted(std::string_view name, bool muted);
+
+    // A new connection numbers its senders afresh
+    void resetBindings();
+
+private:
+    uint32_t intern(std::string_view name);
+
+    mutable std::mutex mutex;
+    std::deque<std::string> names;      // a deque keeps the views stable, never shrinks
+    std::vector<bool> muted;            // by interned index
+    std::unordered_map<std::string_view, uint32_t> byName;
+    std::vector<uint32_t> byWire;       // wire id -> interned index + 1
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include "ClientConnect.h"
+#include "MessageRing.h"
+
+// Headless owner of chat sessions. The connection, keys and history outlive
+// any UI: frontends attach over a UNIX socket (see DaemonProtocol) and read
+// new messages from the session's MessageRing. Closing a window only detaches.
+class SessionDaemon
+{
+public:
+    SessionDaemon() = default;
+    ~SessionDaemon();
+
+    SessionDaemon(const SessionDaemon&) = delete;
+    SessionDaemon& operator=(const SessionDaemon&) = delete;
+
+    bool listen(const std::string& socketPath);
+    void run();     // accept loop, returns after stop()
+    void stop() { stopping = true; }
+
+private:
+    struct Session
+    {
+        uint64_t id = 0;
+        std::string name;       // user@host:port
+        std::string secret;     // hash of both passwords, checked on re-attach
+        ClientConnect client;
+        MessageRing ring;
+        std::mutex ringMutex;   // publish() has a single writer
+    };
+
+    void serve(int fd, uint64_t worker);
+    std::string handle(std::string_view request, std::shared_ptr<Session>& session);
+    std::shared_ptr<Session> attach(const std::vector<std::string_view>& fields, std::string& error);
+    void publishStatus();
+    static uint32_t statusOf(ClientConnect& client);
+
+    int listenFd = -1;
+    std::string path;
+    std::atomic<bool> stopping{false};
+
+    std::mutex mutex;
+    std::map<uint64_t, std::shared_ptr<Session>> sessions;
+    uint64_t nextId = 1;
+    std::set<int> frontendFds;
+    std::vector<uint64_t> finished;     // workers whose frontend went away
+
+    static const size_t ringCapacity = 4 * 1024 * 1024;
+};
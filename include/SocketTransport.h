@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <atomic>
+#include "Transport.h"
+
+// A connected stream socket, TCP or UNIX. Owns the descriptor.
+class SocketTransport : public Transport
+{
+public:
+    explicit SocketTransport(int fd) : sock(fd) {}
+    ~SocketTransport() override;
+
+    SocketTransport(const SocketTransport&) = delete;
+    SocketTransport& operator=(const SocketTransport&) = delete;
+
+    // nullptr when the connection could not be made, the reason goes to
+    // stderr. An attempt is given up after 3 s, or soon after cancel is set.
+    static std::unique_ptr<SocketTransport> connectTcp(const std::string& address, int port,
+                                                       const std::atomic<bool>* cancel = nullptr);
+    static std::unique_ptr<SocketTransport> connectUnix(const std::string& path, const std::atomic<bool>* cancel = nullptr);
+
+    ssize_t read(void* buffer, size_t len) override;
+    ssize_t write(const void* data, size_t len) override;
+    bool wait(short events, int timeoutMs) override;
+    void shutdown() override;
+    int fd() const override { return sock; }
+
+private:
+    int sock = -1;
+};
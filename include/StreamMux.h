@@ -0,0 +1,135 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "TokenBucket.h"
+
+// Several logical streams over one connection. Messages are cut into chunks
+// and the chunks of all streams are interleaved by deficit round robin, so a
+// chat message never waits behind more than one chunk of a bulk transfer.
+// Every stream also has a credit window: it stops sending once the peer holds
+// initialCredit bytes of it that it has not delivered yet. A message is at
+// most one window, and the messages of all streams that take more than one
+// chunk are only started while they fit in maxReassembly together, which is
+// all the peer ever buffers for us.
+//
+// A mux frame is the payload of one [u32 netLen] frame, before the transport
+// layer encrypts it:
+//
+//   u32 stream, u8 flags, payload
+//
+// flags 1 marks the last chunk of a message, flags 2 a credit update whose
+// payload is the u32 number of bytes consumed. Both sides start every stream
+// with the same window, initialCredit unless the session agreed on another.
+//
+// A session may also agree on a session window over the bulk frames of all
+// streams together, header included. The receiver returns it on
+// sessionStream as soon as it has taken a frame in, so it only bounds what is
+// in flight, not what waits for reassembly or delivery.
+//
+// enqueue() may be called from any thread, nextFrame() from one writer thread
+// and receive() from reader threads, one at a time for any one stream.
+class StreamMux
+{
+public:
+    static constexpr uint32_t sessionStream = 0;    // credit updates for the session window
+    static constexpr uint32_t chatStream = 1;
+    static constexpr unsigned chatWeight = 8;
+    static constexpr size_t headerSize = 5;
+    static constexpr size_t chunkSize = 16 * 1024;
+    static constexpr size_t maxFrame = headerSize + chunkSize;
+    static constexpr uint32_t initialCredit = 256 * 1024;
+    static constexpr uint8_t endFlag = 1;
+    static constexpr uint8_t creditFlag = 2;
+    static constexpr size_t maxInbound = 64;        // streams the peer may have open to us
+    static constexpr size_t maxReassembly = 16 * 1024 * 1024;
+
+    struct Delivery
+    {
+        uint32_t stream;
+        std::string message;
+    };
+
+    StreamMux() { openStream(chatStream, chatWeight); }
+
+    // Weight is the stream's share of the link relative to the others
+    bool openStream(uint32_t stream, unsigned weight);
+    void closeStream(uint32_t stream);
+
+    // Caps one stream at bytesPerSecond on top of its weight, 0 lifts the cap
+    bool setStreamRate(uint32_t stream, double bytesPerSecond, double burstBytes);
+
+    // False for an unknown stream, an empty message, one larger than the
+    // stream window or a full queue
+    bool enqueue(uint32_t stream, std::string message);
+
+    // The next frame to write: credit updates first, then chunks by weight.
+    // False after timeout or once stop() was called.
+    bool nextFrame(std::string& frame, std::chrono::milliseconds timeout);
+    void stop();
+
+    // Makes a waiting nextFrame() return early, e.g. when the caller has
+    // other work that became due
+    void interrupt();
+
+    // True while a stream other than chat has data that has not gone out
+    bool bulkWaiting();
+
+    // New connection: queues are dropped and credits start over at
+    // streamWindow, and at sessionLimit for the session window (0 for none)
+    void reset(uint32_t streamWindow = initialCredit, uint32_t sessionLimit = 0);
+
+    // Appends every message the frame completes; false for a malformed frame
+    // or one the peer should not have sent yet
+    bool receive(std::string_view frame, std::vector<Delivery>& delivered);
+
+private:
+    struct Outbound
+    {
+        unsigned weight = 1;
+        std::deque<std::string> queue;
+        size_t offset = 0;          // into queue.front()
+        size_t queuedBytes = 0;
+        int64_t credit = initialCredit;
+        size_t deficit = 0;
+        TokenBucket pace;
+    };
+
+    struct Inbound
+    {
+        std::string partial;
+        uint32_t consumed = 0;      // delivered, not yet returned as credit
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    bool pickChunk(std::string& frame, Clock::time_point now);
+    static bool multiChunk(const std::string& message) { return message.size() > chunkSize; }
+    size_t sendable(uint32_t id, Outbound& stream, Clock::time_point now);
+    static std::string makeFrame(uint32_t stream, uint8_t flags, std::string_view payload);
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::map<uint32_t, Outbound> outbound;
+    std::map<uint32_t, Inbound> inbound;
+    std::deque<std::string> control;
+    uint32_t window = initialCredit;
+    uint32_t sessionWindow = 0;
+    int64_t sessionCredit = 0;
+    uint32_t sessionConsumed = 0;   // taken in, not yet returned
+    size_t started = 0;             // multi-chunk messages we are partway through sending
+    size_t reassembling = 0;        // bytes of unfinished messages from the peer
+    uint32_t cursor = 0;            // stream whose turn it is
+    bool turnStarted = false;
+    bool stopping = false;
+    bool interrupted = false;
+    Clock::time_point nextRefill;   // earliest time a paced stream can go again
+
+    static constexpr size_t maxQueued = 16 * 1024 * 1024;
+};
@@ -0,0 +1,156 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include "StreamMux.h"
+#include "Transport.h"
+
+// Bulk stream chunks striped over extra connections ("lanes") to the same
+// server. One TCP connection moves at most its congestion window per round
+// trip; on a long fat link several of them together get further. Chat never
+// leaves the session's own connection.
+//
+// Striped chunks are numbered and the receiver puts them back in order before
+// StreamMux sees them, so any chunk may take any lane. A stripe frame is
+//
+//   u64 seq, mux frame
+//
+// sent on a lane as one [u32 netLen] packet through the transport layer, or,
+// while no lane is up, as the payload of a mux frame on stripeStream over the
+// session's connection. A lane's first packet is "LANE1\n<token>\n" with the
+// token the session announced in its first chat frame, announcement().
+//
+// Either side retires a lane by shutting down its sending half; the other
+// stops writing to it and does the same, and both read until EOF, so nothing
+// in flight is lost. Any other lane error may have lost chunks, and the
+// session fails with it.
+//
+// The number of lanes follows measured throughput: while bulk data keeps
+// waiting to go out, one more is opened as long as the last one made the
+// transfer faster by minGain, and closed again when it did not.
+class StripeSet
+{
+public:
+    static constexpr uint32_t stripeStream = 0xffffffff;
+    static constexpr size_t seqSize = sizeof(uint64_t);
+    static constexpr size_t maxFrame = StreamMux::headerSize + seqSize + StreamMux::maxFrame;
+
+    // Striped sessions give every stream this much credit, so a stream is
+    // not held to initialCredit per round trip
+    static constexpr uint32_t window = 4 * 1024 * 1024;
+
+    static constexpr size_t initialLanes = 2;
+    static constexpr size_t maxLanes = 8;
+    static constexpr std::chrono::milliseconds adaptInterval{500};
+    static constexpr double minGain = 0.1;
+    static constexpr int holdIntervals = 20;        // after a lane that did not help
+    // The session window of striped sessions: bulk frames of all streams on
+    // their way at once, which is also all receive() holds back to put them
+    // in order
+    static constexpr uint32_t reorderWindow = 8 * 1024 * 1024;
+
+    struct Callbacks
+    {
+        std::function<std::unique_ptr<Transport>(const std::atomic<bool>&)> connect;  // nullptr on failure or once the flag is set
+        std::function<std::string(const std::string&)> seal;             // transport layer, empty on failure
+        std::function<std::string(const char*, size_t)> open;            // empty on failure
+        std::function<bool(const std::string&)> sendPrimary;             // a mux frame, on the session's connection
+        std::function<bool(std::string_view)> deliver;                   // in order; false for a bad frame
+        std::function<void(const std::string&)> fail;                    // the session cannot go on
+        std::function<bool()> backlogged;                                // bulk data waits to be sent
+    };
+
+    StripeSet() = default;
+    ~StripeSet();
+
+    StripeSet(const StripeSet&) = delete;
+    StripeSet& operator=(const StripeSet&) = delete;
+
+    // A new token and numbering; lanes are opened in the background
+    void start(Callbacks callbacks);
+
+    // stop() wakes every thread and may be called from any of them, join()
+    // waits for them and must not be
+    void stop();
+    void join();
+
+    // The chat frame that tells the server which lanes belong to the session
+    std::string announcement() const;
+
+    // Bulk data chunks are striped, credit updates and chat are not
+    static bool carries(std::string_view muxFrame);
+
+    // A mux frame on stripeStream, its payload is for receive()
+    static bool onStripeStream(std::string_view muxFrame);
+
+    // Numbers a chunk and queues it for the lanes, or sends it on the
+    // session's connection while none is up. From the writer thread.
+    bool send(std::string muxFrame);
+
+    // A stripe frame from the session's connection, from its receive thread
+    bool receive(std::string_view frame);
+
+    size_t laneCount() const;
+    double throughput() const { return measuredRate; }      // bytes/s, while backlogged
+
+private:
+    struct Lane
+    {
+        std::unique_ptr<Transport> transport;
+        std::thread reader;
+        std::thread writer;
+        bool retiring = false;      // no new frames, guarded by mutex
+        std::atomic<bool> finished{false};
+        std::atomic<bool> writerDone{false};
+    };
+
+    void control();
+    void adapt(bool saturated, uint64_t bytes);
+    bool openLane();
+    void retireNewest();
+    void reap(bool all);
+    void writeLane(Lane* lane);
+    void readLane(Lane* lane);
+    std::deque<std::string> retire(Lane* lane);
+    void sendStranded(std::deque<std::string> frames);
+    bool sendOnPrimary(const std::string& stripeFrame);
+    void failed(const std::string& reason);
+
+    Callbacks callbacks;
+    std::string token;
+
+    mutable std::mutex mutex;                   // lanes, queue, openLanes, stopping
+    std::condition_variable queueReady;
+    std::condition_variable controlWake;
+    std::vector<std::unique_ptr<Lane>> lanes;
+    std::deque<std::string> queue;              // stripe frames for the lanes
+    size_t openLanes = 0;                       // not retiring
+    bool stopping = false;
+    std::atomic<bool> cancelConnect{false};     // stop() ends a lane connect in progress
+
+    std::thread controller;
+
+    uint64_t nextOut = 0;                       // writer thread only
+    std::mutex receiveMutex;                    // the reorder buffer, and held while delivering
+    std::map<uint64_t, std::string> early;
+    size_t earlyBytes = 0;
+    uint64_t nextIn = 0;
+
+    // Measured by the controller over adaptInterval; the rest is its own
+    std::atomic<uint64_t> sentBytes{0};
+    std::atomic<double> measuredRate{0};
+    double baseRate = 0;                        // before the trial lane
+    bool trialLane = false;
+    int hold = 0;
+    std::atomic<bool> failing{false};
+};
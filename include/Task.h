@@ -0,0 +1,116 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+// A coroutine that starts when it is co_awaited and hands its result to the
+// awaiter. Finishing resumes the awaiter directly (symmetric transfer), so
+// long chains of tasks do not grow the stack. EventLoop::spawn() runs a
+// Task<void> that nobody awaits. C++20, built with FREIA_COROUTINES.
+template <typename T>
+class Task;
+
+namespace TaskDetail
+{
+    struct PromiseBase
+    {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> done) noexcept
+            {
+                std::coroutine_handle<> next = done.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    template <typename T>
+    struct Promise : PromiseBase
+    {
+        std::optional<T> value;
+
+        Task<T> get_return_object();
+
+        template <typename U>
+        void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+    };
+
+    template <>
+    struct Promise<void> : PromiseBase
+    {
+        Task<void> get_return_object();
+        void return_void() {}
+    };
+}
+
+template <typename T>
+class Task
+{
+public:
+    using promise_type = TaskDetail::Promise<T>;
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return handle.done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+
+    T await_resume()
+    {
+        if (handle.promise().error)
+            std::rethrow_exception(handle.promise().error);
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*handle.promise().value);
+    }
+
+private:
+    friend promise_type;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+Task<T> TaskDetail::Promise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskDetail::Promise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <chrono>
+
+// Classic token bucket: `rate` tokens per second flow in, at most `burst`
+// are kept. A cost larger than the burst is let through once the bucket is
+// full and leaves it in debt, so nothing is stuck forever. Not thread safe,
+// the owner serialises access.
+class TokenBucket
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket() = default;
+    TokenBucket(double rate, double burst) { configure(rate, burst); }
+
+    // A rate of 0 switches limiting off; the bucket starts full
+    void configure(double rate, double burst);
+    bool limited() const { return ratePerSecond > 0; }
+    double rate() const { return ratePerSecond; }
+    double burst() const { return capacity; }
+
+    // How long until `cost` can be taken, zero when it can be taken now
+    Clock::duration delayFor(double cost, Clock::time_point now);
+    bool tryTake(double cost, Clock::time_point now);
+
+private:
+    void refill(Clock::time_point now);
+
+    double ratePerSecond = 0;
+    double capacity = 0;
+    double tokens = 0;
+    Clock::time_point last;
+};
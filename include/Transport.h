@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <sys/types.h>
+
+// The byte stream under a chat connection. ClientConnect only reads, writes,
+// waits on and shuts down its transport, so the same session code runs over
+// TCP, a UNIX socket or MemoryTransport's simulated link.
+//
+// read() and write() behave like recv() and send(): the number of bytes moved,
+// 0 from read() once the peer closed, -1 with errno set otherwise (EINTR means
+// try again, EAGAIN means wait() first). One thread may read while another
+// writes; shutdown() may be called from any thread and wakes both.
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+    virtual ssize_t read(void* buffer, size_t len) = 0;
+    virtual ssize_t write(const void* data, size_t len) = 0;
+
+    // POLLIN and/or POLLOUT; false on timeout, error or shutdown. -1 waits forever.
+    virtual bool wait(short events, int timeoutMs) = 0;
+    virtual void shutdown() = 0;
+
+    // The socket underneath, for TLS; -1 when there is none
+    virtual int fd() const { return -1; }
+};
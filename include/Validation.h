@@ -1,9 +1,23 @@
 #pragma once
 #include <string>
+#include <vector>
 
 namespace Validation
 {
+    struct ServerAddress
+    {
+        std::string host;           // as isValidHost accepts it
+        int port = 0;               // 0 = the port given separately
+    };
+
     bool isValidIP(const std::string& ip);
+    bool isValidHost(const std::string& host);
+    bool isUnixSocketAddress(const std::string& host);
+
+    // "a.example, 10.0.0.2:7001, unix:/run/chat.sock": one or more hosts,
+    // each with an optional port. Empty when any entry is invalid.
+    std::vector<ServerAddress> parseServerList(const std::string& list);
+    bool isValidServerList(const std::string& list);
     bool isValidPort(const std::string& portStr);
     bool isValidUser(const std::string& user);
     bool isValidPassword(const std::string& password);
@@ -0,0 +1,282 @@
+#include "AsyncSession.h"
+#include "ChatFrame.h"
+#include "Resolver.h"
+#include "Validation.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+AsyncSession::~AsyncSession()
+{
+    close();
+}
+
+bool AsyncSession::configure(
+    const char* ip,
+    const char* port,
+    const char* user,
+    const char* chatPassword,
+    const char* serverPassword)
+{
+    if (!Validation::isValidPassword(chatPassword)) return false;
+    if (!Validation::isValidPassword(serverPassword)) return false;
+
+    return configure(ip, port, user,
+                     FreiaEncryption::deriveKey(chatPassword),
+                     FreiaEncryption::deriveKey(serverPassword));
+}
+
+bool AsyncSession::configure(
+    const char* ip,
+    const char* port,
+    const char* user,
+    const FreiaEncryption::Key& chatKey,
+    const FreiaEncryption::Key& serverKey)
+{
+    if (!Validation::isValidHost(ip)) return false;
+    if (!Validation::isValidPort(port)) return false;
+    if (!Validation::isValidUser(user)) return false;
+
+    this->ip = ip;
+    this->port = std::atoi(port);
+    this->user = user;
+    this->chatKey = chatKey;
+    this->serverKey = serverKey;
+    return true;
+}
+
+Task<bool> AsyncSession::connect()
+{
+    close();
+
+    if (Validation::isUnixSocketAddress(ip))
+    {
+        sockaddr_un serverAddress{};
+        serverAddress.sun_family = AF_UNIX;
+        std::string path = ip.substr(5);
+        std::memcpy(serverAddress.sun_path, path.data(), path.size());
+        co_return co_await connectTo(AF_UNIX, reinterpret_cast<const sockaddr*>(&serverAddress), sizeof(serverAddress));
+    }
+
+    // The resolver answers on its own thread; look again every few milliseconds
+    std::shared_future<Resolver::Result> lookup = Resolver::global().resolve(ip);
+    while (lookup.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        co_await loop.sleep(std::chrono::milliseconds(10));
+
+    const Resolver::Result& result = lookup.get();
+    if (result.addresses.empty())
+    {
+        std::cerr << "Failed to resolve " << ip << ": " << result.error << "\n";
+        co_return false;
+    }
+
+    for (const std::string& address : result.addresses)
+    {
+        sockaddr_in serverAddress{};
+        serverAddress.sin_family = AF_INET;
+        serverAddress.sin_port = htons(port);
+        if (inet_pton(AF_INET, address.c_str(), &serverAddress.sin_addr) <= 0)
+            continue;
+        if (co_await connectTo(AF_INET, reinterpret_cast<const sockaddr*>(&serverAddress), sizeof(serverAddress)))
+            co_return true;
+    }
+
+    // The cached answer may be stale
+    Resolver::global().forget(ip);
+    co_return false;
+}
+
+Task<bool> AsyncSession::connectTo(int domain, const sockaddr* address, socklen_t addressLen)
+{
+    int fd = socket(domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        std::cerr << "Failed to create socket, errno: " << errno << "\n";
+        co_return false;
+    }
+
+    int error = 0;
+    if (::connect(fd, address, addressLen) == -1)
+    {
+        error = errno;
+        if (error == EINPROGRESS || error == EAGAIN)
+        {
+            co_await loop.writable(fd);
+            socklen_t errorLen = sizeof(error);
+            if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1)
+                error = errno;
+        }
+    }
+
+    if (error != 0)
+    {
+        std::cerr << "Connection failed, errno: " << error << "\n";
+        loop.forget(fd);
+        ::close(fd);
+        co_return false;
+    }
+
+    sock = fd;
+    bytesQueued = 0;
+    bytesSent = 0;
+    co_return true;
+}
+
+Task<bool> AsyncSession::send(std::string text)
+{
+    if (sock == -1 || text.empty())
+        co_return false;
+
+    // E2EE, the PROT1 frame, then the transport layer
+    std::string chatCipher = FreiaEncryption::encryptData(text, chatKey);
+    if (chatCipher.empty())
+        co_return false;
+    std::string payload = FreiaEncryption::encryptData(ChatFrame::build(user, chatCipher), serverKey);
+    if (payload.empty())
+        co_return false;
+
+    uint32_t netLen = htonl(static_cast<uint32_t>(payload.size()));
+    outgoing.append(reinterpret_cast<const char*>(&netLen), sizeof(netLen));
+    outgoing.append(payload);
+    bytesQueued += sizeof(netLen) + payload.size();
+    uint64_t target = bytesQueued;
+
+    // Whoever is already writing takes these bytes along
+    while (flushing && bytesSent < target && sock != -1)
+        co_await FlushWait{*this};
+
+    if (bytesSent >= target)
+        co_return true;
+    if (sock == -1)
+        co_return false;
+    co_return co_await flush();
+}
+
+Task<bool> AsyncSession::flush()
+{
+    flushing = true;
+    bool ok = true;
+    while (outgoingStart < outgoing.size())
+    {
+        ssize_t n = ::send(sock, outgoing.data() + outgoingStart, outgoing.size() - outgoingStart, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            outgoingStart += n;
+            bytesSent += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            co_await loop.writable(sock);
+            if (sock != -1)
+                continue;
+        }
+
+        ok = false;
+        close();
+        break;
+    }
+
+    outgoing.clear();
+    outgoingStart = 0;
+    flushing = false;
+    for (std::coroutine_handle<> waiter : flushWaiters)
+        loop.post(waiter);
+    flushWaiters.clear();
+    co_return ok;
+}
+
+Task<std::optional<AsyncSession::Message>> AsyncSession::next()
+{
+    char chunk[readChunk];
+    while (sock != -1)
+    {
+        if (std::optional<Message> message = takeMessage())
+            co_return message;
+
+        if (incomingStart == incoming.size())
+        {
+            incoming.clear();
+            incomingStart = 0;
+        }
+        else if (incomingStart > readChunk && incomingStart * 2 > incoming.size())
+        {
+            incoming.erase(0, incomingStart);
+            incomingStart = 0;
+        }
+
+        ssize_t n = recv(sock, chunk, sizeof(chunk), 0);
+        if (n > 0)
+        {
+            incoming.append(chunk, n);
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            co_await loop.readable(sock);
+            continue;
+        }
+
+        close();
+    }
+    co_return std::nullopt;
+}
+
+std::optional<AsyncSession::Message> AsyncSession::takeMessage()
+{
+    if (incoming.size() - incomingStart >= sizeof(uint32_t))
+    {
+        uint32_t netLen;
+        std::memcpy(&netLen, incoming.data() + incomingStart, sizeof(netLen));
+        uint32_t len = ntohl(netLen);
+        if (len == 0 || len > maxPacket)
+        {
+            close();
+            return Message{"", "[Error] Invalid message length received."};
+        }
+        if (incoming.size() - incomingStart - sizeof(netLen) < len)
+            return std::nullopt;
+
+        const char* packet = incoming.data() + incomingStart + sizeof(netLen);
+        incomingStart += sizeof(netLen) + len;
+
+        std::string frame = FreiaEncryption::decryptData(packet, len, serverKey);
+        if (frame.empty())
+            return Message{"", "[Decryption failed]"};
+
+        ChatFrame::Header header;
+        std::string error = ChatFrame::parseHeader(frame, header);
+        if (!error.empty())
+            return Message{"", error};
+        // The ciphertext fills the rest of the frame, as in ClientConnect
+        if (header.cipherLen != frame.size() - header.size)
+            return Message{"", "[Protocol error] PROT1 length out of range."};
+
+        std::string text = FreiaEncryption::decryptData(frame.data() + header.size, header.cipherLen, chatKey);
+        if (text.empty())
+            return Message{std::string(header.user), "[Chat decryption failed]"};
+        return Message{std::string(header.user), text};
+    }
+    return std::nullopt;
+}
+
+void AsyncSession::close()
+{
+    if (sock == -1)
+        return;
+
+    loop.forget(sock);
+    ::close(sock);
+    sock = -1;
+    incoming.clear();
+    incomingStart = 0;
+}
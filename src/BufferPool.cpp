@@ -0,0 +1,119 @@
+#include "BufferPool.h"
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        pool = other.pool;
+        bytes = other.bytes;
+        size = other.size;
+        other.pool = nullptr;
+        other.bytes = nullptr;
+        other.size = 0;
+    }
+    return *this;
+}
+
+void BufferPool::Buffer::reset()
+{
+    if (bytes)
+        pool->release(bytes, size);
+    pool = nullptr;
+    bytes = nullptr;
+    size = 0;
+}
+
+BufferPool::~BufferPool()
+{
+    for (auto& list : freeLists)
+        for (char* bytes : list)
+            delete[] bytes;
+}
+
+BufferPool& BufferPool::global()
+{
+    static BufferPool pool(8 * 1024 * 1024);
+    return pool;
+}
+
+int BufferPool::classFor(size_t size)
+{
+    size_t classSize = minClass;
+    for (size_t i = 0; i < classCount; i++, classSize <<= 1)
+    {
+        if (size <= classSize)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t size)
+{
+    int cls = classFor(size);
+    if (cls < 0)
+        return Buffer();
+
+    size_t classSize = minClass << cls;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto& list = freeLists[cls];
+    if (!list.empty())
+    {
+        char* bytes = list.back();
+        list.pop_back();
+        cached -= classSize;
+        inUse += classSize;
+        return Buffer(this, bytes, classSize);
+    }
+
+    // Make room by dropping idle buffers of other sizes before giving up
+    if (inUse + cached + classSize > budget && !freeCached(inUse + cached + classSize - budget))
+        return Buffer();
+
+    // new char[] leaves the memory uninitialised, no zero-fill per frame
+    inUse += classSize;
+    return Buffer(this, new char[classSize], classSize);
+}
+
+void BufferPool::setBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = bytes;
+    if (inUse + cached > budget)
+        freeCached(inUse + cached - budget);
+}
+
+void BufferPool::release(char* bytes, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    inUse -= size;
+
+    if (inUse + cached + size <= budget)
+    {
+        freeLists[classFor(size)].push_back(bytes);
+        cached += size;
+    }
+    else
+    {
+        delete[] bytes;
+    }
+}
+
+bool BufferPool::freeCached(size_t bytes)
+{
+    // Caller holds the mutex. Largest buffers go first.
+    size_t freed = 0;
+    for (size_t cls = classCount; cls-- > 0 && freed < bytes;)
+    {
+        auto& list = freeLists[cls];
+        while (!list.empty() && freed < bytes)
+        {
+            delete[] list.back();
+            list.pop_back();
+            cached -= minClass << cls;
+            freed += minClass << cls;
+        }
+    }
+    return freed >= bytes;
+}
@@ -0,0 +1,39 @@
+#include "ChatFrame.h"
+#include <charconv>
+
+namespace ChatFrame
+{
+    std::string build(const std::string& user, const std::string& chatCipher)
+    {
+        std::string frame = "PROT1\n" + user + "\n" + std::to_string(chatCipher.size()) + "\n";
+        frame.append(chatCipher);
+        return frame;
+    }
+
+    std::string parseHeader(std::string_view frame, Header& header)
+    {
+        size_t protoEnd = frame.find('\n');
+        std::string_view proto = frame.substr(0, protoEnd);
+        if (proto.empty())
+            return "[Protocol error] empty packet.";
+        if (proto != "PROT1")
+            return "[Unknown protocol] " + std::string(proto);
+
+        size_t userEnd = protoEnd == std::string_view::npos ? protoEnd : frame.find('\n', protoEnd + 1);
+        size_t lenEnd = userEnd == std::string_view::npos ? userEnd : frame.find('\n', userEnd + 1);
+        if (lenEnd == std::string_view::npos)
+            return "[Protocol error] malformed PROT1 header.";
+
+        header.user = frame.substr(protoEnd + 1, userEnd - protoEnd - 1);
+        header.size = lenEnd + 1;
+
+        std::string_view lenField = frame.substr(userEnd + 1, lenEnd - userEnd - 1);
+        auto [end, ec] = std::from_chars(lenField.data(), lenField.data() + lenField.size(), header.cipherLen);
+        if (ec != std::errc() || end != lenField.data() + lenField.size())
+            return "[Protocol error] invalid length in PROT1.";
+        if (header.cipherLen == 0)
+            return "[Protocol error] PROT1 length out of range.";
+
+        return "";
+    }
+}
@@ -1,148 +1,1725 @@
 #include "ClientConnect.h"
 #include "Validation.h"
+#include "BufferPool.h"
+#include "Resolver.h"
+#include "SocketTransport.h"
+#include "Executor.h"
+#include "EndpointProbe.h"
+#include "NetworkMonitor.h"
+#include "HashRing.h"
 #include <iostream>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#include <charconv>
+#include <algorithm>
+#include <memory>
+#include <climits>
+#include <cctype>
+#include <random>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <sched.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
 
 ClientConnect::ClientConnect(){}
 ClientConnect::ClientConnect(const char* ip,
                              const char* port,
                              const char* user,
                              const char* chatPassword)
-    : ip(ip), port(std::atoi(port)), user(user), chatPassword(chatPassword) {}
+    : ip(ip), port(std::atoi(port)), user(user), chatPassword(chatPassword)
+{
+    servers = Validation::parseServerList(ip);
+}
+
+ClientConnect::~ClientConnect()
+{
+    if (networkListener)
+        NetworkMonitor::global().unsubscribe(networkListener);
+
+    // Disarmed first, so the watcher starts no connector after this one is joined
+    {
+        std::lock_guard<std::mutex> lock(connectMutex);
+        stayConnected = false;
+    }
+    cancelConnect = true;
+    if (connector.joinable())
+        connector.join();
+    {
+        std::lock_guard<std::mutex> lock(watchMutex);
+        watchStop = true;
+    }
+    watchWake.notify_all();
+    if (watcher.joinable())
+        watcher.join();
+    disconnect();
+
+    // The receive thread writes into history, it has to be gone before we are
+    if (receiver.joinable())
+        receiver.join();
+    if (writer.joinable())
+        writer.join();
+    stripes.join();
+
+    closeTls();
+    if (tlsContext)
+        SSL_CTX_free(tlsContext);
+}
+
+static bool waitSocket(int fd, short events, int timeoutMs)
+{
+    pollfd pfd{fd, events, 0};
+    int rc;
+    do
+        rc = poll(&pfd, 1, timeoutMs);
+    while (rc < 0 && errno == EINTR);
+    return rc > 0;
+}
+
+bool ClientConnect::startTls(int sock)
+{
+    // TLS 1.3 only. With SSL_OP_ENABLE_KTLS OpenSSL hands the record layer to
+    // the kernel when the kernel and cipher allow it.
+    if (!tlsContext)
+    {
+        tlsContext = SSL_CTX_new(TLS_client_method());
+        if (!tlsContext)
+        {
+            tlsError = "no TLS context";
+            return false;
+        }
+        SSL_CTX_set_min_proto_version(tlsContext, TLS1_3_VERSION);
+        SSL_CTX_set_options(tlsContext, SSL_OP_ENABLE_KTLS);
+        SSL_CTX_set_verify(tlsContext, SSL_VERIFY_PEER, nullptr);
+        // System CAs; SSL_CERT_FILE / SSL_CERT_DIR point at a private CA
+        SSL_CTX_set_default_verify_paths(tlsContext);
+    }
+
+    ssl = SSL_new(tlsContext);
+    if (!ssl)
+    {
+        tlsError = "no TLS session";
+        return false;
+    }
+
+    if (Validation::isValidIP(serverHost))
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), serverHost.c_str());
+    else
+    {
+        SSL_set_tlsext_host_name(ssl, serverHost.c_str());
+        SSL_set1_host(ssl, serverHost.c_str());
+    }
+
+    // Non-blocking, so the receive thread never sits inside SSL_read holding sslMutex
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    SSL_set_fd(ssl, sock);
+
+    while (true)
+    {
+        int rc = SSL_connect(ssl);
+        if (rc == 1)
+            break;
+
+        int err = SSL_get_error(ssl, rc);
+        if ((err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) && !cancelConnect &&
+            waitSocket(sock, err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, 3000))
+            continue;
+
+        long verify = SSL_get_verify_result(ssl);
+        unsigned long reason = ERR_get_error();
+        if (verify != X509_V_OK)
+            tlsError = X509_verify_cert_error_string(verify);
+        else if (reason)
+            tlsError = ERR_reason_error_string(reason) ? ERR_reason_error_string(reason) : "unknown error";
+        else
+            tlsError = cancelConnect ? "cancelled" : "timeout";
+        ERR_clear_error();
+        closeTls();
+        return false;
+    }
+
+    ktlsSend = BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+    ktlsRecv = BIO_get_ktls_recv(SSL_get_rbio(ssl)) > 0;
+
+    std::string line = std::string("[TLS: ") + SSL_get_version(ssl) + ", " + SSL_get_cipher_name(ssl);
+    if (ktlsSend || ktlsRecv)
+        line += std::string(", kernel offload ") + (ktlsSend && ktlsRecv ? "send+recv" : ktlsSend ? "send" : "recv");
+    addMessage(line + "]");
+    return true;
+}
+
+void ClientConnect::closeTls()
+{
+    if (ssl)
+        SSL_free(ssl);
+    ssl = nullptr;
+    ktlsSend = false;
+    ktlsRecv = false;
+}
+
+static constexpr uint32_t maxPacket = 10 * 1024 * 1024;
+
+// [u32 netLen][payload], the way every packet goes over a stream
+static void appendPacket(std::string& out, const std::string& payload)
+{
+    uint32_t netLen = htonl(static_cast<uint32_t>(payload.size()));
+    out.append(reinterpret_cast<const char*>(&netLen), sizeof(netLen));
+    out.append(payload);
+}
+
+// Low latency mode: how long the receive thread polls before it blocks, and
+// the kernel's busy poll budget per socket read
+static constexpr std::chrono::microseconds inputSpin{200};
+static constexpr int busyPollMicros = 50;
+
+// False when busy polling was refused; above net.core.busy_read it needs
+// CAP_NET_ADMIN. The other options fail harmlessly where they do not apply.
+static bool tuneForLatency(int sock)
+{
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    int budget = busyPollMicros;
+    return setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &budget, sizeof(budget)) == 0 || errno != EPERM;
+}
+
+static bool pinToCpu(int cpu)
+{
+    if (cpu >= CPU_SETSIZE)
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// The address of the other end of a socket, for another connection to it: an
+// IPv4 address and port, or a socket path and port 0. False for anything
+// else, e.g. a MemoryTransport.
+static bool laneTarget(int fd, std::string& address, int& port)
+{
+    sockaddr_storage peer{};
+    socklen_t peerLen = sizeof(peer);
+    if (fd == -1 || getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &peerLen) == -1)
+        return false;
+
+    if (peer.ss_family == AF_INET)
+    {
+        const sockaddr_in& in = reinterpret_cast<const sockaddr_in&>(peer);
+        char text[INET_ADDRSTRLEN];
+        if (!inet_ntop(AF_INET, &in.sin_addr, text, sizeof(text)))
+            return false;
+        address = text;
+        port = ntohs(in.sin_port);
+        return true;
+    }
+
+    if (peer.ss_family == AF_UNIX)
+    {
+        const sockaddr_un& un = reinterpret_cast<const sockaddr_un&>(peer);
+        address.assign(un.sun_path, strnlen(un.sun_path, sizeof(un.sun_path)));
+        port = 0;
+        return !address.empty();
+    }
+    return false;
+}
+
+bool ClientConnect::attachStream(std::unique_ptr<Transport> stream)
+{
+    addMessage("[Connected to server]");
+
+    if (lowLatency && stream->fd() != -1 && !tuneForLatency(stream->fd()))
+        addMessage("[Low latency: kernel busy polling is not permitted, polling in the client only]");
+
+    // TLS mode: the handshake decides, another address would not verify any better
+    if (useTls && (stream->fd() == -1 || !startTls(stream->fd())))
+    {
+        connectFailure = "TLS handshake failed: " + (stream->fd() == -1 ? std::string("no socket under the transport") : tlsError);
+        connectStatus = ConnectState::Failed;
+        return false;
+    }
+
+    // Where this session's packets go, to tell later whether a network change moved them
+    {
+        std::lock_guard<std::mutex> lock(pathMutex);
+        socklen_t localLen = sizeof(localAddress);
+        socklen_t peerLen = sizeof(peerAddress);
+        pathKnown = stream->fd() != -1 &&
+                    getsockname(stream->fd(), reinterpret_cast<sockaddr*>(&localAddress), &localLen) == 0 &&
+                    getpeername(stream->fd(), reinterpret_cast<sockaddr*>(&peerAddress), &peerLen) == 0 &&
+                    localAddress.sin_family == AF_INET && localLen == sizeof(localAddress);
+    }
+
+    // Striping lanes follow this connection to the same server
+    laneAddress.clear();
+    if (useStriping)
+        laneTarget(stream->fd(), laneAddress, lanePort);
+
+    transport = std::move(stream);
+    datagramMode = false;
+    muxMode = useMux;
+    stripeMode = useStriping && muxMode && !ssl && !laneAddress.empty();
+    if (useStriping && !stripeMode)
+        addMessage("[Striping needs multiplexed streams over IPv4 or a UNIX socket without TLS, using one connection]");
+
+    // Cooperative mode reads and writes only what is ready
+    cooperativeMode = useCooperative && !muxMode && !ssl;
+    if (cooperativeMode && transport->fd() != -1)
+        fcntl(transport->fd(), F_SETFL, fcntl(transport->fd(), F_GETFL) | O_NONBLOCK);
+
+    startSession();
+    return true;
+}
+
+bool ClientConnect::connectTransport(std::unique_ptr<Transport> stream)
+{
+    if (isConnected || connectStatus == ConnectState::Connecting || !stream)
+        return false;
+
+    if (connector.joinable())
+        connector.join();
+    reapSession();
+
+    connectFailure.clear();
+    connectStatus = ConnectState::Connecting;
+    return attachStream(std::move(stream));
+}
+
+void ClientConnect::reapSession()
+{
+    // A previous connection's receive thread has already seen its socket close
+    if (receiver.joinable())
+        receiver.join();
+    if (writer.joinable())
+        writer.join();
+    stripes.join();
+    closeTls();
+    transport.reset();
+
+    std::lock_guard<std::mutex> lock(pathMutex);
+    pathKnown = false;
+}
+
+
+bool ClientConnect::connectToServer()
+{
+    // Not under connectMutex, the listener takes it while the monitor holds its own
+    if (networkListener == 0)
+        networkListener = NetworkMonitor::global().subscribe([this] { onNetworkChange(); });
+
+    std::lock_guard<std::mutex> lock(connectMutex);
+    if (isConnected || connectStatus == ConnectState::Connecting)
+        return false;
+
+    stayConnected = true;
+    serverClosed = false;
+    if (servers.size() > 1 && !watcher.joinable())
+        watcher = std::thread(&ClientConnect::watchServers, this);
+
+    startConnector();
+    return true;
+}
+
+void ClientConnect::startConnector()
+{
+    if (connector.joinable())
+        connector.join();
+
+    connectFailure.clear();
+    connectStatus = ConnectState::Connecting;
+    connector = std::thread(&ClientConnect::runConnect, this);
+}
+
+void ClientConnect::runConnect()
+{
+    if (servers.size() > 1)
+        connectFromList();
+    else
+        connectToHost();
+
+    // Nothing took the place of the session a network change left up
+    if (replacing.exchange(false))
+        closeSession();
+}
+
+// The session a network change left up goes once its successor's connection
+// is open, the others are gone already
+void ClientConnect::retireSession()
+{
+    if (replacing.exchange(false))
+        closeSession();
+    reapSession();
+}
+
+void ClientConnect::connectToHost()
+{
+    // One server, possibly with its own port
+    std::string host = servers.empty() ? ip : servers[0].host;
+    int serverPort = servers.empty() || servers[0].port == 0 ? port : servers[0].port;
+    {
+        std::lock_guard<std::mutex> lock(connectMutex);
+        currentServer = 0;
+        serverHost = host;
+    }
+
+    // A server on this machine needs no resolving
+    if (Validation::isUnixSocketAddress(host))
+    {
+        std::string path = host.substr(5);
+        if (useDatagram)
+        {
+            connectFailure = "The datagram transport needs a network address.";
+            connectStatus = ConnectState::Failed;
+            return;
+        }
+
+        std::unique_ptr<SocketTransport> sock = SocketTransport::connectUnix(path);
+        if (!sock)
+        {
+            connectFailure = "Connection failed. No server at " + path + ".";
+            connectStatus = ConnectState::Failed;
+            return;
+        }
+        retireSession();
+        attachStream(std::move(sock));
+        return;
+    }
+
+    // 1) Resolve, straight from the cache when the host was seen within its TTL
+    std::shared_future<Resolver::Result> pending = Resolver::global().resolve(host);
+    while (pending.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready)
+    {
+        if (cancelConnect)
+        {
+            connectFailure = "Connection cancelled.";
+            connectStatus = ConnectState::Failed;
+            return;
+        }
+    }
+
+    const Resolver::Result& result = pending.get();
+    if (result.addresses.empty())
+    {
+        connectFailure = "Could not resolve " + host + ": " + result.error;
+        connectStatus = ConnectState::Failed;
+        return;
+    }
+
+    // A session still up is replaced only once the new connection is open
+    if (!replacing)
+        reapSession();
+    datagramMode = useDatagram;
+    if (datagramMode && useTls)
+    {
+        connectFailure = "TLS is not available over the datagram transport.";
+        connectStatus = ConnectState::Failed;
+        return;
+    }
+
+    // 2) Try every address in turn
+    std::string datagramError;
+    for (const auto& address : result.addresses)
+    {
+        if (cancelConnect)
+            break;
+
+        if (datagramMode)
+        {
+            // Messages on the link are independent already, there is nothing to multiplex
+            muxMode = false;
+            stripeMode = false;
+            if (!datagramLink.open(address, serverPort, 3000))
+            {
+                datagramError = datagramLink.error();
+                continue;
+            }
+
+            addMessage("[Connected to server over UDP]");
+            startSession();
+            return;
+        }
+
+        std::unique_ptr<SocketTransport> sock = SocketTransport::connectTcp(address, serverPort);
+        if (!sock)
+            continue;
+
+        // 3) Over TLS the first address that answers decides
+        retireSession();
+        attachStream(std::move(sock));
+        return;
+    }
+
+    // The host may have moved, resolve it again next time
+    Resolver::global().forget(host);
+    connectFailure = datagramError.empty() ? "Connection failed. Server unreachable."
+                                           : "Connection failed. " + datagramError + ".";
+    connectStatus = ConnectState::Failed;
+}
+
+// The servers in the order a chat at `position` tries them. Nodes are named
+// "host:port" in lower case, so the ring does not depend on how the list was
+// ordered or typed.
+static std::vector<size_t> clusterRoute(const std::vector<Validation::ServerAddress>& servers, int defaultPort,
+                                        uint64_t position)
+{
+    std::vector<std::string> names;
+    for (const Validation::ServerAddress& server : servers)
+    {
+        std::string name = EndpointProbe::describe(server, defaultPort);
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        names.push_back(name);
+    }
+    return HashRing(names).route(position);
+}
+
+void ClientConnect::connectFromList()
+{
+    if (useDatagram)
+    {
+        connectFailure = "The datagram transport takes a single server.";
+        connectStatus = ConnectState::Failed;
+        return;
+    }
+
+    size_t index = 0;
+    std::chrono::microseconds rtt{0};
+    std::string errors;
+    std::unique_ptr<SocketTransport> sock;
+    std::vector<size_t> route;
+    if (useCluster)
+    {
+        {
+            std::lock_guard<std::mutex> lock(connectMutex);
+            route = clusterRoute(servers, port, chatPosition);
+        }
+        std::vector<Validation::ServerAddress> nodes;
+        for (size_t node : route)
+            nodes.push_back(servers[node]);
+        sock = EndpointProbe::connectPreferred(nodes, port, probeTimeout, index, rtt, errors);
+        if (sock)
+            index = route[index];
+    }
+    else
+        sock = EndpointProbe::connectFastest(servers, port, probeTimeout, index, rtt, errors);
+
+    if (!sock)
+    {
+        connectFailure = "Connection failed. No server answered (" + errors + ").";
+        connectStatus = ConnectState::Failed;
+        return;
+    }
+    retireSession();
+
+    {
+        std::lock_guard<std::mutex> lock(connectMutex);
+        currentServer = index;
+        serverHost = servers[index].host;
+    }
+    char ms[32];
+    std::snprintf(ms, sizeof(ms), "%.2f ms", rtt.count() / 1000.0);
+    std::string chosen = EndpointProbe::describe(servers[index], port);
+    if (!useCluster)
+        addMessage("[Fastest of " + std::to_string(servers.size()) + " servers: " + chosen + ", " + ms + "]");
+    else if (index == route.front())
+        addMessage("[Cluster node " + chosen + ", owner of this chat, " + ms + "]");
+    else
+        addMessage("[Cluster node " + chosen + ", standing in for " +
+                   EndpointProbe::describe(servers[route.front()], port) + ", " + ms + "]");
+    attachStream(std::move(sock));
+}
+
+// A session that drops again before it was up for stableSession waits before
+// the next reconnect, doubling from retryBase up to retryMax
+static constexpr std::chrono::milliseconds retryBase{250};
+static constexpr std::chrono::milliseconds retryMax{30000};
+static constexpr std::chrono::seconds stableSession{30};
+
+// None for the first retry; a random part of up to half is taken off the
+// others, so clients dropped together do not come back together
+static std::chrono::milliseconds retryDelay(int retries, std::minstd_rand& random)
+{
+    if (retries == 0)
+        return std::chrono::milliseconds(0);
+
+    std::chrono::milliseconds delay = retryMax;
+    if (retries <= 16)
+        delay = std::min(delay, retryBase * (1 << (retries - 1)));
+    std::uniform_int_distribution<std::chrono::milliseconds::rep> cut(0, delay.count() / 2);
+    return delay - std::chrono::milliseconds(cut(random));
+}
+
+void ClientConnect::watchServers()
+{
+    int misses = 0;
+    int retries = 0;    // drops since the last session that stayed up
+    std::minstd_rand random(std::random_device{}());
+    std::unique_lock<std::mutex> lock(watchMutex);
+    while (true)
+    {
+        watchWake.wait_for(lock, reprobeInterval, [this] { return watchStop || watchKick; });
+        if (watchStop)
+            return;
+        bool kicked = watchKick;
+        watchKick = false;
+
+        // The connector races the servers itself, a probe first would only add
+        // a round. A server that accepts and drops again is not hammered.
+        if (kicked && !isConnected)
+        {
+            if (std::chrono::steady_clock::now() - sessionSince >= stableSession)
+                retries = 0;
+            if (watchWake.wait_for(lock, retryDelay(retries++, random), [this] { return watchStop; }))
+                return;
+            watchKick = false;
+            lock.unlock();
+
+            misses = 0;
+            reconnect();
+            lock.lock();
+            continue;
+        }
+        lock.unlock();
+
+        std::vector<Validation::ServerAddress> probing;
+        int defaultPort = 0;
+        size_t current = 0;
+        std::vector<size_t> route;
+        {
+            std::lock_guard<std::mutex> connectLock(connectMutex);
+            if (stayConnected && connectStatus != ConnectState::Connecting)
+            {
+                probing = servers;
+                defaultPort = port;
+                current = currentServer;
+                if (useCluster)
+                    route = clusterRoute(probing, defaultPort, chatPosition);
+            }
+        }
+
+        if (!probing.empty())
+        {
+            std::vector<EndpointProbe::Result> probes = EndpointProbe::probeAll(probing, defaultPort, probeTimeout);
+            bool anyHealthy = std::any_of(probes.begin(), probes.end(),
+                                          [](const EndpointProbe::Result& r) { return r.healthy; });
+
+            if (!isConnected)
+            {
+                // A dropped session, or a failover that found nobody last time
+                misses = 0;
+                if (anyHealthy)
+                    reconnect();
+            }
+            else if (current < probes.size())
+            {
+                misses = probes[current].healthy ? 0 : misses + 1;
+                // In a cluster everyone in a chat has to meet on one node: the
+                // first healthy one in ring order, the owner as soon as it is back
+                auto owner = std::find_if(route.begin(), route.end(), [&probes](size_t node) { return probes[node].healthy; });
+
+                if (misses >= failedProbesBeforeFailover && anyHealthy)
+                {
+                    addMessage("[" + EndpointProbe::describe(probing[current], defaultPort) +
+                               " stopped answering, switching servers]");
+                    misses = 0;
+                    dropStale();
+                }
+                else if (misses == 0 && owner != route.end() && *owner != current)
+                {
+                    addMessage("[Cluster node " + EndpointProbe::describe(probing[*owner], defaultPort) +
+                               " is back, moving this chat to it]");
+                    dropStale();
+                }
+            }
+        }
+        lock.lock();
+    }
+}
+
+void ClientConnect::onNetworkChange()
+{
+    if (!stayConnected)
+        return;
+
+    // Names may resolve differently on the new network, e.g. behind a VPN
+    std::vector<Validation::ServerAddress> hosts;
+    {
+        std::lock_guard<std::mutex> lock(connectMutex);
+        hosts = servers;
+    }
+    auto forgetNames = [&hosts]
+    {
+        for (const Validation::ServerAddress& server : hosts)
+            Resolver::global().forget(server.host);
+    };
+
+    // The network may be back after a drop; a session the server closed stays closed
+    if (!isConnected)
+    {
+        if (connectStatus != ConnectState::Connecting && !serverClosed)
+        {
+            forgetNames();
+            reconnect();
+        }
+        return;
+    }
+
+    sockaddr_in local;
+    sockaddr_in peer;
+    {
+        std::lock_guard<std::mutex> lock(pathMutex);
+        if (!pathKnown)
+            return;
+        local = localAddress;
+        peer = peerAddress;
+    }
+    if (!NetworkMonitor::routeChanged(local, peer))
+        return;
+
+    addMessage("[Network changed, reconnecting]");
+    forgetNames();
+    replaceSession();
+}
+
+void ClientConnect::dropStale()
+{
+    // The pump buffers belong to the thread that calls pump()
+    if (cooperativeMode)
+    {
+        sessionStale = true;
+        return;
+    }
+
+    closeSession();
+    reconnect();
+}
+
+// Make-before-break: the connector opens a new connection while this one is
+// still up, see retireSession()
+void ClientConnect::replaceSession()
+{
+    // The pump buffers belong to the thread that calls pump(), it drops the session first
+    if (cooperativeMode)
+    {
+        sessionStale = true;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(connectMutex);
+    if (!stayConnected || connectStatus == ConnectState::Connecting)
+        return;
+
+    replacing = true;
+    startConnector();
+}
+
+void ClientConnect::reconnect()
+{
+    std::lock_guard<std::mutex> lock(connectMutex);
+    if (!stayConnected || isConnected || connectStatus == ConnectState::Connecting)
+        return;
+
+    // The receive thread may still be on its way out, runConnect reaps it
+    startConnector();
+}
+
+void ClientConnect::startSession()
+{
+    if (muxMode)
+    {
+        if (stripeMode)
+            mux.reset(StripeSet::window, StripeSet::reorderWindow);
+        else
+            mux.reset();
+    }
+    if (stripeMode)
+        startStriping();
+    senders.resetBindings();
+    sessionStale = false;
+    serverClosed = false;
+    {
+        std::lock_guard<std::mutex> lock(watchMutex);
+        sessionSince = std::chrono::steady_clock::now();
+    }
+    if (cooperativeMode)
+        queueSessionStart();
+
+    isConnected = true;
+    {
+        // From here on sendMessage() queues for the writer, not the offline outbox
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        writerActive = true;
+    }
+    connectStatus = ConnectState::Connected;
+
+    // pump() takes over from here
+    if (cooperativeMode)
+        return;
+
+    receiver = std::thread(&ClientConnect::receiveMessages, this);
+    writer = std::thread(&ClientConnect::writeFrames, this);
+}
+
+void ClientConnect::disconnect()
+{
+    // Only the user ends a session for good, drops are failed over
+    {
+        std::lock_guard<std::mutex> lock(connectMutex);
+        stayConnected = false;
+    }
+    closeSession();
+}
+
+void ClientConnect::closeSession()
+{
+    if (stayConnected)
+    {
+        {
+            std::lock_guard<std::mutex> lock(watchMutex);
+            watchKick = true;
+        }
+        watchWake.notify_all();
+    }
+
+    if (isConnected)
+    {
+        isConnected = false;
+        if (muxMode)
+            mux.stop();
+        {
+            std::lock_guard<std::mutex> lock(outboxMutex);
+            outboxReady.notify_all();
+        }
+
+        // The datagram link is closed by its receive thread. The transport
+        // stays until both threads are gone, they may still be using it.
+        if (!datagramMode && transport)
+            transport->shutdown();
+    }
+
+    // The receive thread clears isConnected itself, the lanes end either way
+    if (stripeMode)
+        stripes.stop();
+
+    if (cooperativeMode)
+        finishCooperative();
+}
+
+// Numbered senders, see SenderTable
+static constexpr std::string_view senderRequest = "SIDS1\n";
+static constexpr std::string_view senderBinding = "SNDR1\n";
+static constexpr std::string_view numberedTag = "PROT2\n";
+
+static bool startsWith(std::string_view frame, std::string_view tag)
+{
+    return frame.substr(0, tag.size()) == tag;
+}
+
+// Enough of a frame arrived to parse its header
+static bool headerBuffered(std::string_view plain)
+{
+    if (startsWith(plain, numberedTag))
+    {
+        std::string_view rest = plain.substr(numberedTag.size());
+        uint64_t value = 0;
+        return SenderTable::readVarint(rest, value) && SenderTable::readVarint(rest, value);
+    }
+    return std::count(plain.begin(), plain.end(), '\n') >= 3;
+}
+
+// closed is set when the peer closed the connection in order before the first byte
+bool ClientConnect::recvAll(void* buffer, size_t len, bool* closed)
+{
+    char* out = static_cast<char*>(buffer);
+    while (len > 0 && ssl)
+    {
+        // OpenSSL reads through kTLS itself when it is on; it still has to see
+        // non-data records, so reads always go through SSL_read
+        int n = 0;
+        int err = SSL_ERROR_NONE;
+        {
+            std::lock_guard<std::mutex> lock(sslMutex);
+            n = SSL_read(ssl, out, static_cast<int>(std::min<size_t>(len, INT32_MAX)));
+            if (n <= 0)
+                err = SSL_get_error(ssl, n);
+        }
+
+        if (n > 0)
+        {
+            out += n;
+            len -= n;
+        }
+        else if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+        {
+            if (!transport->wait(err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT, -1))
+                return false;
+        }
+        else
+        {
+            if (closed)
+                *closed = err == SSL_ERROR_ZERO_RETURN && out == buffer;
+            return false;
+        }
+    }
+
+    while (len > 0)
+    {
+        ssize_t r = transport->read(out, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            if (closed)
+                *closed = r == 0 && out == buffer;
+            return false;
+        }
+        out += r;
+        len -= r;
+    }
+    return true;
+}
+
+int ClientConnect::pump()
+{
+    // The connector thread sets the session up before it reports Connected
+    if (!cooperativeMode || connectStatus != ConnectState::Connected)
+        return pumpIntervalMs;
+
+    // Dropped here when another thread found it stale
+    if (sessionStale.exchange(false))
+    {
+        closeSession();
+        reconnect();
+        return pumpIntervalMs;
+    }
+
+    std::chrono::milliseconds wait(pumpIntervalMs);
+    if (!isConnected || !queueOutgoing(wait) || !writePending() || !readAvailable())
+    {
+        closeSession();
+        return pumpIntervalMs;
+    }
+    return static_cast<int>(std::min<std::chrono::milliseconds::rep>(wait.count(), pumpIntervalMs));
+}
+
+void ClientConnect::queueSessionStart()
+{
+    // What the writer thread sends first: the numbered senders request,
+    // then everything written while offline
+    pumpIn.clear();
+    pumpOut.clear();
+    pumpOutStart = 0;
+    if (useNumberedSenders)
+        appendPacket(pumpOut, transportPayload(std::string(senderRequest)));
+
+    std::vector<std::string> batch;
+    {
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        batch = offline.frames();
+    }
+    offlineEnds.clear();
+    for (const std::string& frame : batch)
+    {
+        appendPacket(pumpOut, transportPayload(frame));
+        offlineEnds.push_back(pumpOut.size());
+    }
+    offlineSending = batch.size();
+}
+
+bool ClientConnect::queueOutgoing(std::chrono::milliseconds& wait)
+{
+    std::string frame;
+    while (takeOutgoing(frame, wait))
+    {
+        std::string payload = transportPayload(frame);
+        if (payload.empty())
+        {
+            addMessage("[Error] Sending failed.");
+            return false;
+        }
+        appendPacket(pumpOut, payload);
+    }
+    return true;
+}
+
+bool ClientConnect::writePending()
+{
+    while (pumpOutStart < pumpOut.size() && transport->wait(POLLOUT, 0))
+    {
+        ssize_t n = transport->write(pumpOut.data() + pumpOutStart, pumpOut.size() - pumpOutStart);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0)
+        {
+            addMessage("[Error] Sending failed.");
+            return false;
+        }
+        pumpOutStart += n;
+    }
+
+    // Offline frames leave the outbox once written in full
+    size_t written = std::upper_bound(offlineEnds.begin(), offlineEnds.end(), pumpOutStart) - offlineEnds.begin();
+    if (written > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(outboxMutex);
+            offline.drop(written);
+        }
+        offlineEnds.erase(offlineEnds.begin(), offlineEnds.begin() + written);
+    }
+    if (offlineSending > 0 && offlineEnds.empty())
+    {
+        addMessage("[Sent " + std::to_string(offlineSending) + " message(s) written while offline]");
+        offlineSending = 0;
+    }
+
+    if (pumpOutStart == pumpOut.size())
+    {
+        pumpOut.clear();
+        pumpOutStart = 0;
+    }
+    return true;
+}
+
+bool ClientConnect::readAvailable()
+{
+    // A bounded amount per call, the UI still has a frame to draw
+    static constexpr int maxReads = 16;
+    char chunk[64 * 1024];
+    for (int i = 0; i < maxReads && transport->wait(POLLIN, 0); i++)
+    {
+        ssize_t r = transport->read(chunk, sizeof(chunk));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (r <= 0)
+        {
+            serverClosed = r == 0 && pumpIn.empty();
+            addMessage(serverClosed ? "[Server closed the session]" : "[Disconnected from server]");
+            return false;
+        }
+        pumpIn.append(chunk, r);
+    }
+
+    size_t pos = 0;
+    while (pumpIn.size() - pos >= sizeof(uint32_t))
+    {
+        uint32_t netLen;
+        std::memcpy(&netLen, pumpIn.data() + pos, sizeof(netLen));
+        uint32_t len = ntohl(netLen);
+        if (len == 0 || len > maxPacket)
+        {
+            addMessage("[Error] Invalid message length received.");
+            return false;
+        }
+        if (pumpIn.size() - pos - sizeof(netLen) < len)
+            break;
+
+        handlePacket(pumpIn.data() + pos + sizeof(netLen), len);
+        pos += sizeof(netLen) + len;
+    }
+    pumpIn.erase(0, pos);
+    return true;
+}
+
+void ClientConnect::handlePacket(const char* data, uint32_t len)
+{
+    if (!hasChatKey)
+    {
+        addMessage("[Error] Received encrypted message but no password is set.");
+        return;
+    }
+
+    std::string plain = FreiaEncryption::decryptData(data, len, serverSessionKey);
+    if (plain.empty())
+    {
+        addMessage("[Decryption failed]");
+        return;
+    }
+    handleProtocolPacket(plain);
+}
+
+void ClientConnect::finishCooperative()
+{
+    // Like the writer thread on its way out; packets already built are lost
+    // with the connection, as they would be halfway through a write
+    cooperativeMode = false;
+    keepUnsent();
+    pumpIn.clear();
+    pumpOut.clear();
+    pumpOutStart = 0;
+    offlineEnds.clear();
+    offlineSending = 0;
+}
+
+void ClientConnect::spinForInput()
+{
+    // A record OpenSSL already holds can be read right away
+    if (ssl)
+    {
+        std::lock_guard<std::mutex> lock(sslMutex);
+        if (SSL_pending(ssl) > 0)
+            return;
+    }
+
+    // Data that arrives meanwhile is read without a sleep and a wakeup.
+    // Yielding lets whoever shares the core, maybe the sender, go first.
+    // Whether that ends up faster depends on the machine, see
+    // freia-thiwi-latency-bench.
+    auto until = std::chrono::steady_clock::now() + inputSpin;
+    while (isConnected && !transport->wait(POLLIN, 0) && std::chrono::steady_clock::now() < until)
+        std::this_thread::yield();
+}
+
+bool ClientConnect::sendAll(const char* data, size_t len, size_t* sent)
+{
+    // One sender at a time, a frame never interleaves with another
+    std::lock_guard<std::mutex> lock(sendMutex);
+    if (sent)
+        *sent = 0;
+    while (len > 0)
+    {
+        ssize_t n = 0;
+        if (ssl && !ktlsSend)
+        {
+            int err = SSL_ERROR_NONE;
+            {
+                std::lock_guard<std::mutex> sslLock(sslMutex);
+                n = SSL_write(ssl, data, static_cast<int>(std::min<size_t>(len, INT32_MAX)));
+                if (n <= 0)
+                    err = SSL_get_error(ssl, n);
+            }
+            if (n <= 0)
+            {
+                if ((err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) &&
+                    transport->wait(err == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN, -1))
+                    continue;
+                return false;
+            }
+        }
+        else
+        {
+            // Plain stream, or kTLS: the kernel encrypts what we send
+            n = transport->write(data, len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                if (!transport->wait(POLLOUT, -1))
+                    return false;
+                continue;
+            }
+            if (n <= 0)
+                return false;
+        }
+        data += n;
+        len -= n;
+        if (sent)
+            *sent += n;
+    }
+    return true;
+}
+
+bool ClientConnect::drain(size_t len)
+{
+    char sink[4096];
+    while (len > 0)
+    {
+        size_t n = std::min(len, sizeof(sink));
+        if (!recvAll(sink, n))
+            return false;
+        len -= n;
+    }
+    return true;
+}
+
+void ClientConnect::receiveMessages()
+{
+    if (lowLatency && ioCpu >= 0 && !pinToCpu(ioCpu))
+        addMessage("[Error] Could not pin the receive thread to CPU " + std::to_string(ioCpu) + ".");
+
+    if (datagramMode)
+    {
+        receiveDatagrams();
+        return;
+    }
+
+    while (isConnected)
+    {
+        // 1) Read length prefix
+        uint32_t netLen = 0;
+        if (lowLatency)
+            spinForInput();
+        bool closed = false;
+        if (!recvAll(&netLen, sizeof(netLen), &closed))
+        {
+            addMessage(closed && isConnected ? "[Server closed the session]" : "[Disconnected from server]");
+            serverClosed = closed && isConnected;
+            isConnected = false;
+            break;
+        }
+
+        uint32_t len = ntohl(netLen);
+
+        // Mux frames hold one chunk, plus IV and padding without TLS
+        uint32_t maxLen = muxMode ? (stripeMode ? StripeSet::maxFrame : StreamMux::maxFrame) + 32 : maxPacket;
+        if (len == 0 || len > maxLen)
+        {
+            addMessage("[Error] Invalid message length received.");
+            isConnected = false;
+            break;
+        }
+
+        // 2) Read and handle the payload. Frames go into pooled buffers,
+        // anything the pool cannot hold is decrypted as it arrives.
+        bool ok = true;
+        if (!hasChatKey)
+        {
+            ok = drain(len);
+            if (ok)
+                addMessage("[Error] Received encrypted message but no password is set.");
+        }
+        else if (muxMode)
+            ok = receiveMux(len);
+        else
+        {
+            // Over TLS the frame arrives as plaintext, one buffer is enough
+            BufferPool::Buffer cipher = BufferPool::global().acquire(len);
+            BufferPool::Buffer plain = cipher && !ssl ? BufferPool::global().acquire(len) : BufferPool::Buffer();
+            if (cipher && (ssl || plain))
+                ok = receivePooled(len, cipher, plain);
+            else
+            {
+                cipher.reset();
+                ok = receiveStreamed(len);
+            }
+        }
+
+        if (!ok)
+        {
+            addMessage("[Disconnected from server]");
+            isConnected = false;
+            break;
+        }
+    }
+
+    closeSession();
+}
+
+void ClientConnect::receiveDatagrams()
+{
+    // Messages come out of the link whole and independently of each other, a
+    // lost datagram only holds back the message it belongs to
+    std::vector<std::string> frames;
+    while (isConnected)
+    {
+        frames.clear();
+        if (!datagramLink.poll(100, frames))
+        {
+            addMessage("[Disconnected from server: " + datagramLink.error() + "]");
+            isConnected = false;
+            break;
+        }
+
+        for (const std::string& frame : frames)
+        {
+            if (!hasChatKey)
+            {
+                addMessage("[Error] Received encrypted message but no password is set.");
+                continue;
+            }
 
-ClientConnect::~ClientConnect()
+            std::string plain = FreiaEncryption::decryptData(frame.data(), frame.size(), serverSessionKey);
+            if (plain.empty())
+                addMessage("[Decryption failed]");
+            else
+                handleProtocolPacket(plain);
+        }
+    }
+
+    datagramLink.close();
+}
+
+bool ClientConnect::receiveMux(uint32_t len)
 {
-    disconnect();
+    // Mux frames are at most one chunk, the receive thread reuses its buffers
+    muxCipher.resize(len);
+    if (!recvAll(muxCipher.data(), len))
+        return false;
+
+    std::string_view frame(muxCipher.data(), len);
+    if (!ssl)
+    {
+        muxPlain.resize(len);
+        size_t plainLen = 0;
+        if (!FreiaEncryption::decryptInto(muxCipher.data(), len, serverSessionKey, muxPlain.data(), plainLen))
+        {
+            addMessage("[Decryption failed]");
+            return true;
+        }
+        frame = std::string_view(muxPlain.data(), plainLen);
+    }
+
+    // Striped chunks that came this way while no lane was up
+    if (stripeMode && StripeSet::onStripeStream(frame))
+    {
+        if (stripes.receive(frame.substr(StreamMux::headerSize)))
+            return true;
+        addMessage("[Protocol error] malformed stripe frame.");
+        return false;
+    }
+
+    muxDeliveries.clear();
+    if (!mux.receive(frame, muxDeliveries))
+    {
+        addMessage("[Protocol error] malformed stream frame.");
+        return true;
+    }
+
+    for (const StreamMux::Delivery& delivery : muxDeliveries)
+    {
+        if (delivery.stream == StreamMux::chatStream)
+            handleProtocolPacket(delivery.message);
+        else if (streamListener)
+            streamListener(delivery.stream, delivery.message);
+    }
+    return true;
+}
+
+void ClientConnect::startStriping()
+{
+    // Lanes speak the session's transport layer, they are just more sockets
+    StripeSet::Callbacks callbacks;
+    callbacks.connect = [this](const std::atomic<bool>& cancel) -> std::unique_ptr<Transport>
+    {
+        if (lanePort == 0)
+            return SocketTransport::connectUnix(laneAddress, &cancel);
+        return SocketTransport::connectTcp(laneAddress, lanePort, &cancel);
+    };
+    callbacks.seal = [this](const std::string& frame) { return transportPayload(frame); };
+    callbacks.open = [this](const char* data, size_t len) { return FreiaEncryption::decryptData(data, len, serverSessionKey); };
+    callbacks.sendPrimary = [this](const std::string& frame) { return transmitFrame(frame); };
+    callbacks.deliver = [this](std::string_view frame) { return deliverStriped(frame); };
+    callbacks.fail = [this](const std::string& reason)
+    {
+        addMessage(reason);
+        closeSession();
+    };
+    callbacks.backlogged = [this] { return mux.bulkWaiting(); };
+    stripes.start(std::move(callbacks));
+}
+
+bool ClientConnect::deliverStriped(std::string_view frame)
+{
+    // In order, on whichever thread brought the chunk the others waited for
+    std::vector<StreamMux::Delivery> deliveries;
+    if (!mux.receive(frame, deliveries))
+        return false;
+
+    for (const StreamMux::Delivery& delivery : deliveries)
+    {
+        if (delivery.stream == StreamMux::chatStream)
+            handleProtocolPacket(delivery.message);
+        else if (streamListener)
+            streamListener(delivery.stream, delivery.message);
+    }
+    return true;
 }
 
-void ClientConnect::handleSystemCallError(const std::string &errorMsg)
+bool ClientConnect::takeOutgoing(std::string& frame, std::chrono::milliseconds& wait)
 {
-    std::cerr << errorMsg << ", errno: " << errno << "\n";
+    std::lock_guard<std::mutex> lock(outboxMutex);
+    outboxPushed = false;
+    wait = std::chrono::milliseconds(100);
+    if (outbox.empty())
+        return false;
+
+    auto now = TokenBucket::Clock::now();
+    auto delay = sendBucket.delayFor(1, now);
+    if (delay > TokenBucket::Clock::duration::zero())
+    {
+        wait = std::chrono::ceil<std::chrono::milliseconds>(delay);
+        return false;
+    }
+
+    sendBucket.tryTake(1, now);
+    frame = std::move(outbox.front());
+    outbox.pop_front();
+    return true;
 }
 
-int ClientConnect::createClientSocket(const std::string &serverIP, int serverPort)
+void ClientConnect::writeFrames()
 {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == -1)
+    // Chat frames leave the outbox as fast as the send bucket allows. With
+    // multiplexing they join the chat stream, whose chunks this thread writes
+    // too; otherwise they go straight out.
+    std::string frame;
+    bool ok = true;
+
+    // The server learns which lanes are ours before anything else
+    if (stripeMode)
+        ok = mux.enqueue(StreamMux::chatStream, stripes.announcement());
+
+    // Ask for numbered senders before any chat goes out
+    if (ok && useNumberedSenders)
     {
-        handleSystemCallError("Failed to create socket");
-        return -1;
+        std::string request(senderRequest);
+        ok = muxMode ? mux.enqueue(StreamMux::chatStream, std::move(request)) : transmitFrame(request);
     }
 
-    // Set timeout (3 seconds example)
-    struct timeval tv;
-    tv.tv_sec = 3;
-    tv.tv_usec = 0;
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    ok = ok && flushOffline();
+    while (ok && isConnected)
+    {
+        std::chrono::milliseconds wait;
+        while (ok && takeOutgoing(frame, wait))
+        {
+            if (!muxMode)
+                ok = transmitFrame(frame);
+            else if (!mux.enqueue(StreamMux::chatStream, std::move(frame)))
+                addMessage("[Error] Sending failed.");
+        }
+
+        if (!ok)
+            break;
 
-    sockaddr_in serverAddress{};
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(serverPort);
+        // sendMessage() wakes us early
+        if (muxMode)
+        {
+            // Bulk chunks take the lanes, chat and credit stay here
+            if (mux.nextFrame(frame, wait))
+                ok = stripeMode && StripeSet::carries(frame) ? stripes.send(std::move(frame)) : transmitFrame(frame);
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(outboxMutex);
+            outboxReady.wait_for(lock, wait, [this] { return outboxPushed || !isConnected; });
+        }
+    }
 
-    if (inet_pton(AF_INET, serverIP.c_str(), &serverAddress.sin_addr) <= 0)
+    if (!ok && isConnected)
     {
-        handleSystemCallError("Invalid IP address or unsupported format");
-        close(sock);
-        return -1;
+        addMessage("[Error] Sending failed.");
+        closeSession();
     }
 
-    if (connect(sock, (sockaddr*)&serverAddress, sizeof(serverAddress)) == -1)
+    keepUnsent();
+}
+
+bool ClientConnect::flushOffline()
+{
+    std::vector<std::string> batch;
     {
-        handleSystemCallError("Connection failed");
-        close(sock);
-        return -1;
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        batch = offline.frames();
     }
+    if (batch.empty())
+        return true;
 
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
-    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    addMessage("[Connected to server]");
+    // One burst, outside the send bucket: over TCP every frame goes into a
+    // single write, the datagram link and the mux queue them all at once
+    bool ok = true;
+    size_t sent = 0;
+    if (muxMode)
+    {
+        while (sent < batch.size() && (ok = mux.enqueue(StreamMux::chatStream, std::move(batch[sent]))))
+            sent++;
+    }
+    else if (datagramMode)
+    {
+        while (sent < batch.size() && (ok = transmitFrame(batch[sent])))
+            sent++;
+    }
+    else
+    {
+        std::string packets;
+        std::vector<size_t> ends;
+        for (const std::string& frame : batch)
+        {
+            std::string payload = transportPayload(frame);
+            if (payload.empty())
+                break;
+            appendPacket(packets, payload);
+            ends.push_back(packets.size());
+        }
 
+        size_t written = 0;
+        ok = ends.size() == batch.size() && sendAll(packets.data(), packets.size(), &written);
+        sent = std::upper_bound(ends.begin(), ends.end(), written) - ends.begin();
+    }
 
-    return sock;
+    // Only what did not go out is kept for the next connection
+    {
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        offline.drop(sent);
+    }
+    if (ok)
+        addMessage("[Sent " + std::to_string(batch.size()) + " message(s) written while offline]");
+    return ok;
 }
 
+void ClientConnect::keepUnsent()
+{
+    // Whatever the bucket still held waits for the next connection, behind
+    // nothing: sendMessage() keeps using the outbox until writerActive drops
+    size_t kept = 0;
+    bool durable = true;
+    {
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        writerActive = false;
+        for (const std::string& frame : outbox)
+            durable = offline.append(frame) && durable;
+        kept = outbox.size();
+        outbox.clear();
+    }
 
-bool ClientConnect::connectToServer()
+    if (!durable)
+        addMessage("[Error] Unsent messages could not be saved to disk.");
+    if (kept > 0)
+        addMessage("[" + std::to_string(kept) + " unsent message(s) will be sent after reconnecting]");
+}
+
+std::string ClientConnect::transportPayload(const std::string& frame) const
+{
+    // Transport layer: TLS, or encryption with the server password
+    return ssl ? frame : FreiaEncryption::encryptData(frame, serverSessionKey);
+}
+
+bool ClientConnect::transmitFrame(const std::string& frame)
 {
-    clientSocket = createClientSocket(ip, port);
-    if (clientSocket == -1)
+    std::string payload = transportPayload(frame);
+    if (payload.empty())
         return false;
 
-    isConnected = true;
-    std::thread(&ClientConnect::receiveMessages, this).detach();
-    return true;
+    return datagramMode ? datagramLink.send(payload) : sendPacket(payload);
 }
 
-void ClientConnect::disconnect()
+void ClientConnect::setSendRate(unsigned messagesPerSecond, unsigned burst)
 {
-    if (isConnected)
+    std::lock_guard<std::mutex> lock(outboxMutex);
+    sendBucket.configure(messagesPerSecond, burst);
+}
+
+size_t ClientConnect::queuedMessages() const
+{
+    std::lock_guard<std::mutex> lock(outboxMutex);
+    return outbox.size() + offline.size();
+}
+
+bool ClientConnect::sendPacket(const std::string& payload)
+{
+    // Length prefix + payload, as one write
+    std::string packet;
+    appendPacket(packet, payload);
+    return sendAll(packet.data(), packet.size());
+}
+
+bool ClientConnect::sendOnStream(uint32_t stream, std::string data)
+{
+    return isConnected && muxMode && stream != StreamMux::chatStream && mux.enqueue(stream, std::move(data));
+}
+
+bool ClientConnect::receivePooled(uint32_t len, BufferPool::Buffer& cipher, BufferPool::Buffer& plain)
+{
+    if (!recvAll(cipher.data(), len))
+        return false;
+
+    if (ssl)
     {
-        isConnected = false;
-        shutdown(clientSocket, SHUT_RDWR);
-        close(clientSocket);
+        handleProtocolPacket(std::string_view(cipher.data(), len));
+        return true;
+    }
+
+    size_t plainLen = 0;
+    if (!FreiaEncryption::decryptInto(cipher.data(), len, serverSessionKey, plain.data(), plainLen) || plainLen == 0)
+    {
+        addMessage("[Decryption failed]");
+        return true;
     }
+
+    handleProtocolPacket(std::string_view(plain.data(), plainLen));
+    return true;
 }
 
-void ClientConnect::receiveMessages()
+bool ClientConnect::receiveStreamed(uint32_t len)
 {
-    while (isConnected)
+    // Only one chunk of the frame is held at a time, the message itself goes
+    // into one buffer of its final size as soon as the header says what that is.
+    static const size_t chunkSize = 64 * 1024;
+    static const size_t maxHeader = 4096;
+
+    std::vector<char> chunk(std::min<size_t>(chunkSize, len));
+    FreiaEncryption::Decryptor outer(serverSessionKey);
+    std::unique_ptr<FreiaEncryption::Decryptor> inner;
+    std::string plain;      // outer plaintext not consumed yet
+    std::string sender;
+    ChatFrame::Header header;
+    size_t bodyBytes = 0;
+    std::string iv;         // the message ID needs the IV in front of the body
+    bool headerDone = false;
+    bool outerFailed = false;
+
+    // Ciphertext in lazy mode, message text otherwise. E2EE plaintext is never
+    // longer than its ciphertext, so cipherLen bytes hold either.
+    BufferPool::Buffer pooled;
+    std::string unpooled;
+    char* body = nullptr;
+    size_t bodyLen = 0;
+
+    // Set once the message is known to be unwanted. Reported only after the
+    // whole frame decrypted, so a corrupt frame still reads as a decryption failure.
+    bool discard = false;
+    std::string error;
+
+    for (size_t remaining = len; remaining > 0;)
     {
-        // 1) Read length prefix
-        uint32_t netLen = 0;
-        int r = recv(clientSocket, &netLen, sizeof(netLen), MSG_WAITALL);
-        if (r <= 0)
+        size_t n = std::min(chunk.size(), remaining);
+        if (!recvAll(chunk.data(), n))
+            return false;
+        remaining -= n;
+        if (outerFailed)
+            continue;
+
+        if (ssl)
+            plain.append(chunk.data(), n);
+        else if (!outer.update(chunk.data(), n, plain) || (remaining == 0 && !outer.finish(plain)))
         {
-            addMessage("[Disconnected from server]");
-            isConnected = false;
-            break;
+            outerFailed = true;
+            continue;
         }
 
-        uint32_t len = ntohl(netLen);
-        static constexpr uint32_t MAX_PACKET = 10 * 1024 * 1024;
-        if (len == 0 || len > MAX_PACKET)
+        if (!headerDone)
         {
-            addMessage("[Error] Invalid message length received.");
-            isConnected = false;
-            break;
+            if (!headerBuffered(plain) && plain.size() <= maxHeader && remaining > 0)
+                continue;
+
+            headerDone = true;
+            if (startsWith(plain, senderBinding))
+            {
+                // Tiny, it only comes this way when the pool is exhausted
+                error = remaining == 0 ? bindSender(plain) : "[Protocol error] invalid SNDR1 binding.";
+                discard = true;
+                continue;
+            }
+            error = parseChatHeader(plain, header);
+
+            // Muted senders are dropped before the E2EE pass
+            bool muted = header.muted;
+            if (muted)
+                error.clear();
+            else if (error.empty() && header.cipherLen > len)
+                error = "[Protocol error] PROT1 length out of range.";
+            discard = muted || !error.empty();
+            if (discard)
+                continue;
+
+            sender = header.user;
+            plain.erase(0, header.size);
+            pooled = BufferPool::global().acquire(header.cipherLen);
+            if (pooled)
+                body = pooled.data();
+            else
+            {
+                unpooled.resize(header.cipherLen);
+                body = unpooled.data();
+            }
+            if (!lazyDecrypt)
+                inner = std::make_unique<FreiaEncryption::Decryptor>(sessionKey);
         }
 
-        // 2) Read encryptedData payload
-        std::string encryptedData(len, '\0');
-        r = recv(clientSocket, encryptedData.data(), len, MSG_WAITALL);
-        if (r <= 0)
+        if (discard)
         {
-            addMessage("[Disconnected from server]");
-            isConnected = false;
-            break;
+            plain.clear();
+            continue;
         }
 
-        // 3) Handle Package
-        if (!hasChatKey)
+        // Resent and echoed frames are dropped before the E2EE pass
+        if (iv.size() < DuplicateFilter::ivSize)
         {
-            addMessage("[Error] Received encrypted message but no password is set.");
-            continue;
+            iv.append(plain, 0, DuplicateFilter::ivSize - iv.size());
+            if (iv.size() == DuplicateFilter::ivSize && duplicates.seen(DuplicateFilter::messageId(sender, iv)))
+            {
+                discard = true;
+                plain.clear();
+                continue;
+            }
+        }
+
+        // The ciphertext fills the rest of the frame, as in handleProtocolPacket
+        bodyBytes += plain.size();
+        if (bodyBytes > header.cipherLen)
+        {
+            error = "[Protocol error] PROT1 length out of range.";
+            discard = true;
+        }
+        else if (lazyDecrypt)
+        {
+            std::copy(plain.begin(), plain.end(), body + bodyLen);
+            bodyLen += plain.size();
         }
-        
-        handleProtocolPacket(encryptedData);
+        else if (!inner->update(plain.data(), plain.size(), body, bodyLen))
+        {
+            error = "[Chat decryption failed]";
+            discard = true;
+        }
+        plain.clear();
     }
 
-    disconnect();
+    if (outerFailed)
+    {
+        addMessage("[Decryption failed]");
+        return true;
+    }
+    if (discard)
+    {
+        if (!error.empty())
+            addMessage(error);
+        return true;
+    }
+
+    if (bodyBytes != header.cipherLen)
+    {
+        addMessage("[Protocol error] PROT1 length out of range.");
+        return true;
+    }
+
+    if (lazyDecrypt)
+    {
+        addMessage(seal(sender, std::string_view(body, bodyLen)));
+        return true;
+    }
+
+    if (!inner->finish(body, bodyLen) || bodyLen == 0)
+    {
+        addMessage("[Chat decryption failed]");
+        return true;
+    }
+
+    std::string line = sender + ": ";
+    line.append(body, bodyLen);
+    addMessage(line);
+    return true;
 }
 
 
 void ClientConnect::addMessage(const std::string &message)
 {
-    std::lock_guard<std::mutex> lock(chatMutex);
-    chatMessages.push_back(message);
+    size_t index = history.append(message);
+    if (messageListener)
+        messageListener(index, message);
 }
 
 void ClientConnect::sendMessage(const std::string& text)
 {
-    if (!isConnected || text.empty())
+    if (!hasChatKey || text.empty())
         return;
 
     // 1. Encrypt chat message (E2EE)
@@ -152,36 +1729,67 @@ void ClientConnect::sendMessage(const std::string& text)
         addMessage("[Error] Chat encryption failed.");
         return;
     }
-    // 2. Build PROT1 frame (plaintext to server)
+    // The server's echo of this message is a duplicate of the local echo below
+    duplicates.seen(DuplicateFilter::messageId(user, chatCipher));
 
-    std::string frame = "PROT1\n" + user + "\n" + std::to_string(chatCipher.size()) + "\n";
-    frame.append(chatCipher);
+    // 2. Build PROT1 frame (plaintext to server)
 
-    // 3. Encrypt with SERVER password (transport layer)
-    std::string transportCipher = FreiaEncryption::encryptData(frame, serverSessionKey);
+    std::string frame = ChatFrame::build(user, chatCipher);
 
-    if (transportCipher.empty())
+    // 3. Queue for the writer thread. It paces sends through the send bucket
+    // and applies the transport layer. Offline the frame goes to disk instead.
+    bool queuedOffline = false;
+    bool firstOffline = false;
+    bool durable = true;
     {
-        addMessage("[Error] Server-layer encryption failed.");
-        return;
-    }
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        size_t waiting = writerActive ? outbox.size() : offline.size();
+        if (waiting >= maxOutbox)
+        {
+            addMessage("[Error] Too many messages waiting to be sent.");
+            return;
+        }
 
-    // 4. Length prefix + send
+        if (writerActive)
+        {
+            outbox.push_back(std::move(frame));
+            outboxPushed = true;
+        }
+        else
+        {
+            queuedOffline = true;
+            firstOffline = offline.empty();
+            durable = offline.append(frame);
+        }
+    }
 
-    uint32_t len = transportCipher.size();
-    uint32_t netLen = htonl(len); // convert to network byte order
+    if (queuedOffline)
+    {
+        if (!durable)
+            addMessage("[Error] Could not save the message to disk, it is lost if the client exits.");
+        else if (firstOffline)
+            addMessage("[Not connected, messages are kept and sent after reconnecting]");
+    }
+    else
+    {
+        outboxReady.notify_one();
+        if (muxMode)
+            mux.interrupt();
+    }
 
-    send(clientSocket, &netLen, sizeof(netLen), 0);
-    send(clientSocket, transportCipher.data(), transportCipher.size(), 0);
+    // 4. Local echo (PLAINTEXT, or still sealed with lazy decryption)
+    addMessage(lazyDecrypt ? seal(user, chatCipher) : user + ": " + text);
+}
 
-    // 5. Local echo (PLAINTEXT)
-    addMessage(user + ": " + text);
+std::string ClientConnect::messageAt(size_t index) const
+{
+    return reveal(history.at(index));
 }
 
-const std::vector<std::string>& ClientConnect::getMessages() const
+void ClientConnect::setHistoryLimits(size_t memoryBytes, uint64_t diskBytes)
 {
-    std::lock_guard<std::mutex> lock(chatMutex);
-    return chatMessages;
+    history.setMemoryLimit(memoryBytes);
+    history.setDiskLimit(diskBytes);
 }
 
 bool ClientConnect::configure(
@@ -191,7 +1799,7 @@ bool ClientConnect::configure(
     const char* chatPassword,
     const char* serverPassword)
 {
-    if (!Validation::isValidIP(ip)) return false;
+    if (!Validation::isValidServerList(ip)) return false;
     if (!Validation::isValidPort(port)) return false;
     if (!Validation::isValidUser(user)) return false;
     if (!Validation::isValidPassword(chatPassword)) return false;
@@ -199,18 +1807,59 @@ bool ClientConnect::configure(
 
     int p = std::atoi(port);
 
-    this->ip   = ip;
-    this->port = p;
+    {
+        std::lock_guard<std::mutex> lock(connectMutex);
+        this->ip   = ip;
+        this->port = p;
+        servers = Validation::parseServerList(ip);
+    }
     this->user = user;
 
     this->chatPassword   = chatPassword   ? chatPassword   : "";
     this->serverPassword = serverPassword ? serverPassword : "";
 
-    // Derive Chat Session Key
+    // Both keys are derived side by side on the pool, PBKDF2 is the slow part
+    auto deriveLater = [](const std::string& password)
+    {
+        return Executor::global().submit(Executor::Priority::Interactive,
+                                         [password] { return FreiaEncryption::deriveKey(password); });
+    };
+    std::future<FreiaEncryption::Key> chatKey;
+    std::future<FreiaEncryption::Key> serverKey;
     if (!this->chatPassword.empty())
+        chatKey = deriveLater(this->chatPassword);
+    if (!this->serverPassword.empty())
+        serverKey = deriveLater(this->serverPassword);
+
+    // Derive Chat Session Key
+    if (chatKey.valid())
     {
-        sessionKey = FreiaEncryption::deriveKey(this->chatPassword);
+        sessionKey = chatKey.get();
         hasChatKey = true;
+        {
+            // Everyone with this chat key lands on the same cluster node
+            std::lock_guard<std::mutex> lock(connectMutex);
+            chatPosition = HashRing::position("freia-thiwi chat\n" + std::string(sessionKey.begin(), sessionKey.end()));
+        }
+
+        // Fall back to an anonymous spill file when the journal is off or unusable
+        if (!persistHistory || !history.open(journalPath(), sessionKey))
+            history.setKey(sessionKey);
+
+        // Messages left from an earlier run go out with the next connection.
+        // Without persistent history nothing is written to disk, not even these.
+        std::string outboxPath = persistHistory ? journalPath(".outbox") : std::string();
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        if (outboxPath.empty() || !offline.open(outboxPath, sessionKey))
+            offline.close();
+
+        // Their local echo was shown when they were written, the server's must not add another
+        for (const std::string& frame : offline.frames())
+        {
+            ChatFrame::Header header;
+            if (ChatFrame::parseHeader(frame, header).empty() && header.cipherLen <= frame.size() - header.size)
+                duplicates.seen(DuplicateFilter::messageId(header.user, std::string_view(frame).substr(header.size)));
+        }
     }
     else
     {
@@ -218,9 +1867,9 @@ bool ClientConnect::configure(
     }
 
     // Derive Server Session Key
-    if (!this->serverPassword.empty())
+    if (serverKey.valid())
     {
-        serverSessionKey = FreiaEncryption::deriveKey(this->serverPassword);
+        serverSessionKey = serverKey.get();
         hasServerKey = true;
     }
     else
@@ -231,90 +1880,181 @@ bool ClientConnect::configure(
     return hasChatKey && hasServerKey;
 }
 
-void ClientConnect::handleProtocolPacket(const std::string& encryptedData)
+void ClientConnect::handleProtocolPacket(std::string_view frame)
 {
-    std::string plaintext =
-        FreiaEncryption::decryptData(encryptedData, serverSessionKey);
+    if (startsWith(frame, senderBinding))
+    {
+        std::string error = bindSender(frame);
+        if (!error.empty())
+            addMessage(error);
+        return;
+    }
 
-    if (plaintext.empty()) {
-        addMessage("[Decryption failed]");
+    // Header lines are parsed in place, nothing is copied until we know we want the message
+    ChatFrame::Header header;
+    std::string error = parseChatHeader(frame, header);
+
+    // Muted senders are dropped before the E2EE pass
+    if (header.muted)
+        return;
+
+    if (!error.empty()) {
+        addMessage(error);
         return;
     }
 
-    auto parts = splitByNewline(plaintext);
-    if (parts.empty()) {
-        addMessage("[Protocol error] empty packet.");
+    // The ciphertext fills the rest of the frame, right after the header
+    if (header.cipherLen != frame.size() - header.size) {
+        addMessage("[Protocol error] PROT1 length out of range.");
         return;
     }
+    std::string_view cipher = frame.substr(header.size);
 
-    const std::string& proto = parts[0];
+    // Resent and echoed frames are dropped before the E2EE pass. Anything
+    // shorter than an IV cannot be a message and is not remembered.
+    if (cipher.size() >= DuplicateFilter::ivSize && duplicates.seen(DuplicateFilter::messageId(header.user, cipher)))
+        return;
 
-    if (proto == "PROT1")
+    if (lazyDecrypt)
     {
-        // We expect at least:
-        // 0: "PROT1"
-        // 1: username
-        // 2: length
-        // plus ciphertext bytes after the third newline
-        if (parts.size() < 3) {
-            addMessage("[Protocol error] malformed PROT1 header.");
-            return;
-        }
+        addMessage(seal(header.user, cipher));
+        return;
+    }
 
-        const std::string& messageUser = parts[1];
+    std::string text = FreiaEncryption::decryptData(cipher.data(), cipher.size(), sessionKey);
+    if (text.empty()) {
+        addMessage("[Chat decryption failed]");
+        return;
+    }
 
-        size_t len = 0;
-        try {
-            len = std::stoul(parts[2]);
-        } catch (...) {
-            addMessage("[Protocol error] invalid length in PROT1.");
-            return;
-        }
+    addMessage(std::string(header.user) + ": " + text);
+}
 
-        if (len == 0 || len > plaintext.size()) {
-            addMessage("[Protocol error] PROT1 length out of range.");
-            return;
-        }
+std::string ClientConnect::parseChatHeader(std::string_view frame, ChatFrame::Header& header) const
+{
+    if (!startsWith(frame, numberedTag))
+    {
+        std::string error = ChatFrame::parseHeader(frame, header);
+        header.muted = isMuted(header.user);
+        return error;
+    }
 
-        // Ciphertext is the last `len` bytes of the plaintext frame
-        std::string cipher = plaintext.substr(plaintext.size() - len);
+    // The sender is a number; its name and mute state are one table lookup
+    std::string_view rest = frame.substr(numberedTag.size());
+    uint64_t id = 0;
+    uint64_t cipherLen = 0;
+    if (!SenderTable::readVarint(rest, id) || !SenderTable::readVarint(rest, cipherLen))
+        return "[Protocol error] malformed PROT2 header.";
+    if (cipherLen == 0 || cipherLen > SIZE_MAX)
+        return "[Protocol error] PROT2 length out of range.";
+    if (!senders.lookup(id, header.user, header.muted))
+        return "[Protocol error] PROT2 from unknown sender " + std::to_string(id) + ".";
 
-        std::string text = FreiaEncryption::decryptData(cipher, sessionKey);
-        if (text.empty()) {
-            addMessage("[Chat decryption failed]");
-            return;
-        }
+    header.cipherLen = static_cast<size_t>(cipherLen);
+    header.size = frame.size() - rest.size();
+    return "";
+}
 
-        addMessage(messageUser + ": " + text);
-    }
-    else
-    {
-        addMessage("[Unknown protocol] " + proto);
-    }
+std::string ClientConnect::bindSender(std::string_view frame)
+{
+    std::string_view rest = frame.substr(senderBinding.size());
+    uint64_t id = 0;
+    if (!SenderTable::readVarint(rest, id) || !senders.bind(id, rest, isMuted(rest)))
+        return "[Protocol error] invalid SNDR1 binding.";
+    return "";
 }
 
+std::string ClientConnect::seal(std::string_view sender, std::string_view cipher)
+{
+    std::string entry(1, MessageStore::sealedPrefix);
+    entry.append(sender);
+    entry += '\n';
+    entry.append(cipher);
+    return entry;
+}
+
+std::string ClientConnect::reveal(const std::string& entry) const
+{
+    if (!MessageStore::isSealed(entry))
+        return entry;
+
+    size_t nl = entry.find('\n', 1);
+    if (nl == std::string::npos)
+        return "[Chat decryption failed]";
+
+    std::string sender = entry.substr(1, nl - 1);
+    std::string cipher = entry.substr(nl + 1);
+
+    // Not the IV alone: the peer picks it and may reuse it for another message
+    std::string cacheKey = FreiaEncryption::hashHex(entry);
+    std::string line;
+    if (plaintextCache.get(cacheKey, line))
+        return line;
+
+    std::string text = FreiaEncryption::decryptData(cipher, sessionKey);
+    if (text.empty())
+        return "[Chat decryption failed]";
+
+    line = sender + ": " + text;
+    plaintextCache.put(cacheKey, line);
+    return line;
+}
+
+void ClientConnect::muteSender(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(muteMutex);
+    auto [it, inserted] = mutedNames.insert(name);
+    if (inserted)
+        mutedLookup.insert(*it);
+    senders.setMuted(name, true);
+}
+
+void ClientConnect::unmuteSender(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(muteMutex);
+    auto it = mutedNames.find(name);
+    if (it == mutedNames.end())
+        return;
 
+    mutedLookup.erase(*it);
+    mutedNames.erase(it);
+    senders.setMuted(name, false);
+}
+
+std::vector<std::string> ClientConnect::mutedSenders() const
+{
+    std::lock_guard<std::mutex> lock(muteMutex);
+    return std::vector<std::string>(mutedNames.begin(), mutedNames.end());
+}
 
-std::vector<std::string> ClientConnect::splitByNewline(const std::string& s)
+bool ClientConnect::isMuted(std::string_view name) const
 {
-    std::vector<std::string> out;
-    std::string current;
+    std::lock_guard<std::mutex> lock(muteMutex);
+    return mutedLookup.count(name) != 0;
+}
+
+std::string ClientConnect::journalPath(const char* extension) const
+{
+    const char* xdg = std::getenv("XDG_DATA_HOME");
+    const char* home = std::getenv("HOME");
+
+    std::string base;
+    if (xdg && *xdg)
+        base = xdg;
+    else if (home && *home)
+        base = std::string(home) + "/.local/share";
+    else
+        return "";
 
-    for (char c : s)
+    std::string dir;
+    for (const std::string& part : {base, std::string("/freia-thiwi"), std::string("/history")})
     {
-        if (c == '\n')
-        {
-            out.push_back(current);
-            current.clear();
-        }
-        else
-        {
-            current += c;
-        }
+        dir += part;
+        mkdir(dir.c_str(), 0700);
     }
 
-    if (!current.empty())
-        out.push_back(current);
-
-    return out;
-}
\ No newline at end of file
+    // One journal per server, user and chat key. The name reveals none of them.
+    std::string id = ip + ":" + std::to_string(port) + "\n" + user + "\n"
+                   + std::string(sessionKey.begin(), sessionKey.end());
+    return dir + "/" + FreiaEncryption::hashHex(id).substr(0, 32) + extension;
+}
@@ -0,0 +1,360 @@
+#include "DaemonClient.h"
+#include "Validation.h"
+#include <algorithm>
+#include <charconv>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static size_t distance(size_t a, size_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+static int connectDaemon()
+{
+    std::string path = DaemonProtocol::socketPath();
+    sockaddr_un addr{};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return -1;
+    addr.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), addr.sun_path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        return -1;
+    // Passwords go over this socket, only to a daemon of our own user
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) == -1 || !DaemonProtocol::peerIsUs(sock))
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+DaemonClient::~DaemonClient()
+{
+    if (attacher.joinable())
+        attacher.join();
+
+    // Nobody is going to look at a session that never got going
+    if (ring.isOpen() && connectState() == ConnectState::Failed)
+    {
+        std::string reply;
+        request("CLOSE", reply);
+    }
+
+    if (fd != -1)
+        close(fd);
+}
+
+bool DaemonClient::available()
+{
+    int sock = connectDaemon();
+    if (sock == -1)
+        return false;
+    close(sock);
+    return true;
+}
+
+DaemonClient* DaemonClient::resume()
+{
+    DaemonClient* client = new DaemonClient();
+    std::string reply;
+    if (!client->openSocket() || !client->request("LIST", reply) || reply.empty())
+    {
+        delete client;
+        return nullptr;
+    }
+
+    // Lines are "id\tuser@host:port", the first session wins
+    std::string id = reply.substr(0, reply.find('\t'));
+    if (!client->attachWith("RESUME\n" + id))
+    {
+        delete client;
+        return nullptr;
+    }
+
+    client->attachStatus = ConnectState::Connected;
+    return client;
+}
+
+bool DaemonClient::openSocket()
+{
+    std::lock_guard<std::mutex> lock(socketMutex);
+    if (fd == -1)
+        fd = connectDaemon();
+    return fd != -1;
+}
+
+bool DaemonClient::request(const std::string& payload, std::string& reply) const
+{
+    // Replies come back without their "OK\n"; on "ERR" reply holds the message
+    std::lock_guard<std::mutex> lock(socketMutex);
+    if (fd == -1 || !DaemonProtocol::sendFrame(fd, payload) || !DaemonProtocol::recvFrame(fd, reply))
+    {
+        reply = "Lost connection to the daemon.";
+        return false;
+    }
+
+    bool ok = reply.compare(0, 2, "OK") == 0;
+    reply.erase(0, std::min(reply.size(), ok ? size_t(3) : size_t(4)));
+    return ok;
+}
+
+bool DaemonClient::attachWith(const std::string& payload)
+{
+    // Reply is "id\nringName"
+    std::string reply;
+    if (!request(payload, reply))
+    {
+        attachFailure = reply;
+        return false;
+    }
+
+    size_t nl = reply.find('\n');
+    if (nl == std::string::npos || !ring.attach(reply.substr(nl + 1)))
+    {
+        attachFailure = "Could not open the daemon's message ring.";
+        return false;
+    }
+    return true;
+}
+
+bool DaemonClient::configure(const char* ip, const char* port, const char* user,
+                             const char* chatPassword, const char* serverPassword)
+{
+    if (!Validation::isValidServerList(ip)) return false;
+    if (!Validation::isValidPort(port)) return false;
+    if (!Validation::isValidUser(user)) return false;
+    if (!Validation::isValidPassword(chatPassword)) return false;
+    if (!Validation::isValidPassword(serverPassword)) return false;
+
+    // The keys are derived by the daemon, once per session
+    this->host = ip;
+    this->port = port;
+    this->user = user;
+    this->chatPassword = chatPassword;
+    this->serverPassword = serverPassword;
+    return true;
+}
+
+bool DaemonClient::connectToServer()
+{
+    if (attachStatus == ConnectState::Connecting || ring.isOpen())
+        return false;
+
+    if (attacher.joinable())
+        attacher.join();
+
+    attachFailure.clear();
+    attachStatus = ConnectState::Connecting;
+    attacher = std::thread(&DaemonClient::runAttach, this);
+    return true;
+}
+
+void DaemonClient::runAttach()
+{
+    std::string payload = "ATTACH\n" + host + "\n" + port + "\n" + user + "\n" + std::to_string(flags) +
+                          "\n" + chatPassword + "\n" + serverPassword;
+    chatPassword.clear();
+    serverPassword.clear();
+
+    if (!openSocket())
+    {
+        attachFailure = "Could not reach the daemon.";
+        attachStatus = ConnectState::Failed;
+        return;
+    }
+
+    if (!attachWith(payload))
+    {
+        attachStatus = ConnectState::Failed;
+        return;
+    }
+
+    std::string reply;
+    request("PACE\n" + std::to_string(sendRate) + "\n" + std::to_string(sendBurst), reply);
+    attachStatus = ConnectState::Connected;
+}
+
+void DaemonClient::setLowLatency(bool enabled, int cpu)
+{
+    setFlag(DaemonProtocol::lowLatency, enabled);
+    unsigned pinned = cpu >= 0 && cpu < 0xffff ? static_cast<unsigned>(cpu) + 1 : 0;
+    flags = (flags & ((1u << DaemonProtocol::pinnedCpuShift) - 1)) | (pinned << DaemonProtocol::pinnedCpuShift);
+}
+
+void DaemonClient::setSendRate(unsigned messagesPerSecond, unsigned burst)
+{
+    // Before attaching the values go out with the attach, a resumed session keeps its own
+    sendRate = messagesPerSecond;
+    sendBurst = burst;
+    if (attachStatus == ConnectState::Connected)
+    {
+        std::string reply;
+        request("PACE\n" + std::to_string(sendRate) + "\n" + std::to_string(sendBurst), reply);
+    }
+}
+
+void DaemonClient::disconnect()
+{
+    if (!ring.isOpen())
+        return;
+
+    std::string reply;
+    request("CLOSE", reply);
+    ring.close();
+    rows.clear();
+    attachStatus = ConnectState::Idle;
+}
+
+ChatSession::ConnectState DaemonClient::connectState() const
+{
+    if (attachStatus != ConnectState::Connected)
+        return attachStatus;
+
+    // The daemon's session state, published in the ring header
+    return static_cast<ConnectState>(ring.status() & 0xff);
+}
+
+std::string DaemonClient::connectError() const
+{
+    if (!attachFailure.empty())
+        return attachFailure;
+
+    std::string reply;
+    request("ERROR", reply);
+    return reply;
+}
+
+bool DaemonClient::isConnectedToServer() const
+{
+    return attachStatus == ConnectState::Connected && (ring.status() & 0x100) != 0;
+}
+
+void DaemonClient::sendMessage(const std::string& text)
+{
+    std::string reply;
+    request("SEND\n" + text, reply);
+}
+
+void DaemonClient::cacheRow(size_t index, std::string text) const
+{
+    // Drop whatever is furthest away from the row being added
+    while (rows.size() >= maxRows)
+    {
+        auto victim = distance(index, rows.begin()->first) > distance(index, rows.rbegin()->first)
+            ? rows.begin()
+            : std::prev(rows.end());
+        rows.erase(victim);
+    }
+    rows[index] = std::move(text);
+}
+
+void DaemonClient::drainRing() const
+{
+    uint64_t index = 0;
+    std::string text;
+    bool truncated = false;
+
+    while (true)
+    {
+        MessageRing::ReadResult result = ring.next(index, text, truncated);
+        if (result == MessageRing::ReadResult::Empty)
+            break;
+
+        // Fell a whole ring behind: refetch whatever is on screen
+        if (result == MessageRing::ReadResult::Overrun)
+        {
+            rows.clear();
+            continue;
+        }
+
+        // Retention dropped old history in the daemon, every index moved
+        if (index < lastIndex)
+            rows.clear();
+        lastIndex = index;
+
+        if (!truncated)
+            cacheRow(index, std::move(text));
+    }
+}
+
+size_t DaemonClient::messageCount() const
+{
+    if (!ring.isOpen())
+        return 0;
+
+    drainRing();
+    return ring.count();
+}
+
+std::string DaemonClient::messageAt(size_t index) const
+{
+    auto it = rows.find(index);
+    if (it != rows.end())
+        return it->second;
+
+    // Fetch the whole block around the row, the neighbours are on screen too
+    size_t from = index - index % fetchBlock;
+    std::string reply;
+    if (!request("READ\n" + std::to_string(from) + "\n" + std::to_string(fetchBlock), reply))
+        return "[History unavailable]";
+
+    std::string_view in(reply);
+    std::string_view blob;
+    for (size_t i = from; DaemonProtocol::nextBlob(in, blob); i++)
+        cacheRow(i, std::string(blob));
+
+    it = rows.find(index);
+    return it != rows.end() ? it->second : std::string();
+}
+
+std::vector<size_t> DaemonClient::searchMessages(const std::string& query, size_t limit) const
+{
+    std::vector<size_t> hits;
+    std::string reply;
+    if (!request("SEARCH\n" + std::to_string(limit) + "\n" + query, reply))
+        return hits;
+
+    std::string_view in(reply);
+    while (!in.empty())
+    {
+        size_t nl = std::min(in.find('\n'), in.size());
+        size_t hit = 0;
+        if (std::from_chars(in.data(), in.data() + nl, hit).ec == std::errc())
+            hits.push_back(hit);
+        in.remove_prefix(std::min(nl + 1, in.size()));
+    }
+    return hits;
+}
+
+void DaemonClient::muteSender(const std::string& name)
+{
+    std::string reply;
+    request("MUTE\n" + name, reply);
+}
+
+void DaemonClient::unmuteSender(const std::string& name)
+{
+    std::string reply;
+    request("UNMUTE\n" + name, reply);
+}
+
+std::vector<std::string> DaemonClient::mutedSenders() const
+{
+    std::vector<std::string> names;
+    std::string reply;
+    if (!request("MUTED", reply))
+        return names;
+
+    size_t start = 0;
+    while (start < reply.size())
+    {
+        size_t nl = std::min(reply.find('\n', start), reply.size());
+        names.push_back(reply.substr(start, nl - start));
+        start = nl + 1;
+    }
+    return names;
+}
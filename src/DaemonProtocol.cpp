@@ -0,0 +1,132 @@
+#include "DaemonProtocol.h"
+#include <charconv>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+std::string DaemonProtocol::socketPath()
+{
+    // The runtime dir is per user and 0700 already; /tmp needs our own
+    std::string dir;
+    if (const char* runtime = std::getenv("XDG_RUNTIME_DIR"); runtime && *runtime)
+        dir = std::string(runtime) + "/freia-thiwi";
+    else
+        dir = "/tmp/freia-thiwi-" + std::to_string(getuid());
+
+    // Someone else may have made it first, in /tmp that is an attack
+    struct stat st{};
+    if ((mkdir(dir.c_str(), 0700) == -1 && errno != EEXIST) || lstat(dir.c_str(), &st) == -1)
+    {
+        std::cerr << "Failed to create " << dir << ", errno: " << errno << "\n";
+        return "";
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 0777) != 0700)
+    {
+        std::cerr << dir << " is not a private directory of this user\n";
+        return "";
+    }
+    return dir + "/daemon.sock";
+}
+
+bool DaemonProtocol::peerIsUs(int fd)
+{
+    ucred cred{};
+    socklen_t credLen = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == 0 && cred.uid == getuid();
+}
+
+static bool writeAll(int fd, const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, data, len, MSG_WAITALL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool DaemonProtocol::sendFrame(int fd, const std::string& payload)
+{
+    if (payload.size() > maxFrame)
+        return false;
+
+    uint32_t netLen = htonl(static_cast<uint32_t>(payload.size()));
+    return writeAll(fd, reinterpret_cast<const char*>(&netLen), sizeof(netLen)) &&
+           writeAll(fd, payload.data(), payload.size());
+}
+
+bool DaemonProtocol::recvFrame(int fd, std::string& payload)
+{
+    uint32_t netLen = 0;
+    if (!readAll(fd, reinterpret_cast<char*>(&netLen), sizeof(netLen)))
+        return false;
+
+    uint32_t len = ntohl(netLen);
+    if (len > maxFrame)
+        return false;
+
+    payload.resize(len);
+    return readAll(fd, payload.data(), len);
+}
+
+bool DaemonProtocol::split(std::string_view payload, size_t count, std::vector<std::string_view>& fields)
+{
+    fields.clear();
+    while (fields.size() + 1 < count)
+    {
+        size_t nl = payload.find('\n');
+        if (nl == std::string_view::npos)
+            return false;
+        fields.push_back(payload.substr(0, nl));
+        payload.remove_prefix(nl + 1);
+    }
+    fields.push_back(payload);
+    return true;
+}
+
+void DaemonProtocol::appendBlob(std::string& out, std::string_view blob)
+{
+    out += std::to_string(blob.size());
+    out += '\n';
+    out.append(blob);
+}
+
+bool DaemonProtocol::nextBlob(std::string_view& in, std::string_view& blob)
+{
+    size_t nl = in.find('\n');
+    if (nl == std::string_view::npos)
+        return false;
+
+    size_t len = 0;
+    auto [end, ec] = std::from_chars(in.data(), in.data() + nl, len);
+    if (ec != std::errc() || end != in.data() + nl || len > in.size() - nl - 1)
+        return false;
+
+    blob = in.substr(nl + 1, len);
+    in.remove_prefix(nl + 1 + len);
+    return true;
+}
@@ -0,0 +1,508 @@
+#include "DatagramLink.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+static void putU16(char* out, uint16_t value)
+{
+    value = htons(value);
+    std::memcpy(out, &value, sizeof(value));
+}
+
+static void putU32(char* out, uint32_t value)
+{
+    value = htonl(value);
+    std::memcpy(out, &value, sizeof(value));
+}
+
+static uint16_t getU16(const char* in)
+{
+    uint16_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return ntohs(value);
+}
+
+static uint32_t getU32(const char* in)
+{
+    uint32_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return ntohl(value);
+}
+
+static std::string makeHeader(uint8_t type, uint8_t count, uint16_t fragCount, uint32_t a, uint32_t b)
+{
+    std::string header(12, '\0');
+    header[0] = static_cast<char>(type);
+    header[1] = static_cast<char>(count);
+    putU16(&header[2], fragCount);
+    putU32(&header[4], a);
+    putU32(&header[8], b);
+    return header;
+}
+
+static int millisUntil(std::chrono::steady_clock::time_point when, int cap)
+{
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(when - std::chrono::steady_clock::now()).count();
+    return static_cast<int>(std::clamp<long long>(left, 0, cap));
+}
+
+DatagramLink::DatagramLink()
+    : random(std::random_device{}())
+{
+}
+
+void DatagramLink::setFaultInjection(double loss, int delayMs)
+{
+    lossRate = std::clamp(loss, 0.0, 1.0);
+    injectedDelay = std::chrono::milliseconds(std::max(0, delayMs));
+}
+
+bool DatagramLink::dropInjected()
+{
+    if (lossRate <= 0.0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(randomMutex);
+    return std::uniform_real_distribution<double>(0.0, 1.0)(random) < lossRate;
+}
+
+bool DatagramLink::open(const std::string& address, int port, int timeoutMs)
+{
+    close();
+    failure.clear();
+    dead = false;
+
+    // Dotted IPv4, as the resolver hands them out
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &server.sin_addr) != 1)
+    {
+        failure = "Invalid address";
+        return false;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        std::cerr << "Failed to create datagram socket, errno: " << errno << "\n";
+        failure = "No datagram socket";
+        return false;
+    }
+
+    // Room for a whole window in flight, overflowing our own buffers is loss too
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &socketBuffer, sizeof(socketBuffer));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &socketBuffer, sizeof(socketBuffer));
+
+    if (connect(sock, reinterpret_cast<sockaddr*>(&server), sizeof(server)) == -1)
+    {
+        std::cerr << "Datagram connect failed, errno: " << errno << "\n";
+        failure = "Server unreachable";
+        ::close(sock);
+        return false;
+    }
+
+    Clock::time_point now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        fd = sock;
+        nextSeq = 0;
+        unacked.clear();
+        backlog.clear();
+        backlogBytes = 0;
+        srtt = Clock::duration::zero();
+        rttvar = Clock::duration::zero();
+        rto = std::chrono::milliseconds(1000);
+        lastSend = now;
+    }
+    cumulative = 0;
+    receivedAbove.clear();
+    partials.clear();
+    partialBytes = 0;
+    ackPending = false;
+    delayed.clear();
+    nextTimer = now;
+
+    uint64_t nonce;
+    {
+        std::lock_guard<std::mutex> lock(randomMutex);
+        nonce = (static_cast<uint64_t>(random()) << 32) ^ random();
+    }
+    std::string hello = makeHeader(Hello, 0, 0, static_cast<uint32_t>(nonce >> 32), static_cast<uint32_t>(nonce));
+
+    // The handshake sees injected loss but not injected delay
+    Clock::time_point deadline = now + std::chrono::milliseconds(timeoutMs);
+    char buffer[2048];
+    while (Clock::now() < deadline)
+    {
+        transmit(hello);
+        Clock::time_point retryAt = std::min(deadline, Clock::now() + std::chrono::milliseconds(500));
+
+        for (int wait; (wait = millisUntil(retryAt, timeoutMs)) > 0;)
+        {
+            pollfd pfd{fd, POLLIN, 0};
+            if (::poll(&pfd, 1, wait) <= 0)
+                continue;
+
+            ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n < 0 && errno == ECONNREFUSED)
+            {
+                failure = "Server does not accept datagrams on this port";
+                close();
+                return false;
+            }
+            if (n == static_cast<ssize_t>(hello.size()) && std::memcmp(buffer, hello.data(), hello.size()) == 0 &&
+                !dropInjected())
+            {
+                lastHeard = Clock::now();
+                return true;
+            }
+        }
+    }
+
+    failure = "No answer to the datagram handshake";
+    close();
+    return false;
+}
+
+void DatagramLink::close()
+{
+    std::lock_guard<std::mutex> lock(sendMutex);
+    if (fd == -1)
+        return;
+
+    // Best effort, the server times the session out otherwise
+    if (!dead)
+    {
+        std::string bye = makeHeader(Close, 0, 0, 0, 0);
+        ::send(fd, bye.data(), bye.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    ::close(fd);
+    fd = -1;
+    dead = true;
+}
+
+void DatagramLink::transmit(const std::string& datagram)
+{
+    if (dropInjected())
+        return;
+
+    // A full socket buffer is just more loss, the resend timers deal with it
+    ::send(fd, datagram.data(), datagram.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+void DatagramLink::transmitLocked(Outgoing& out, Clock::time_point now)
+{
+    transmit(out.datagram);
+    out.sentAt = now;
+    ++out.sends;
+    lastSend = now;
+}
+
+bool DatagramLink::send(std::string_view message)
+{
+    std::lock_guard<std::mutex> lock(sendMutex);
+    if (fd == -1 || dead)
+        return false;
+
+    size_t fragCount = std::max<size_t>(1, (message.size() + maxPayload - 1) / maxPayload);
+    if (fragCount > UINT16_MAX || backlogBytes + message.size() > maxBacklog)
+        return false;
+
+    uint32_t first = nextSeq;
+    for (size_t i = 0; i < fragCount; ++i)
+    {
+        std::string datagram = makeHeader(Data, 0, static_cast<uint16_t>(fragCount), nextSeq++, first);
+        datagram.append(message.substr(std::min(message.size(), i * maxPayload), maxPayload));
+        backlogBytes += datagram.size();
+        backlog.push_back(std::move(datagram));
+    }
+
+    flushBacklog(Clock::now());
+    return true;
+}
+
+void DatagramLink::flushBacklog(Clock::time_point now)
+{
+    // sendMutex held
+    while (!backlog.empty() && unacked.size() < maxWindow)
+    {
+        std::string& datagram = backlog.front();
+        backlogBytes -= datagram.size();
+
+        Outgoing& out = unacked[getU32(datagram.data() + 4)];
+        out.datagram = std::move(datagram);
+        backlog.pop_front();
+        transmitLocked(out, now);
+    }
+}
+
+bool DatagramLink::poll(int timeoutMs, std::vector<std::string>& messages)
+{
+    if (fd == -1 || dead)
+        return false;
+
+    int wait = millisUntil(nextTimer, timeoutMs);
+    if (!delayed.empty())
+        wait = std::min(wait, millisUntil(delayed.front().due, timeoutMs));
+
+    pollfd pfd{fd, POLLIN, 0};
+    int rc = ::poll(&pfd, 1, wait);
+    if (rc < 0 && errno != EINTR)
+    {
+        failure = "Datagram socket failed";
+        dead = true;
+        return false;
+    }
+
+    Clock::time_point now = Clock::now();
+    char buffer[2048];
+    while (rc > 0)
+    {
+        // ECONNREFUSED and friends are left to the resend limit, ICMP is not trusted
+        ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        if (dropInjected())
+            continue;
+
+        if (injectedDelay.count() > 0)
+            delayed.push_back(Delayed{now + injectedDelay, std::string(buffer, n)});
+        else
+            handleDatagram(std::string_view(buffer, n), messages);
+    }
+
+    while (!delayed.empty() && delayed.front().due <= now)
+    {
+        handleDatagram(delayed.front().datagram, messages);
+        delayed.pop_front();
+    }
+
+    if (ackPending)
+        sendAck();
+
+    if (dead)
+        return false;
+    resendDue(now);
+
+    if (now - lastHeard > idleTimeout)
+    {
+        failure = "Server stopped answering";
+        dead = true;
+        return false;
+    }
+    return true;
+}
+
+void DatagramLink::handleDatagram(std::string_view datagram, std::vector<std::string>& messages)
+{
+    if (datagram.size() < headerSize)
+        return;
+
+    lastHeard = Clock::now();
+    switch (static_cast<uint8_t>(datagram[0]))
+    {
+    case Data:
+        handleData(datagram, messages);
+        break;
+    case Ack:
+        handleAck(datagram);
+        break;
+    case Ping:
+        ackPending = true;
+        break;
+    case Close:
+        failure = "Server closed the connection";
+        dead = true;
+        break;
+    default:
+        // Late HELLO echoes
+        break;
+    }
+}
+
+void DatagramLink::handleData(std::string_view datagram, std::vector<std::string>& messages)
+{
+    uint16_t fragCount = getU16(datagram.data() + 2);
+    uint32_t seq = getU32(datagram.data() + 4);
+    uint32_t first = getU32(datagram.data() + 8);
+    std::string_view payload = datagram.substr(headerSize);
+
+    // Duplicates are acknowledged again, the first ACK may have been lost
+    ackPending = true;
+    if (fragCount == 0 || seq - first >= fragCount)
+        return;
+    if (seq < cumulative || seq - cumulative >= maxReorder || receivedAbove.count(seq))
+        return;
+
+    auto partial = partials.end();
+    if (fragCount > 1)
+    {
+        partial = partials.find(first);
+        if (partial != partials.end() && partial->second.fragCount != fragCount)
+            return;
+        // Not acknowledged either, the sender tries again once messages completed
+        if (partialBytes + payload.size() > maxPartialBytes)
+            return;
+    }
+
+    if (seq == cumulative)
+    {
+        ++cumulative;
+        while (!receivedAbove.empty() && *receivedAbove.begin() == cumulative)
+        {
+            receivedAbove.erase(receivedAbove.begin());
+            ++cumulative;
+        }
+    }
+    else
+        receivedAbove.insert(seq);
+
+    if (fragCount == 1)
+    {
+        messages.emplace_back(payload);
+        return;
+    }
+
+    if (partial == partials.end())
+    {
+        partial = partials.emplace(first, Partial{}).first;
+        partial->second.fragCount = fragCount;
+        partial->second.parts.resize(fragCount);
+    }
+
+    Partial& p = partial->second;
+    p.parts[seq - first].assign(payload);
+    partialBytes += payload.size();
+    if (++p.received < p.fragCount)
+        return;
+
+    std::string message;
+    for (std::string& part : p.parts)
+    {
+        partialBytes -= part.size();
+        message += part;
+    }
+    partials.erase(partial);
+    messages.push_back(std::move(message));
+}
+
+void DatagramLink::sendAck()
+{
+    std::string ack = makeHeader(Ack, 0, 0, cumulative, 0);
+    size_t ranges = 0;
+    for (auto it = receivedAbove.begin(); it != receivedAbove.end() && ranges < maxAckRanges; ++ranges)
+    {
+        uint32_t from = *it;
+        uint32_t to = from + 1;
+        while (++it != receivedAbove.end() && *it == to)
+            ++to;
+
+        char range[8];
+        putU32(range, from);
+        putU32(range + 4, to);
+        ack.append(range, sizeof(range));
+    }
+    ack[1] = static_cast<char>(ranges);
+
+    transmit(ack);
+    ackPending = false;
+}
+
+void DatagramLink::handleAck(std::string_view datagram)
+{
+    size_t rangeCount = static_cast<uint8_t>(datagram[1]);
+    if (datagram.size() < headerSize + rangeCount * 8)
+        return;
+
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(sendMutex);
+
+    // Only datagrams sent once give a usable round trip (Karn)
+    auto acknowledge = [&](std::map<uint32_t, Outgoing>::iterator it)
+    {
+        if (it->second.sends == 1)
+            sampleRtt(now - it->second.sentAt);
+        return unacked.erase(it);
+    };
+
+    uint32_t highest = getU32(datagram.data() + 4);
+    for (auto it = unacked.begin(); it != unacked.end() && it->first < highest;)
+        it = acknowledge(it);
+
+    for (size_t i = 0; i < rangeCount; ++i)
+    {
+        uint32_t from = getU32(datagram.data() + headerSize + i * 8);
+        uint32_t to = getU32(datagram.data() + headerSize + i * 8 + 4);
+        for (auto it = unacked.lower_bound(from); it != unacked.end() && it->first < to;)
+            it = acknowledge(it);
+        highest = std::max(highest, to);
+    }
+
+    // Three later datagrams got through, this one is lost: resend without waiting
+    for (auto& [seq, out] : unacked)
+    {
+        if (seq + 3 >= highest)
+            break;
+        if (!out.fastResent)
+        {
+            out.fastResent = true;
+            transmitLocked(out, now);
+        }
+    }
+
+    flushBacklog(now);
+}
+
+void DatagramLink::sampleRtt(Clock::duration rtt)
+{
+    // RFC 6298 smoothing; sendMutex held
+    if (srtt == Clock::duration::zero())
+    {
+        srtt = rtt;
+        rttvar = rtt / 2;
+    }
+    else
+    {
+        Clock::duration error = srtt > rtt ? srtt - rtt : rtt - srtt;
+        rttvar = (3 * rttvar + error) / 4;
+        srtt = (7 * srtt + rtt) / 8;
+    }
+    rto = std::clamp<Clock::duration>(srtt + 4 * rttvar, minRto, maxRto);
+}
+
+void DatagramLink::resendDue(Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(sendMutex);
+
+    // Backoff per datagram, kept short: on a lossy link a long silence costs
+    // more than a duplicate. A dead server shows up as idleTimeout instead.
+    auto timeoutFor = [&](const Outgoing& out)
+    {
+        return std::min<Clock::duration>(rto * (1 << std::min(out.sends - 1, maxBackoff)), maxRto);
+    };
+
+    nextTimer = now + keepAlive;
+    for (auto& [seq, out] : unacked)
+    {
+        if (now - out.sentAt >= timeoutFor(out))
+            transmitLocked(out, now);
+        nextTimer = std::min(nextTimer, out.sentAt + timeoutFor(out));
+    }
+
+    // Keeps NAT bindings open and makes a vanished server show up as silence
+    if (now - lastSend >= keepAlive)
+    {
+        transmit(makeHeader(Ping, 0, 0, 0, 0));
+        lastSend = now;
+        nextTimer = std::min(nextTimer, now + keepAlive);
+    }
+}
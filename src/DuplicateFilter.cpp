@@ -0,0 +1,125 @@
+#include "DuplicateFilter.h"
+#include <algorithm>
+
+// splitmix64 finaliser, spreads every input bit over the whole word
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t DuplicateFilter::messageId(std::string_view sender, std::string_view cipher)
+{
+    // FNV-1a over "sender\nIV"
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto add = [&h](std::string_view bytes)
+    {
+        for (unsigned char c : bytes)
+        {
+            h ^= c;
+            h *= 0x100000001b3ULL;
+        }
+    };
+    add(sender);
+    add("\n");
+    add(cipher.substr(0, ivSize));
+    return mix(h);
+}
+
+DuplicateFilter::DuplicateFilter(std::chrono::seconds window)
+    : halfWindow(std::max<Clock::duration>(window / 2, std::chrono::seconds(1))),
+      generationStart(Clock::now()),
+      recent(exactBuckets)
+{
+}
+
+bool DuplicateFilter::seen(uint64_t id, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    rotate(now);
+
+    if ((test(generations[0], id) || test(generations[1], id)) && (recorded(id) || evictedLately(id)))
+        return true;
+
+    set(generations[current], id);
+    record(id);
+    return false;
+}
+
+void DuplicateFilter::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    generations = {};
+    std::fill(recent.begin(), recent.end(), Bucket{});
+    generationCount += 2;
+    generationStart = Clock::now();
+}
+
+void DuplicateFilter::rotate(Clock::time_point now)
+{
+    if (now - generationStart < halfWindow)
+        return;
+
+    // After a full window of silence both generations are out of date
+    if (now - generationStart >= 2 * halfWindow)
+    {
+        generations[current] = {};
+        generationCount++;
+    }
+
+    current ^= 1;
+    generationCount++;
+    generations[current] = {};
+    generationStart = now;
+}
+
+// Double hashing: probe i sits at id + i * step, the step is odd so the
+// probes never fall into a short cycle
+bool DuplicateFilter::test(const Bits& bits, uint64_t id)
+{
+    uint64_t step = mix(id) | 1;
+    for (unsigned i = 0; i < hashCount; ++i)
+    {
+        uint64_t bit = (id + i * step) % filterBits;
+        if (!(bits[bit / 64] & (1ULL << (bit % 64))))
+            return false;
+    }
+    return true;
+}
+
+void DuplicateFilter::set(Bits& bits, uint64_t id)
+{
+    uint64_t step = mix(id) | 1;
+    for (unsigned i = 0; i < hashCount; ++i)
+    {
+        uint64_t bit = (id + i * step) % filterBits;
+        bits[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+void DuplicateFilter::record(uint64_t id)
+{
+    Bucket& bucket = recent[id % exactBuckets];
+    if (bucket.ids[bucket.next] != 0)
+        bucket.evictedAt = generationCount;
+    bucket.ids[bucket.next] = id;
+    bucket.next = (bucket.next + 1) % exactWays;
+}
+
+bool DuplicateFilter::recorded(uint64_t id) const
+{
+    const Bucket& bucket = recent[id % exactBuckets];
+    return std::find(bucket.ids.begin(), bucket.ids.end(), id) != bucket.ids.end();
+}
+
+// An ID dropped in this generation or the one before may still be in the
+// filters, anything dropped earlier went with its generation
+bool DuplicateFilter::evictedLately(uint64_t id) const
+{
+    const Bucket& bucket = recent[id % exactBuckets];
+    return bucket.evictedAt != 0 && generationCount - bucket.evictedAt <= 1;
+}
\ No newline at end of file
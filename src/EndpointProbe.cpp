@@ -0,0 +1,296 @@
+#include "EndpointProbe.h"
+#include "Resolver.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+// How often lookups still out are looked at while connects are in flight
+static constexpr std::chrono::milliseconds lookupCheck{5};
+
+namespace
+{
+    // One connection attempt; a server with several addresses has several
+    struct Attempt
+    {
+        size_t server;
+        int fd;
+        Clock::time_point started;
+    };
+
+    // Starts a non-blocking connect. False with the reason in error when it
+    // failed on the spot.
+    bool startConnect(int domain, const sockaddr* address, socklen_t addressLen, int& fd, std::string& error)
+    {
+        fd = socket(domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            error = std::string("no socket: ") + std::strerror(errno);
+            return false;
+        }
+        if (connect(fd, address, addressLen) == -1 && errno != EINPROGRESS && errno != EAGAIN)
+        {
+            error = std::strerror(errno);
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    enum class Pick
+    {
+        None,           // wait for every attempt, keep nothing
+        Fastest,        // the first connection made
+        Preferred       // the first server in list order that accepts
+    };
+
+    // Runs one round and returns the descriptor of the pick, or -1
+    int race(const std::vector<Validation::ServerAddress>& servers, int defaultPort,
+             std::chrono::milliseconds timeout, Pick pick, std::vector<EndpointProbe::Result>& results,
+             size_t& winner)
+    {
+        Clock::time_point deadline = Clock::now() + timeout;
+        results.assign(servers.size(), EndpointProbe::Result());
+
+        // 1) Every lookup at once, IP literals and cached names are ready already.
+        // A server counts as open while its lookup or any of its connects is.
+        std::vector<std::shared_future<Resolver::Result>> lookups(servers.size());
+        std::vector<size_t> open(servers.size(), 0);
+        std::vector<size_t> resolving;
+        std::vector<Attempt> attempts;
+        for (size_t i = 0; i < servers.size(); i++)
+        {
+            if (!Validation::isUnixSocketAddress(servers[i].host))
+            {
+                lookups[i] = Resolver::global().resolve(servers[i].host);
+                resolving.push_back(i);
+                open[i]++;
+                continue;
+            }
+
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            std::string path = servers[i].host.substr(5);
+            std::memcpy(address.sun_path, path.data(), path.size());
+            int fd = -1;
+            if (startConnect(AF_UNIX, reinterpret_cast<const sockaddr*>(&address), sizeof(address), fd, results[i].error))
+            {
+                attempts.push_back({i, fd, Clock::now()});
+                open[i]++;
+            }
+        }
+
+        // 2) A server's connects go out as soon as its own lookup is in, one
+        // slow name does not hold up the others
+        auto startResolved = [&]
+        {
+            for (size_t r = resolving.size(); r-- > 0;)
+            {
+                size_t i = resolving[r];
+                if (lookups[i].wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    continue;
+                resolving.erase(resolving.begin() + r);
+                open[i]--;
+
+                const Resolver::Result& resolved = lookups[i].get();
+                if (resolved.addresses.empty())
+                {
+                    results[i].error = resolved.error;
+                    continue;
+                }
+
+                for (const std::string& ip : resolved.addresses)
+                {
+                    sockaddr_in address{};
+                    address.sin_family = AF_INET;
+                    address.sin_port = htons(servers[i].port ? servers[i].port : defaultPort);
+                    if (inet_pton(AF_INET, ip.c_str(), &address.sin_addr) <= 0)
+                        continue;
+                    int fd = -1;
+                    if (startConnect(AF_INET, reinterpret_cast<const sockaddr*>(&address), sizeof(address), fd,
+                                     results[i].error))
+                    {
+                        attempts.push_back({i, fd, Clock::now()});
+                        open[i]++;
+                    }
+                }
+            }
+        };
+
+        // 3) Answers as they come, until the pick is certain, all are in or time is up
+        std::vector<int> accepted(servers.size(), -1);    // one connection per server, Preferred only
+
+        int kept = -1;
+        std::vector<pollfd> fds;
+        while (kept == -1)
+        {
+            startResolved();
+            if (attempts.empty() && resolving.empty())
+                break;
+
+            int remaining = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now()).count());
+            if (remaining <= 0)
+                break;
+            // A lookup has no descriptor to poll, it is looked at again soon
+            if (!resolving.empty())
+                remaining = std::min(remaining, static_cast<int>(lookupCheck.count()));
+
+            fds.clear();
+            for (const Attempt& attempt : attempts)
+                fds.push_back({attempt.fd, POLLOUT, 0});
+            int rc = poll(fds.data(), fds.size(), remaining);
+            if (rc < 0 && errno == EINTR)
+                continue;
+            if (rc < 0 || (rc == 0 && resolving.empty()))
+                break;
+
+            Clock::time_point now = Clock::now();
+            std::chrono::microseconds keptRtt{0};
+            for (size_t a = attempts.size(); a-- > 0;)
+            {
+                if (fds[a].revents == 0)
+                    continue;
+
+                Attempt attempt = attempts[a];
+                attempts.erase(attempts.begin() + a);
+                open[attempt.server]--;
+
+                int error = 0;
+                socklen_t errorLen = sizeof(error);
+                if (getsockopt(attempt.fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1)
+                    error = errno;
+
+                EndpointProbe::Result& result = results[attempt.server];
+                if (error != 0)
+                {
+                    if (!result.healthy)
+                        result.error = std::strerror(error);
+                    close(attempt.fd);
+                    continue;
+                }
+
+                auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(now - attempt.started);
+                if (!result.healthy || rtt < result.rtt)
+                    result.rtt = rtt;
+                result.healthy = true;
+                result.error.clear();
+
+                // Several can finish within one poll(), keep the quickest
+                if (pick == Pick::Fastest && (kept == -1 || rtt < keptRtt))
+                {
+                    if (kept != -1)
+                        close(kept);
+                    kept = attempt.fd;
+                    keptRtt = rtt;
+                    winner = attempt.server;
+                }
+                else if (pick == Pick::Preferred && accepted[attempt.server] == -1)
+                    accepted[attempt.server] = attempt.fd;
+                else
+                    close(attempt.fd);
+            }
+
+            // Decided once every server ahead of an accepting one has failed
+            if (pick == Pick::Preferred)
+            {
+                for (size_t i = 0; i < servers.size(); i++)
+                {
+                    if (accepted[i] != -1)
+                    {
+                        kept = accepted[i];
+                        accepted[i] = -1;
+                        winner = i;
+                        break;
+                    }
+                    if (open[i] > 0)
+                        break;
+                }
+            }
+        }
+
+        // Out of time: the most preferred server that did accept
+        for (size_t i = 0; i < servers.size(); i++)
+        {
+            if (accepted[i] == -1)
+                continue;
+            if (kept == -1)
+            {
+                kept = accepted[i];
+                winner = i;
+            }
+            else
+                close(accepted[i]);
+        }
+
+        for (size_t i : resolving)
+            results[i].error = "lookup timed out";
+        for (const Attempt& attempt : attempts)
+        {
+            close(attempt.fd);
+            if (!results[attempt.server].healthy && results[attempt.server].error.empty())
+                results[attempt.server].error = "no answer";
+        }
+        return kept;
+    }
+
+    std::unique_ptr<SocketTransport> connectPicked(const std::vector<Validation::ServerAddress>& servers, int defaultPort,
+                                                   std::chrono::milliseconds timeout, Pick pick, size_t& index,
+                                                   std::chrono::microseconds& rtt, std::string& errors)
+    {
+        std::vector<EndpointProbe::Result> results;
+        int fd = race(servers, defaultPort, timeout, pick, results, index);
+        if (fd == -1)
+        {
+            errors.clear();
+            for (size_t i = 0; i < servers.size(); i++)
+                errors += (i ? ", " : "") + EndpointProbe::describe(servers[i], defaultPort) + ": " + results[i].error;
+            return nullptr;
+        }
+
+        // The session uses blocking reads and writes
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        rtt = results[index].rtt;
+        return std::make_unique<SocketTransport>(fd);
+    }
+}
+
+std::string EndpointProbe::describe(const Validation::ServerAddress& server, int defaultPort)
+{
+    if (Validation::isUnixSocketAddress(server.host))
+        return server.host;
+    return server.host + ":" + std::to_string(server.port ? server.port : defaultPort);
+}
+
+std::vector<EndpointProbe::Result> EndpointProbe::probeAll(const std::vector<Validation::ServerAddress>& servers,
+                                                           int defaultPort, std::chrono::milliseconds timeout)
+{
+    std::vector<Result> results;
+    size_t winner = 0;
+    race(servers, defaultPort, timeout, Pick::None, results, winner);
+    return results;
+}
+
+std::unique_ptr<SocketTransport> EndpointProbe::connectFastest(const std::vector<Validation::ServerAddress>& servers,
+                                                               int defaultPort, std::chrono::milliseconds timeout,
+                                                               size_t& index, std::chrono::microseconds& rtt,
+                                                               std::string& errors)
+{
+    return connectPicked(servers, defaultPort, timeout, Pick::Fastest, index, rtt, errors);
+}
+
+std::unique_ptr<SocketTransport> EndpointProbe::connectPreferred(const std::vector<Validation::ServerAddress>& servers,
+                                                                 int defaultPort, std::chrono::milliseconds timeout,
+                                                                 size_t& index, std::chrono::microseconds& rtt,
+                                                                 std::string& errors)
+{
+    return connectPicked(servers, defaultPort, timeout, Pick::Preferred, index, rtt, errors);
+}
@@ -0,0 +1,175 @@
+#include "EventLoop.h"
+#include <iostream>
+#include <cerrno>
+#include <unistd.h>
+
+struct EventLoop::Root
+{
+    struct promise_type
+    {
+        EventLoop* loop;
+
+        promise_type(EventLoop& loop, Task<void>&) : loop(&loop) {}
+
+        Root get_return_object() { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        // The frame frees itself once the task is done
+        std::suspend_never final_suspend() noexcept
+        {
+            loop->roots.erase(std::coroutine_handle<promise_type>::from_promise(*this).address());
+            return {};
+        }
+
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+EventLoop::Root EventLoop::start(EventLoop&, Task<void> task)
+{
+    co_await task;
+}
+
+EventLoop::EventLoop()
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1)
+        std::cerr << "Failed to create epoll instance, errno: " << errno << "\n";
+}
+
+EventLoop::~EventLoop()
+{
+    // Each root owns the frames of everything its task is awaiting
+    for (void* frame : roots)
+        std::coroutine_handle<>::from_address(frame).destroy();
+
+    if (epollFd != -1)
+        close(epollFd);
+}
+
+void EventLoop::spawn(Task<void> task)
+{
+    std::coroutine_handle<> root = start(*this, std::move(task)).handle;
+    roots.insert(root.address());
+    ready.push_back(root);
+}
+
+void EventLoop::run()
+{
+    stopping = false;
+    while (!stopping)
+    {
+        Clock::time_point now = Clock::now();
+        while (!timers.empty() && timers.top().when <= now)
+        {
+            ready.push_back(timers.top().waiter);
+            timers.pop();
+        }
+
+        if (!ready.empty())
+        {
+            // Whatever these resume queues up waits for the next turn
+            std::deque<std::coroutine_handle<>> batch;
+            batch.swap(ready);
+            for (std::coroutine_handle<> waiter : batch)
+                waiter.resume();
+            continue;
+        }
+
+        if (ioWaiters == 0 && timers.empty())
+            break;
+
+        int timeoutMs = -1;
+        if (!timers.empty())
+            timeoutMs = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(timers.top().when - now).count());
+        poll(timeoutMs);
+    }
+}
+
+void EventLoop::watch(int fd, uint32_t events, std::coroutine_handle<> waiter)
+{
+    Watch& entry = watches[fd];
+    if (!entry.registered)
+    {
+        // Registered once for both directions; edges nobody waits for are ignored
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            // Let the task retry its call and see the error
+            watches.erase(fd);
+            ready.push_back(waiter);
+            return;
+        }
+        entry.registered = true;
+    }
+
+    std::coroutine_handle<>& slot = (events & EPOLLIN) ? entry.reader : entry.writer;
+    if (slot)
+        ready.push_back(slot);
+    else
+        ioWaiters++;
+    slot = waiter;
+}
+
+void EventLoop::schedule(Clock::time_point when, std::coroutine_handle<> waiter)
+{
+    timers.push({when, timerOrder++, waiter});
+}
+
+void EventLoop::forget(int fd)
+{
+    auto it = watches.find(fd);
+    if (it == watches.end())
+        return;
+
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    for (std::coroutine_handle<> waiter : {it->second.reader, it->second.writer})
+    {
+        if (waiter)
+        {
+            ready.push_back(waiter);
+            ioWaiters--;
+        }
+    }
+    watches.erase(it);
+}
+
+void EventLoop::poll(int timeoutMs)
+{
+    epoll_event events[256];
+    int count = epoll_wait(epollFd, events, 256, timeoutMs);
+    if (count == -1)
+    {
+        if (errno != EINTR)
+            std::cerr << "epoll_wait failed, errno: " << errno << "\n";
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        auto it = watches.find(events[i].data.fd);
+        if (it == watches.end())
+            continue;
+
+        Watch& entry = it->second;
+        uint32_t happened = events[i].events;
+        uint32_t broken = EPOLLERR | EPOLLHUP;
+        if (entry.reader && (happened & (EPOLLIN | EPOLLRDHUP | broken)))
+        {
+            ready.push_back(entry.reader);
+            entry.reader = {};
+            ioWaiters--;
+        }
+        if (entry.writer && (happened & (EPOLLOUT | broken)))
+        {
+            ready.push_back(entry.writer);
+            entry.writer = {};
+            ioWaiters--;
+        }
+    }
+}
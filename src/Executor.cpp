@@ -0,0 +1,164 @@
+#include "Executor.h"
+#include <algorithm>
+
+// Which pool, and which worker in it, the current thread is
+static thread_local const Executor* currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+static uint64_t nanoseconds(std::chrono::steady_clock::duration d)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+Executor::Executor(size_t threads)
+    : threadCount(threads ? threads : std::max(1u, std::thread::hardware_concurrency()))
+{
+    for (size_t i = 0; i < threadCount; i++)
+        workers.push_back(std::make_unique<Worker>());
+}
+
+Executor::~Executor()
+{
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        stopping = true;
+    }
+    idle.notify_all();
+
+    for (auto& worker : workers)
+    {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+}
+
+Executor& Executor::global()
+{
+    static Executor executor;
+    return executor;
+}
+
+void Executor::start()
+{
+    for (size_t i = 0; i < threadCount; i++)
+        workers[i]->thread = std::thread(&Executor::workerLoop, this, i);
+}
+
+void Executor::post(Priority priority, std::function<void()> job)
+{
+    std::call_once(started, &Executor::start, this);
+
+    size_t p = static_cast<size_t>(priority);
+    size_t target = currentPool == this ? currentWorker : nextWorker++ % threadCount;
+
+    // Counted before a worker can take it, or the counters could wrap below zero
+    counters[p].queued++;
+    pending++;
+    {
+        std::lock_guard<std::mutex> lock(workers[target]->mutex);
+        workers[target]->queues[p].push_back({std::move(job), Clock::now()});
+    }
+
+    // Taking the lock orders this with a worker about to sleep
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+    }
+    idle.notify_one();
+}
+
+bool Executor::take(size_t self, Job& job, size_t& priority)
+{
+    for (priority = 0; priority < priorityCount; priority++)
+    {
+        // Newest first from our own queue, it is the most likely to be cached
+        {
+            Worker& own = *workers[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            std::deque<Job>& queue = own.queues[priority];
+            if (!queue.empty())
+            {
+                job = std::move(queue.back());
+                queue.pop_back();
+                return true;
+            }
+        }
+
+        // Oldest first from everyone else's
+        for (size_t i = 1; i < threadCount; i++)
+        {
+            Worker& victim = *workers[(self + i) % threadCount];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            std::deque<Job>& queue = victim.queues[priority];
+            if (!queue.empty())
+            {
+                job = std::move(queue.front());
+                queue.pop_front();
+                steals++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Executor::workerLoop(size_t self)
+{
+    currentPool = this;
+    currentWorker = self;
+
+    while (true)
+    {
+        Job job;
+        size_t priority;
+        if (take(self, job, priority))
+        {
+            pending--;
+            counters[priority].queued--;
+            Clock::time_point started = Clock::now();
+            job.run();
+            finish(priority, job, started);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(idleMutex);
+        idle.wait(lock, [this] { return stopping || pending > 0; });
+        if (stopping && pending == 0)
+            return;
+    }
+}
+
+void Executor::finish(size_t priority, const Job& job, Clock::time_point started)
+{
+    Counters& c = counters[priority];
+    uint64_t wait = nanoseconds(started - job.posted);
+    c.waitNs += wait;
+    c.runNs += nanoseconds(Clock::now() - started);
+    c.completed++;
+
+    uint64_t seen = c.maxWaitNs.load();
+    while (wait > seen && !c.maxWaitNs.compare_exchange_weak(seen, wait))
+        ;
+}
+
+Executor::Metrics Executor::metrics() const
+{
+    using std::chrono::microseconds;
+
+    Metrics m;
+    m.threads = threadCount;
+    m.steals = steals.load();
+    for (size_t p = 0; p < priorityCount; p++)
+    {
+        const Counters& c = counters[p];
+        Metrics::Queue& q = m.queues[p];
+        q.queued = c.queued.load();
+        q.completed = c.completed.load();
+        q.maxWait = microseconds(c.maxWaitNs.load() / 1000);
+        if (q.completed > 0)
+        {
+            q.meanWait = microseconds(c.waitNs.load() / q.completed / 1000);
+            q.meanRun = microseconds(c.runNs.load() / q.completed / 1000);
+        }
+    }
+    return m;
+}
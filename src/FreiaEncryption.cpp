@@ -83,37 +83,46 @@ std::string FreiaEncryption::encryptData(const std::string& data, const Key& key
 }
 
 std::string FreiaEncryption::decryptData(const std::string& data, const Key& key) {
-    if (data.size() < 16) return "";
-    std::string iv_str = data.substr(0, 16);
-    std::string ciphertext = data.substr(16);
+    return decryptData(data.data(), data.size(), key);
+}
 
-    // unsigned char key[32];
-    // PKCS5_PBKDF2_HMAC(password.c_str(), password.size(), nullptr, 0, 100000, EVP_sha256(), 32, key);
+std::string FreiaEncryption::decryptData(const char* data, size_t len, const Key& key) {
+    std::string plaintext(len, '\0');
+    size_t plaintext_len = 0;
+    if (!decryptInto(data, len, key, plaintext.data(), plaintext_len))
+        return "";
+
+    plaintext.resize(plaintext_len);
+    return plaintext;
+}
+
+bool FreiaEncryption::decryptInto(const char* data, size_t len, const Key& key, char* out, size_t& outLen) {
+    // IV is the first 16 bytes, the output never exceeds the ciphertext after it
+    outLen = 0;
+    if (len < 16) return false;
 
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (!EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, key.data(), (unsigned char*)iv_str.c_str())) {
+    if (!ctx) return false;
+
+    if (!EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, key.data(), (const unsigned char*)data)) {
         EVP_CIPHER_CTX_free(ctx);
-        return "";
+        return false;
     }
 
-    int len, plaintext_len;
-    std::vector<unsigned char> plaintext(ciphertext.size());
-
-    if (!EVP_DecryptUpdate(ctx, plaintext.data(), &len, (unsigned char*)ciphertext.data(), ciphertext.size())) {
+    int updateLen = 0, finalLen = 0;
+    if (!EVP_DecryptUpdate(ctx, (unsigned char*)out, &updateLen, (const unsigned char*)data + 16, len - 16)) {
         EVP_CIPHER_CTX_free(ctx);
-        return "";
+        return false;
     }
-    plaintext_len = len;
 
-    if (EVP_DecryptFinal_ex(ctx, plaintext.data() + len, &len) <= 0) {
+    if (EVP_DecryptFinal_ex(ctx, (unsigned char*)out + updateLen, &finalLen) <= 0) {
         EVP_CIPHER_CTX_free(ctx);
-        return "";
+        return false;
     }
-    plaintext_len += len;
     EVP_CIPHER_CTX_free(ctx);
-    plaintext.resize(plaintext_len);
 
-    return std::string(plaintext.begin(), plaintext.end());
+    outLen = updateLen + finalLen;
+    return true;
 }
 
 FreiaEncryption::Key FreiaEncryption::deriveKey(const std::string& password)
@@ -129,4 +138,98 @@ FreiaEncryption::Key FreiaEncryption::deriveKey(const std::string& password)
             key.data()))
     {}
     return key;
+}
+
+std::string FreiaEncryption::hashHex(const std::string& data)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLen = 0;
+    if (!EVP_Digest(data.data(), data.size(), digest, &digestLen, EVP_sha256(), nullptr))
+        return "";
+
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    for (unsigned int i = 0; i < digestLen; i++)
+    {
+        out += hex[digest[i] >> 4];
+        out += hex[digest[i] & 0x0F];
+    }
+    return out;
+}
+
+FreiaEncryption::Decryptor::~Decryptor()
+{
+    if (ctx)
+        EVP_CIPHER_CTX_free(ctx);
+}
+
+bool FreiaEncryption::Decryptor::update(const char* data, size_t len, char* out, size_t& outLen)
+{
+    if (failed)
+        return false;
+
+    // The IV comes first and may itself be split across pieces
+    while (ivHave < sizeof(iv) && len > 0)
+    {
+        iv[ivHave++] = *data++;
+        len--;
+    }
+    if (ivHave < sizeof(iv))
+        return true;
+
+    if (!ctx)
+    {
+        ctx = EVP_CIPHER_CTX_new();
+        if (!ctx || !EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, key.data(), iv))
+        {
+            failed = true;
+            return false;
+        }
+    }
+    if (len == 0)
+        return true;
+
+    int written = 0;
+    if (!EVP_DecryptUpdate(ctx, (unsigned char*)out + outLen, &written, (const unsigned char*)data, len))
+    {
+        failed = true;
+        return false;
+    }
+    outLen += written;
+    return true;
+}
+
+bool FreiaEncryption::Decryptor::finish(char* out, size_t& outLen)
+{
+    if (failed || !ctx)
+        return false;
+
+    int written = 0;
+    if (EVP_DecryptFinal_ex(ctx, (unsigned char*)out + outLen, &written) <= 0)
+    {
+        failed = true;
+        return false;
+    }
+    outLen += written;
+    return true;
+}
+
+bool FreiaEncryption::Decryptor::update(const char* data, size_t len, std::string& out)
+{
+    size_t old = out.size();
+    out.resize(old + len + 16);
+    size_t outLen = old;
+    bool ok = update(data, len, out.data(), outLen);
+    out.resize(ok ? outLen : old);
+    return ok;
+}
+
+bool FreiaEncryption::Decryptor::finish(std::string& out)
+{
+    size_t old = out.size();
+    out.resize(old + 16);
+    size_t outLen = old;
+    bool ok = finish(out.data(), outLen);
+    out.resize(ok ? outLen : old);
+    return ok;
 }
\ No newline at end of file
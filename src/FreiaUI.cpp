@@ -1,8 +1,10 @@
 #include "FreiaUI.h"
 #include "Validation.h"
+#include "DaemonClient.h"
 #include <iostream>
 #include <cstring>
 #include <cctype>
+#include <algorithm>
 
 FreiaUI::FreiaUI()
 {
@@ -54,7 +56,15 @@ bool FreiaUI::render()
     if (quitRequested)
     return false;
 
-    glfwPollEvents();
+    // Single-threaded: sleep until a window event or until the session needs
+    // pumping again, instead of redrawing as fast as the core allows. Only a
+    // connection that really runs without threads is pumped; TLS and
+    // multiplexed ones keep theirs.
+    if (cooperative)
+        glfwWaitEventsTimeout(nextPumpMs / 1000.0);
+    else
+        glfwPollEvents();
+    nextPumpMs = client && client->isCooperative() ? client->pump() : ChatSession::pumpIntervalMs;
 
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -88,9 +98,9 @@ void FreiaUI::renderConnectionPanel()
     const float labelWidth = 420.0f;
     ImGui::Begin("Connection Data");
 
-    ImGui::Text("IP: ");
+    ImGui::Text("Host: ");
     ImGui::SameLine(labelWidth);
-    ImGui::InputText("##IP", IP, IM_ARRAYSIZE(IP));
+    ImGui::InputTextWithHint("##IP", "host, or several: a.example, b.example:7001", IP, IM_ARRAYSIZE(IP));
 
     ImGui::Text("Port: ");
     ImGui::SameLine(labelWidth);
@@ -108,7 +118,32 @@ void FreiaUI::renderConnectionPanel()
     ImGui::SameLine(labelWidth);
     ImGui::InputText("##SERVERPASS", ServerPassword, IM_ARRAYSIZE(ServerPassword));
 
-    if (!client || !client->isConnectedToServer())
+    ImGui::Checkbox("Keep encrypted history on this device", &keepHistory);
+    ImGui::Checkbox("Decrypt messages only when shown", &lazyDecrypt);
+    ImGui::Checkbox("Use TLS 1.3 transport", &tlsTransport);
+    ImGui::Checkbox("Use datagram transport (UDP, for lossy links)", &datagramTransport);
+    ImGui::Checkbox("Multiplex streams (server support required)", &multiplexStreams);
+    if (multiplexStreams)
+        ImGui::Checkbox("Stripe bulk streams over parallel connections (long fat links)", &stripedTransfers);
+    ImGui::Checkbox("Numbered senders (server support required)", &numberedSenders);
+    ImGui::Checkbox("Servers are cluster nodes (each chat on its own node)", &clusterRouting);
+    ImGui::Checkbox("Busy-poll receive (experimental, uses more CPU)", &lowLatency);
+    if (lowLatency)
+        ImGui::InputInt("Pin receive thread to CPU (-1 = any)", &ioCpu);
+    // Taken with the next connection, so not changed under the current one
+    ImGui::BeginDisabled(client && (client->isConnectedToServer() ||
+                                    client->connectState() == ChatSession::ConnectState::Connecting));
+    ImGui::Checkbox("Single-threaded networking (for single-core machines)", &cooperative);
+    ImGui::EndDisabled();
+    ImGui::SliderInt("Send rate (messages/s, 0 = off)", &sendRate, 0, 50);
+    ImGui::SliderInt("Send burst", &sendBurst, 1, 100);
+
+    pollConnect();
+    if (client && client->connectState() == ChatSession::ConnectState::Connecting)
+    {
+        ImGui::TextUnformatted("Connecting...");
+    }
+    else if (!client || !client->isConnectedToServer())
     {
         connectButton();
     }
@@ -123,15 +158,50 @@ void FreiaUI::renderConnectionPanel()
 void FreiaUI::renderChatPanel()
 {
     ImGui::Begin("Chat Window");
+    renderSearchBar();
 
     ImGui::BeginChild("ChatArea", ImVec2(0, -ImGui::GetFrameHeightWithSpacing()), true);
     if (client)
     {
-        const auto& messages = client->getMessages();
-        for (const auto& msg : messages)
-            ImGui::TextUnformatted(msg.c_str());
+        // Only the visible rows are fetched, older ones may be paged in from disk
+        bool atBottom = !jumpToHit && ImGui::GetScrollY() >= ImGui::GetScrollMaxY();
+        int count = static_cast<int>(client->messageCount());
+        int target = jumpToHit ? static_cast<int>(searchHits[searchCursor]) : -1;
+        if (target >= count)
+            target = -1;
+
+        ImGuiListClipper clipper;
+        clipper.Begin(count);
+        if (target >= 0)
+            clipper.IncludeItemByIndex(target);
+
+        while (clipper.Step())
+        {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+            {
+                bool hit = std::binary_search(searchHits.begin(), searchHits.end(), static_cast<size_t>(i));
+                bool current = hit && searchHits[searchCursor] == static_cast<size_t>(i);
+
+                std::string msg = client->messageAt(i);
+                if (hit)
+                    ImGui::PushStyleColor(ImGuiCol_Text, current ? ImVec4(1, 1, 1, 1) : ImVec4(1, 0.85f, 0, 1));
+                ImGui::TextUnformatted(msg.c_str());
+                if (hit)
+                    ImGui::PopStyleColor();
+                messageContextMenu(i, msg);
+
+                if (i == target)
+                {
+                    ImGui::SetScrollHereY(0.5f);
+                    jumpToHit = false;
+                }
+            }
+        }
+        clipper.End();
 
-        ImGui::SetScrollHereY(1.0f);
+        // Follow new messages unless the user scrolled up to read history
+        if (atBottom)
+            ImGui::SetScrollHereY(1.0f);
     }
     ImGui::EndChild();
 
@@ -141,10 +211,11 @@ void FreiaUI::renderChatPanel()
         focusInput = false;
     }
 
-    ImGui::InputText("##Input", inputBuffer, IM_ARRAYSIZE(inputBuffer));
+    bool enterPressed = ImGui::InputText("##Input", inputBuffer, IM_ARRAYSIZE(inputBuffer),
+                                         ImGuiInputTextFlags_EnterReturnsTrue);
     ImGui::SameLine();
 
-    if (ImGui::Button("Send") || ImGui::IsKeyPressed(ImGuiKey_Enter))
+    if (ImGui::Button("Send") || enterPressed)
     {
         if (client && strlen(inputBuffer) > 0)
         {
@@ -154,17 +225,80 @@ void FreiaUI::renderChatPanel()
         }
     }
 
+    // Messages beyond the burst are paced, show that they are on their way
+    if (size_t queued = client ? client->queuedMessages() : 0)
+        ImGui::TextDisabled("%zu message(s) waiting to be sent", queued);
+
     ImGui::End();
 }
 
+void FreiaUI::messageContextMenu(int index, const std::string& msg)
+{
+    // System lines look like "[...]", chat lines like "sender: text"
+    size_t colon = msg.find(": ");
+    if (msg.empty() || msg[0] == '[' || colon == std::string::npos)
+        return;
+
+    ImGui::PushID(index);
+    if (ImGui::BeginPopupContextItem("MessageMenu"))
+    {
+        std::string sender = msg.substr(0, colon);
+        if (ImGui::MenuItem(("Mute " + sender).c_str()))
+            client->muteSender(sender);
+        ImGui::EndPopup();
+    }
+    ImGui::PopID();
+}
+
+void FreiaUI::renderSearchBar()
+{
+    if (ImGui::InputTextWithHint("##Search", "Search history", searchBuffer, IM_ARRAYSIZE(searchBuffer)))
+        runSearch();
+
+    if (searchBuffer[0] == '\0')
+        return;
+
+    ImGui::SameLine();
+    if (searchHits.empty())
+    {
+        ImGui::TextUnformatted("No hits");
+        return;
+    }
+
+    ImGui::Text("%d/%d", searchCursor + 1, static_cast<int>(searchHits.size()));
+    ImGui::SameLine();
+    if (ImGui::Button("Older") && searchCursor > 0)
+    {
+        searchCursor--;
+        jumpToHit = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Newer") && searchCursor + 1 < static_cast<int>(searchHits.size()))
+    {
+        searchCursor++;
+        jumpToHit = true;
+    }
+}
+
+void FreiaUI::runSearch()
+{
+    searchHits.clear();
+    if (client && searchBuffer[0] != '\0')
+        searchHits = client->searchMessages(searchBuffer, maxSearchHits);
+
+    // Start at the newest hit
+    searchCursor = static_cast<int>(searchHits.size()) - 1;
+    jumpToHit = !searchHits.empty();
+}
+
 void FreiaUI::connectButton()
 {
     if (ImGui::Button("Connect"))
     {
         // Basic UI validation before touching networking
-        if (!Validation::isValidIP(IP))
+        if (!Validation::isValidServerList(IP))
         {
-            openPopup("Invalid IP address.");
+            openPopup("Invalid host name, IP address or server list.");
             return;
         }
 
@@ -196,8 +330,23 @@ void FreiaUI::connectButton()
         //     delete client;
         //     client = nullptr;
         // }
-        client = new ClientConnect();
-        
+        // With a daemon running the session lives there and survives this window
+        if (DaemonClient::available())
+            client = new DaemonClient();
+        else
+            client = new ClientConnect();
+        client->setPersistHistory(keepHistory);
+        client->setLazyDecrypt(lazyDecrypt);
+        client->setTlsTransport(tlsTransport);
+        client->setDatagramTransport(datagramTransport);
+        client->setMultiplexing(multiplexStreams);
+        client->setStripedTransfers(stripedTransfers);
+        client->setNumberedSenders(numberedSenders);
+        client->setClusterRouting(clusterRouting);
+        client->setLowLatency(lowLatency, ioCpu);
+        client->setCooperative(cooperative);
+        client->setSendRate(static_cast<unsigned>(sendRate), static_cast<unsigned>(sendBurst));
+
         // Network-side validation
         if (client->configure(IP, Port, User, ChatPassword, ServerPassword))
         {
@@ -218,6 +367,17 @@ void FreiaUI::connectButton()
 }
 
 
+void FreiaUI::pollConnect()
+{
+    // Resolution and connect run in the background, failures surface here
+    if (client && client->connectState() == ChatSession::ConnectState::Failed)
+    {
+        openPopup(client->connectError());
+        delete client;
+        client = nullptr;
+    }
+}
+
 void FreiaUI::disconnectButton()
 {
     if (ImGui::Button("Disconnect"))
@@ -239,6 +399,10 @@ void FreiaUI::clearInputFields()
     std::memset(User, 0, sizeof(User));
     std::memset(ChatPassword, 0, sizeof(ChatPassword));
     std::memset(inputBuffer, 0, sizeof(inputBuffer));
+    std::memset(searchBuffer, 0, sizeof(searchBuffer));
+    searchHits.clear();
+    searchCursor = -1;
+    jumpToHit = false;
 }
 
 void FreiaUI::renderMenuBar()
@@ -255,6 +419,18 @@ void FreiaUI::renderMenuBar()
             if (ImGui::MenuItem("Exit")) quitRequested = true;
             ImGui::EndMenu();
         }
+        if (ImGui::BeginMenu("Muted", client != nullptr))
+        {
+            auto muted = client->mutedSenders();
+            if (muted.empty())
+                ImGui::TextDisabled("Right-click a message to mute its sender");
+            for (const auto& name : muted)
+            {
+                if (ImGui::MenuItem(("Unmute " + name).c_str()))
+                    client->unmuteSender(name);
+            }
+            ImGui::EndMenu();
+        }
         ImGui::EndMainMenuBar();
     }
 
@@ -0,0 +1,50 @@
+#include "HashRing.h"
+#include "FreiaEncryption.h"
+#include <algorithm>
+
+HashRing::HashRing(const std::vector<std::string>& nodes) : nodeCount(nodes.size())
+{
+    points.reserve(nodes.size() * pointsPerNode);
+    for (size_t node = 0; node < nodes.size(); node++)
+    {
+        for (size_t i = 0; i < pointsPerNode; i++)
+            points.push_back({position(nodes[node] + "#" + std::to_string(i)), node});
+    }
+
+    // Ties are all but impossible; the node index keeps them deterministic
+    std::sort(points.begin(), points.end(), [](const Point& a, const Point& b)
+    {
+        return a.position != b.position ? a.position < b.position : a.node < b.node;
+    });
+}
+
+std::vector<size_t> HashRing::route(uint64_t key) const
+{
+    std::vector<size_t> order;
+    if (points.empty())
+        return order;
+
+    auto it = std::lower_bound(points.begin(), points.end(), key,
+                               [](const Point& point, uint64_t k) { return point.position < k; });
+    size_t start = static_cast<size_t>(it - points.begin());
+
+    // Clockwise from the key, wrapping around, until every node was seen
+    std::vector<bool> seen(nodeCount, false);
+    for (size_t i = 0; i < points.size() && order.size() < nodeCount; i++)
+    {
+        size_t node = points[(start + i) % points.size()].node;
+        if (!seen[node])
+        {
+            seen[node] = true;
+            order.push_back(node);
+        }
+    }
+    return order;
+}
+
+uint64_t HashRing::position(const std::string& data)
+{
+    // The first 64 bits of the digest, read big-endian
+    std::string hex = FreiaEncryption::hashHex(data);
+    return std::stoull(hex.substr(0, 16), nullptr, 16);
+}
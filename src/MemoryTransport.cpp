@@ -0,0 +1,168 @@
+#include "MemoryTransport.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <condition_variable>
+#include <poll.h>
+
+struct MemoryTransport::Link
+{
+    struct Chunk
+    {
+        Duration deliverAt;
+        std::string bytes;
+        size_t offset = 0;
+    };
+
+    LinkOptions options;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    Duration now{0};
+    std::deque<Chunk> inbound[2];       // inbound[i] is read by side i
+    Duration busyUntil[2]{};            // side i is still sending until then
+    bool closed[2] = {false, false};
+};
+
+MemoryTransport::Pair MemoryTransport::pair(LinkOptions options)
+{
+    auto link = std::make_shared<Link>();
+    link->options = options;
+    return {std::unique_ptr<MemoryTransport>(new MemoryTransport(link, 0)),
+            std::unique_ptr<MemoryTransport>(new MemoryTransport(link, 1))};
+}
+
+MemoryTransport::~MemoryTransport()
+{
+    shutdown();
+}
+
+bool MemoryTransport::nextLimit(const std::vector<size_t>& script, size_t& step, size_t& len)
+{
+    if (script.empty())
+        return true;
+
+    size_t limit = script[step++ % script.size()];
+    if (limit == 0)
+    {
+        errno = EINTR;
+        return false;
+    }
+    len = std::min(len, limit);
+    return true;
+}
+
+ssize_t MemoryTransport::read(void* buffer, size_t len)
+{
+    if (!nextLimit(readScript, readStep, len))
+        return -1;
+
+    std::unique_lock<std::mutex> lock(link->mutex);
+    std::deque<Link::Chunk>& queue = link->inbound[side];
+    while (true)
+    {
+        if (link->closed[side])
+            return 0;
+
+        if (!queue.empty())
+        {
+            // Nothing else can happen before the next delivery, skip to it
+            if (queue.front().deliverAt > link->now)
+            {
+                link->now = queue.front().deliverAt;
+                link->changed.notify_all();
+            }
+            break;
+        }
+
+        if (link->closed[side ^ 1])
+            return 0;
+        link->changed.wait(lock);
+    }
+
+    // A stream: take whatever has arrived, across writes
+    char* out = static_cast<char*>(buffer);
+    size_t done = 0;
+    while (done < len && !queue.empty() && queue.front().deliverAt <= link->now)
+    {
+        Link::Chunk& chunk = queue.front();
+        size_t n = std::min(len - done, chunk.bytes.size() - chunk.offset);
+        std::memcpy(out + done, chunk.bytes.data() + chunk.offset, n);
+        chunk.offset += n;
+        done += n;
+        if (chunk.offset == chunk.bytes.size())
+            queue.pop_front();
+    }
+    return static_cast<ssize_t>(done);
+}
+
+ssize_t MemoryTransport::write(const void* data, size_t len)
+{
+    if (!nextLimit(writeScript, writeStep, len))
+        return -1;
+
+    std::lock_guard<std::mutex> lock(link->mutex);
+    if (link->closed[side] || link->closed[side ^ 1])
+    {
+        errno = EPIPE;
+        return -1;
+    }
+    if (len == 0)
+        return 0;
+
+    // Serialised behind what this side is still sending, then in flight
+    Duration start = std::max(link->now, link->busyUntil[side]);
+    Duration sending{0};
+    if (link->options.bytesPerSecond > 0)
+        sending = std::chrono::duration_cast<Duration>(std::chrono::duration<double>(len / link->options.bytesPerSecond));
+    link->busyUntil[side] = start + sending;
+
+    Link::Chunk chunk;
+    chunk.deliverAt = link->busyUntil[side] + link->options.latency;
+    chunk.bytes.assign(static_cast<const char*>(data), len);
+    link->inbound[side ^ 1].push_back(std::move(chunk));
+    link->changed.notify_all();
+    return static_cast<ssize_t>(len);
+}
+
+bool MemoryTransport::wait(short events, int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(link->mutex);
+    auto ready = [&]
+    {
+        if (link->closed[side])
+            return true;
+        if ((events & POLLOUT) && !link->closed[side ^ 1])
+            return true;
+        // Pending data counts, read() moves the clock to it
+        return (events & POLLIN) && (!link->inbound[side].empty() || link->closed[side ^ 1]);
+    };
+
+    if (timeoutMs < 0)
+        link->changed.wait(lock, ready);
+    else if (!link->changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready))
+        return false;
+    return !link->closed[side];
+}
+
+void MemoryTransport::shutdown()
+{
+    std::lock_guard<std::mutex> lock(link->mutex);
+    link->closed[side] = true;
+    link->changed.notify_all();
+}
+
+MemoryTransport::Duration MemoryTransport::now() const
+{
+    std::lock_guard<std::mutex> lock(link->mutex);
+    return link->now;
+}
+
+void MemoryTransport::advance(Duration step)
+{
+    std::lock_guard<std::mutex> lock(link->mutex);
+    link->now += step;
+    link->changed.notify_all();
+}
@@ -0,0 +1,217 @@
+#include "MessageJournal.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cinttypes>
+#include <dirent.h>
+
+bool MessageJournal::open(const std::string& basePath, const FreiaEncryption::Key& key)
+{
+    close();
+
+    size_t slash = basePath.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : basePath.substr(0, slash);
+    std::string prefix = basePath.substr(slash == std::string::npos ? 0 : slash + 1) + ".";
+
+    // Segments are named <base>.<first sequence number in hex>
+    std::vector<uint64_t> found;
+    if (DIR* d = opendir(dir.c_str()))
+    {
+        while (dirent* entry = readdir(d))
+        {
+            std::string name = entry->d_name;
+            if (name.size() != prefix.size() + 16 || name.compare(0, prefix.size(), prefix) != 0)
+                continue;
+
+            char* end = nullptr;
+            uint64_t seq = std::strtoull(name.c_str() + prefix.size(), &end, 16);
+            if (end && *end == '\0')
+                found.push_back(seq);
+        }
+        closedir(d);
+    }
+    std::sort(found.begin(), found.end());
+
+    this->basePath = basePath;
+    this->key = key;
+
+    if (found.empty())
+        found.push_back(0);
+
+    for (uint64_t seq : found)
+    {
+        if (!openSegment(seq))
+        {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MessageJournal::openTemp(const FreiaEncryption::Key& key)
+{
+    close();
+    this->key = key;
+    return openSegment(0);
+}
+
+void MessageJournal::close()
+{
+    segments.clear();
+    openSealed.clear();
+    sealedBytes = 0;
+    basePath.clear();
+}
+
+bool MessageJournal::openSegment(uint64_t firstSeq)
+{
+    auto file = std::make_shared<SegmentFile>();
+    bool ok = basePath.empty() ? file->openTemp(key) : file->open(segmentPath(firstSeq), key);
+    if (!ok)
+        return false;
+
+    if (!segments.empty())
+    {
+        Segment& sealed = segments.back();
+        sealed.bytes = sealed.file->bytes();
+        sealedBytes += sealed.bytes;
+        if (!basePath.empty())
+            release(sealed.firstSeq);
+    }
+    segments.push_back({firstSeq, 0, file});
+    return true;
+}
+
+std::deque<MessageJournal::Segment>::iterator MessageJournal::segmentFor(uint64_t seq)
+{
+    // Last segment starting at or before seq
+    auto it = std::upper_bound(segments.begin(), segments.end(), seq,
+                               [](uint64_t s, const Segment& seg) { return s < seg.firstSeq; });
+    return it == segments.begin() ? segments.end() : --it;
+}
+
+std::shared_ptr<SegmentFile> MessageJournal::fileOf(Segment& segment)
+{
+    // The active segment and those of a spill journal, which could not be
+    // reopened, are always open
+    if (&segment == &segments.back() || basePath.empty())
+        return segment.file;
+
+    if (!segment.file)
+    {
+        auto file = std::make_shared<SegmentFile>();
+        if (!file->open(segmentPath(segment.firstSeq), key))
+            return nullptr;
+        segment.file = file;
+    }
+
+    std::shared_ptr<SegmentFile> file = segment.file;
+    release(segment.firstSeq);
+    return file;
+}
+
+void MessageJournal::release(uint64_t firstSeq)
+{
+    // Most recently used first; whoever still holds an evicted file keeps it
+    // open until done with it
+    openSealed.remove(firstSeq);
+    openSealed.push_front(firstSeq);
+    while (openSealed.size() > maxOpenSealed)
+    {
+        auto it = segmentFor(openSealed.back());
+        if (it != segments.end() && it->firstSeq == openSealed.back())
+            it->file.reset();
+        openSealed.pop_back();
+    }
+}
+
+bool MessageJournal::roll()
+{
+    // Seal the active segment: make it durable before anyone treats it as immutable
+    int logFd = -1;
+    int idxFd = -1;
+    if (dupActiveFds(logFd, idxFd))
+        SegmentFile::syncFds(logFd, idxFd);
+
+    return openSegment(endSeq());
+}
+
+bool MessageJournal::append(const std::string& record)
+{
+    if (segments.empty())
+        return false;
+
+    if (segments.back().file->count() >= segmentRecords && !roll())
+        return false;
+
+    return segments.back().file->append(record);
+}
+
+bool MessageJournal::read(uint64_t seq, std::string& out)
+{
+    if (segments.empty() || seq < firstSeq() || seq >= endSeq())
+        return false;
+
+    auto it = segmentFor(seq);
+    std::shared_ptr<SegmentFile> file = fileOf(*it);
+    return file && file->read(seq - it->firstSeq, out);
+}
+
+uint64_t MessageJournal::endSeq() const
+{
+    if (segments.empty())
+        return 0;
+    return segments.back().firstSeq + segments.back().file->count();
+}
+
+uint64_t MessageJournal::bytes() const
+{
+    return segments.empty() ? 0 : sealedBytes + segments.back().file->bytes();
+}
+
+void MessageJournal::enforceLimit(uint64_t maxBytes)
+{
+    // Retention works in whole segments, the active one always stays
+    while (segments.size() > 1 && bytes() > maxBytes)
+    {
+        const Segment& oldest = segments.front();
+        sealedBytes -= oldest.bytes;
+        if (!basePath.empty())
+            SegmentFile::removeFiles(segmentPath(oldest.firstSeq));
+        openSealed.remove(oldest.firstSeq);
+        segments.pop_front();
+    }
+}
+
+std::vector<MessageJournal::Segment> MessageJournal::sealedSegments() const
+{
+    std::vector<Segment> out;
+    for (size_t i = segments.size(); i-- > 1;)
+        out.push_back(segments[i - 1]);
+    return out;
+}
+
+std::shared_ptr<SegmentFile> MessageJournal::sealedFile(uint64_t firstSeq)
+{
+    if (segments.size() < 2 || firstSeq >= segments.back().firstSeq)
+        return nullptr;
+
+    auto it = segmentFor(firstSeq);
+    if (it == segments.end() || it->firstSeq != firstSeq)
+        return nullptr;
+    return fileOf(*it);
+}
+
+bool MessageJournal::dupActiveFds(int& logFd, int& indexFd) const
+{
+    return !segments.empty() && segments.back().file->dupFds(logFd, indexFd);
+}
+
+std::string MessageJournal::segmentPath(uint64_t firstSeq) const
+{
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%016" PRIx64, firstSeq);
+    return basePath + suffix;
+}
@@ -0,0 +1,199 @@
+#include "MessageRing.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char ringMagic[8] = {'F', 'R', 'E', 'I', 'A', 'R', 'G', '1'};
+
+bool MessageRing::create(const std::string& name, size_t capacity)
+{
+    if (header || capacity == 0 || (capacity & (capacity - 1)) != 0)
+        return false;
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1)
+    {
+        std::cerr << "Failed to create message ring, errno: " << errno << "\n";
+        return false;
+    }
+
+    size_t bytes = sizeof(Header) + capacity;
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, bytes) == 0)
+        map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        std::cerr << "Failed to map message ring, errno: " << errno << "\n";
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    header = new (map) Header{};
+    std::memcpy(header->magic, ringMagic, sizeof(ringMagic));
+    header->capacity = capacity;
+    data = static_cast<char*>(map) + sizeof(Header);
+    mappedBytes = bytes;
+    owner = true;
+    shmName = name;
+    return true;
+}
+
+bool MessageRing::attach(const std::string& name)
+{
+    if (header)
+        return false;
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+
+    struct stat st{};
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > sizeof(Header))
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    Header* h = static_cast<Header*>(map);
+    if (std::memcmp(h->magic, ringMagic, sizeof(ringMagic)) != 0 ||
+        h->capacity != static_cast<size_t>(st.st_size) - sizeof(Header))
+    {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    header = h;
+    data = static_cast<char*>(map) + sizeof(Header);
+    mappedBytes = st.st_size;
+    cursor = header->head.load(std::memory_order_acquire);
+    shmName = name;
+    return true;
+}
+
+void MessageRing::close()
+{
+    if (!header)
+        return;
+
+    munmap(header, mappedBytes);
+    if (owner)
+        shm_unlink(shmName.c_str());
+
+    header = nullptr;
+    data = nullptr;
+    mappedBytes = 0;
+    owner = false;
+    shmName.clear();
+}
+
+void MessageRing::copyIn(uint64_t offset, const void* src, size_t len)
+{
+    size_t at = offset & (header->capacity - 1);
+    size_t first = std::min<size_t>(len, header->capacity - at);
+    std::memcpy(data + at, src, first);
+    std::memcpy(data, static_cast<const char*>(src) + first, len - first);
+}
+
+void MessageRing::copyOut(uint64_t offset, void* dst, size_t len) const
+{
+    size_t at = offset & (header->capacity - 1);
+    size_t first = std::min<size_t>(len, header->capacity - at);
+    std::memcpy(dst, data + at, first);
+    std::memcpy(static_cast<char*>(dst) + first, data, len - first);
+}
+
+void MessageRing::publish(uint64_t index, std::string_view text, uint64_t count)
+{
+    publish(index, text, count, false);
+}
+
+void MessageRing::publish(uint64_t index, std::string_view text, uint64_t count, bool truncated)
+{
+    // Single writer; callers serialise publish()
+    if (!owner)
+        return;
+
+    // Huge messages are announced without their text, readers fetch them
+    RecordHeader rh{index, static_cast<uint32_t>(text.size()), 0};
+    if (truncated || text.size() > header->capacity / 4)
+    {
+        rh.len = 0;
+        rh.flags = truncatedFlag;
+    }
+
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t end = head + recordSize(rh.len);
+
+    // Announce the bytes about to be overwritten before touching them, the
+    // same ordering as a seqlock writer
+    header->reserve.store(end, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    copyIn(head, &rh, sizeof(rh));
+    if (rh.len > 0)
+        copyIn(head + sizeof(rh), text.data(), rh.len);
+
+    header->head.store(end, std::memory_order_release);
+    header->count.store(count, std::memory_order_release);
+}
+
+void MessageRing::setStatus(uint32_t status)
+{
+    if (owner)
+        header->status.store(status, std::memory_order_release);
+}
+
+void MessageRing::setCount(uint64_t count)
+{
+    if (owner)
+        header->count.store(count, std::memory_order_release);
+}
+
+MessageRing::ReadResult MessageRing::next(uint64_t& index, std::string& text, bool& truncated)
+{
+    if (!header)
+        return ReadResult::Empty;
+
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    if (cursor == head)
+        return ReadResult::Empty;
+
+    uint64_t capacity = header->capacity;
+    if (head - cursor > capacity)
+    {
+        cursor = head;
+        return ReadResult::Overrun;
+    }
+
+    RecordHeader rh;
+    copyOut(cursor, &rh, sizeof(rh));
+
+    // A length that does not fit what was published means the record got
+    // overwritten under us; the reserve check below confirms it
+    bool sane = sizeof(rh) + rh.len <= head - cursor;
+    if (sane)
+    {
+        text.resize(rh.len);
+        copyOut(cursor + sizeof(rh), text.data(), rh.len);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t reserve = header->reserve.load(std::memory_order_relaxed);
+    if (!sane || reserve - cursor > capacity)
+    {
+        cursor = header->head.load(std::memory_order_acquire);
+        return ReadResult::Overrun;
+    }
+
+    index = rh.index;
+    truncated = (rh.flags & truncatedFlag) != 0;
+    cursor += recordSize(rh.len);
+    return ReadResult::Message;
+}
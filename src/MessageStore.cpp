@@ -0,0 +1,393 @@
+#include "MessageStore.h"
+#include "Executor.h"
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+static uint64_t distance(uint64_t a, uint64_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+MessageStore::~MessageStore()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    flushCv.notify_all();
+
+    if (flusher.joinable())
+        flusher.join();
+
+    // Preload jobs still queued return right away
+    std::unique_lock<std::mutex> lock(mutex);
+    preloadDone.wait(lock, [this] { return preloadersActive == 0; });
+}
+
+bool MessageStore::open(const std::string& path, const FreiaEncryption::Key& key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (journal.isOpen() || !journal.open(path, key))
+        return false;
+
+    // Only the newest screenful is decrypted before we return, by
+    // attachDisk(). What was written before is indexed once search needs it.
+    preloadEnd = journal.endSeq();
+    preloadPending = true;
+    attachDisk();
+
+    if (!flusher.joinable())
+        flusher = std::thread(&MessageStore::flushLoop, this);
+    return true;
+}
+
+void MessageStore::setKey(const FreiaEncryption::Key& key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (journal.isOpen() || !journal.openTemp(key))
+        return;
+
+    attachDisk();
+}
+
+void MessageStore::setMemoryLimit(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    memoryLimit = bytes;
+    searchIndex.setLimit(bytes / indexShare);
+    trimMemory();
+}
+
+void MessageStore::setDiskLimit(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    diskLimit = bytes;
+    enforceRetention();
+}
+
+size_t MessageStore::append(const std::string& message)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    appendLocked(message);
+    return (journal.isOpen() ? journal.endSeq() - journal.firstSeq() : recent.size()) - 1;
+}
+
+size_t MessageStore::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return journal.isOpen() ? journal.endSeq() - journal.firstSeq() : recent.size();
+}
+
+std::string MessageStore::at(size_t index) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!journal.isOpen())
+        return index < recent.size() ? recent[index] : std::string();
+
+    uint64_t seq = journal.firstSeq() + index;
+    uint64_t end = journal.endSeq();
+    if (seq >= end)
+        return std::string();
+
+    uint64_t firstRecent = end - recent.size();
+    if (seq >= firstRecent)
+        return recent[seq - firstRecent];
+
+    auto it = pages.find(seq);
+    if (it != pages.end())
+        return it->second;
+
+    std::string text;
+    if (!journal.read(seq, text))
+        return "[History unavailable]";
+
+    cachePage(seq, text, true);
+    return text;
+}
+
+std::vector<size_t> MessageStore::search(const std::string& query, size_t limit) const
+{
+    uint64_t first = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!journal.isOpen())
+            return {};
+        first = journal.firstSeq();
+
+        // The first search starts on the history from earlier runs, its hits
+        // come in with the following searches
+        if (preloadPending)
+        {
+            preloadPending = false;
+            startPreload();
+        }
+    }
+
+    std::vector<size_t> out;
+    for (uint64_t seq : searchIndex.find(query, limit))
+    {
+        if (seq >= first)
+            out.push_back(seq - first);
+    }
+    return out;
+}
+
+void MessageStore::appendLocked(const std::string& message)
+{
+    if (journal.isOpen())
+    {
+        if (journal.append(message))
+        {
+            if (!isSealed(message))
+                searchIndex.add(journal.endSeq() - 1, message);
+            if (++unsynced >= syncBatch)
+                flushCv.notify_one();
+        }
+        else
+        {
+            std::cerr << "History write failed, keeping history in memory only\n";
+            journal.close();
+            pages.clear();
+            pageBytes = 0;
+            searchIndex.clear();
+        }
+    }
+
+    recent.push_back(message);
+    recentBytes += message.size();
+
+    enforceRetention();
+    trimMemory();
+}
+
+void MessageStore::attachDisk()
+{
+    // Caller holds the mutex. Show the end of the journal first, then write
+    // out whatever arrived before the disk was ready.
+    std::deque<std::string> pending;
+    pending.swap(recent);
+    recentBytes = 0;
+    pages.clear();
+    pageBytes = 0;
+
+    loadTail();
+    for (const auto& message : pending)
+        appendLocked(message);
+}
+
+void MessageStore::loadTail()
+{
+    // Only the last screenful is decrypted here
+    uint64_t end = journal.endSeq();
+    uint64_t first = std::max(journal.firstSeq(), end > screenful ? end - screenful : 0);
+
+    for (uint64_t seq = first; seq < end; seq++)
+    {
+        std::string text;
+        if (!journal.read(seq, text))
+            text = "[History unavailable]";
+        recentBytes += text.size();
+        recent.push_back(std::move(text));
+    }
+    trimMemory();
+}
+
+void MessageStore::trimMemory()
+{
+    // Cached pages go first, they can always be decrypted again. The search
+    // index has its own share of the limit and trims itself.
+    size_t indexBytes = searchIndex.size();
+    while (recentBytes + pageBytes + indexBytes > memoryLimit && !pages.empty())
+    {
+        pageBytes -= pages.begin()->second.size();
+        pages.erase(pages.begin());
+    }
+
+    // Always keep the newest message in memory, whatever the limit.
+    // Without a journal this is where old history gets dropped.
+    while (recentBytes > memoryLimit && recent.size() > 1)
+    {
+        recentBytes -= recent.front().size();
+        recent.pop_front();
+    }
+}
+
+bool MessageStore::cachePage(uint64_t seq, std::string text, bool evict) const
+{
+    // Caller holds the mutex
+    uint64_t end = journal.endSeq();
+    if (seq < journal.firstSeq() || seq >= end - recent.size() || pages.count(seq))
+        return true;
+
+    size_t used = recentBytes + searchIndex.size();
+    size_t room = memoryLimit > used ? memoryLimit - used : 0;
+    if (text.size() > room)
+        return false;
+
+    // Make space by dropping whatever is furthest away from seq
+    while (pageBytes + text.size() > room)
+    {
+        if (!evict || pages.empty())
+            return false;
+
+        auto victim = distance(seq, pages.begin()->first) > distance(seq, pages.rbegin()->first)
+            ? pages.begin()
+            : std::prev(pages.end());
+        pageBytes -= victim->second.size();
+        pages.erase(victim);
+    }
+
+    pageBytes += text.size();
+    pages.emplace(seq, std::move(text));
+    return true;
+}
+
+void MessageStore::enforceRetention()
+{
+    // Caller holds the mutex
+    if (!journal.isOpen())
+        return;
+
+    uint64_t before = journal.firstSeq();
+    journal.enforceLimit(diskLimit);
+    if (journal.firstSeq() == before)
+        return;
+
+    searchIndex.prune(journal.firstSeq());
+
+    auto keep = pages.lower_bound(journal.firstSeq());
+    for (auto it = pages.begin(); it != keep; ++it)
+        pageBytes -= it->second.size();
+    pages.erase(pages.begin(), keep);
+
+    size_t total = journal.endSeq() - journal.firstSeq();
+    while (recent.size() > total)
+    {
+        recentBytes -= recent.front().size();
+        recent.pop_front();
+    }
+}
+
+void MessageStore::indexBatch(uint64_t firstSeq, const std::vector<std::string>& texts) const
+{
+    for (size_t i = 0; i < texts.size(); i++)
+    {
+        if (!isSealed(texts[i]))
+            searchIndex.add(firstSeq + i, texts[i]);
+    }
+}
+
+void MessageStore::startPreload() const
+{
+    // Caller holds the mutex
+    preloadCacheFull = false;
+
+    // One bulk job per segment, so the executor spreads them and other bulk
+    // work gets a turn in between. Posted oldest first: a worker runs its own
+    // newest job first, which keeps the newest history decrypted first.
+    std::vector<MessageJournal::Segment> sealed = journal.sealedSegments();
+    Executor& executor = Executor::global();
+    for (auto it = sealed.rbegin(); it != sealed.rend(); ++it)
+    {
+        uint64_t firstSeq = it->firstSeq;
+        if (firstSeq >= preloadEnd)
+            continue;
+        preloadersActive++;
+        executor.post(Executor::Priority::Bulk, [this, firstSeq] { preloadSegment(firstSeq); });
+    }
+
+    // What the active segment held on open goes first; messages appended
+    // since were indexed as they came
+    uint64_t activeFirst = journal.activeSegment().firstSeq;
+    uint64_t activeEnd = preloadEnd;
+    if (activeFirst < activeEnd)
+    {
+        preloadersActive++;
+        executor.post(Executor::Priority::Bulk, [this, activeFirst, activeEnd] { indexActive(activeFirst, activeEnd); });
+    }
+}
+
+void MessageStore::preloadSegment(uint64_t firstSeq) const
+{
+    std::shared_ptr<SegmentFile> file;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!stopping)
+            file = journal.sealedFile(firstSeq);
+    }
+
+    // Sealed segments never change, no lock needed to decrypt them
+    std::vector<std::string> texts;
+    if (file && file->decryptAll(texts))
+    {
+        indexBatch(firstSeq, texts);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = texts.size(); i-- > 0 && !preloadCacheFull;)
+        {
+            // Out of budget: newer history is cached, the rest stays on disk
+            if (!cachePage(firstSeq + i, std::move(texts[i]), false))
+                preloadCacheFull = true;
+        }
+    }
+    file.reset();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--preloadersActive == 0)
+        preloadDone.notify_all();
+}
+
+void MessageStore::indexActive(uint64_t firstSeq, uint64_t endSeq) const
+{
+    // The active segment is still appended to, so it is read through the
+    // journal a batch at a time under the lock
+    static constexpr size_t batch = 256;
+    for (uint64_t seq = firstSeq; seq < endSeq;)
+    {
+        uint64_t batchFirst = seq;
+        std::vector<std::string> texts;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping || !journal.isOpen() || seq < journal.firstSeq())
+                break;
+            for (; seq < endSeq && texts.size() < batch; seq++)
+            {
+                std::string text;
+                journal.read(seq, text);
+                texts.push_back(std::move(text));
+            }
+        }
+        indexBatch(batchFirst, texts);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--preloadersActive == 0)
+        preloadDone.notify_all();
+}
+
+void MessageStore::flushLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        flushCv.wait_for(lock, std::chrono::seconds(1),
+                         [this] { return stopping || unsynced >= syncBatch; });
+
+        int logFd = -1;
+        int idxFd = -1;
+        bool pending = unsynced > 0;
+        unsynced = 0;
+        if (pending && journal.dupActiveFds(logFd, idxFd))
+        {
+            lock.unlock();
+            if (!SegmentFile::syncFds(logFd, idxFd))
+                std::cerr << "History sync failed\n";
+            lock.lock();
+        }
+
+        if (stopping)
+            break;
+    }
+}
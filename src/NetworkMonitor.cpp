@@ -0,0 +1,166 @@
+#include "NetworkMonitor.h"
+#include <iostream>
+#include <cerrno>
+#include <cstdint>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+NetworkMonitor::~NetworkMonitor()
+{
+    if (worker.joinable())
+    {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) != sizeof(one))
+            std::cerr << "Failed to stop the network monitor, errno: " << errno << "\n";
+        worker.join();
+    }
+
+    if (netlinkFd != -1)
+        close(netlinkFd);
+    if (wakeFd != -1)
+        close(wakeFd);
+}
+
+NetworkMonitor& NetworkMonitor::global()
+{
+    static NetworkMonitor monitor;
+    return monitor;
+}
+
+size_t NetworkMonitor::subscribe(std::function<void()> listener)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!worker.joinable() && !start())
+        return 0;
+
+    size_t id = nextId++;
+    listeners.emplace(id, std::move(listener));
+    return id;
+}
+
+void NetworkMonitor::unsubscribe(size_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    listeners.erase(id);
+}
+
+bool NetworkMonitor::start()
+{
+    netlinkFd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (netlinkFd == -1)
+    {
+        std::cerr << "Failed to open rtnetlink socket, errno: " << errno << "\n";
+        return false;
+    }
+
+    sockaddr_nl address{};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_LINK;
+    if (bind(netlinkFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+    {
+        std::cerr << "Failed to join rtnetlink groups, errno: " << errno << "\n";
+        close(netlinkFd);
+        netlinkFd = -1;
+        return false;
+    }
+
+    wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd == -1)
+    {
+        std::cerr << "Failed to create eventfd, errno: " << errno << "\n";
+        close(netlinkFd);
+        netlinkFd = -1;
+        return false;
+    }
+
+    worker = std::thread(&NetworkMonitor::workerLoop, this);
+    return true;
+}
+
+bool NetworkMonitor::readEvents()
+{
+    // True when something we care about changed. A full socket buffer lost
+    // messages, which could have been anything.
+    alignas(nlmsghdr) char buffer[16384];
+    bool changed = false;
+    while (true)
+    {
+        ssize_t n = recv(netlinkFd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return changed || errno == ENOBUFS;
+
+        int len = static_cast<int>(n);
+        for (nlmsghdr* message = reinterpret_cast<nlmsghdr*>(buffer); NLMSG_OK(message, len);
+             message = NLMSG_NEXT(message, len))
+        {
+            switch (message->nlmsg_type)
+            {
+            case RTM_NEWADDR:
+            case RTM_DELADDR:
+            case RTM_NEWROUTE:
+            case RTM_DELROUTE:
+            case RTM_NEWLINK:
+            case RTM_DELLINK:
+                changed = true;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+void NetworkMonitor::workerLoop()
+{
+    pollfd fds[2] = {{netlinkFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+    bool pending = false;
+    while (true)
+    {
+        // While a burst is still arriving, wait for it to go quiet
+        int rc = poll(fds, 2, pending ? static_cast<int>(settleTime.count()) : -1);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0)
+        {
+            std::cerr << "Network monitor poll failed, errno: " << errno << "\n";
+            return;
+        }
+        if (fds[1].revents)
+            return;
+
+        if (rc > 0)
+        {
+            pending = readEvents() || pending;
+            continue;
+        }
+
+        pending = false;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : listeners)
+            entry.second();
+    }
+}
+
+bool NetworkMonitor::routeChanged(const sockaddr_in& local, const sockaddr_in& peer)
+{
+    // Connecting a UDP socket sends nothing; the kernel just picks the route
+    // and the source address it would use now
+    int probe = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (probe == -1)
+        return false;
+
+    sockaddr_in source{};
+    socklen_t sourceLen = sizeof(source);
+    bool changed = connect(probe, reinterpret_cast<const sockaddr*>(&peer), sizeof(peer)) == -1 ||
+                   getsockname(probe, reinterpret_cast<sockaddr*>(&source), &sourceLen) == -1 ||
+                   source.sin_addr.s_addr != local.sin_addr.s_addr;
+    close(probe);
+    return changed;
+}
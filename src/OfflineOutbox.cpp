@@ -0,0 +1,188 @@
+#include "OfflineOutbox.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+static const char outboxMagic[8] = {'F', 'R', 'E', 'I', 'A', 'O', 'B', '1'};
+
+bool OfflineOutbox::open(const std::string& path, const FreiaEncryption::Key& key)
+{
+    close();
+    this->key = key;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        std::cerr << "Failed to open outbox " << path << ", errno: " << errno << "\n";
+        return false;
+    }
+
+    if (!load())
+    {
+        std::cerr << "Failed to read outbox " << path << ", errno: " << errno << "\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void OfflineOutbox::close()
+{
+    if (fd != -1)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    pending.clear();
+    recordSizes.clear();
+    fileSize = 0;
+    head = sizeof(Header);
+}
+
+bool OfflineOutbox::load()
+{
+    struct stat st{};
+    if (fstat(fd, &st) != 0)
+        return false;
+
+    std::string data(st.st_size, '\0');
+    size_t got = 0;
+    while (got < data.size())
+    {
+        ssize_t r = pread(fd, data.data() + got, data.size() - got, got);
+        if (r <= 0)
+        {
+            if (r == -1 && errno == EINTR)
+                continue;
+            return false;
+        }
+        got += r;
+    }
+
+    // A file without our header is new, or was cut short before it got one
+    Header header{};
+    if (data.size() >= sizeof(header))
+        std::memcpy(&header, data.data(), sizeof(header));
+    if (data.size() < sizeof(header) || std::memcmp(header.magic, outboxMagic, sizeof(outboxMagic)) != 0)
+    {
+        std::memcpy(header.magic, outboxMagic, sizeof(outboxMagic));
+        header.head = sizeof(header);
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+            return false;
+        data.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    // A head past the end was left by a crash between cutting the file and moving it
+    head = header.head >= sizeof(header) && header.head <= data.size() ? header.head : sizeof(header);
+
+    // Keep every record up to the first one that is torn or does not decrypt
+    size_t pos = head;
+    while (pos + sizeof(uint32_t) <= data.size())
+    {
+        uint32_t netLen = 0;
+        data.copy(reinterpret_cast<char*>(&netLen), sizeof(netLen), pos);
+        size_t next = pos + sizeof(netLen) + ntohl(netLen);
+        if (next > data.size())
+            break;
+
+        std::string frame = FreiaEncryption::decryptData(data.data() + pos + sizeof(netLen), ntohl(netLen), key);
+        if (frame.empty())
+            break;
+        pending.push_back(std::move(frame));
+        recordSizes.push_back(static_cast<uint32_t>(next - pos));
+        pos = next;
+    }
+
+    if (pos < data.size() && ftruncate(fd, pos) != 0)
+        return false;
+    fileSize = pos;
+    return true;
+}
+
+bool OfflineOutbox::append(const std::string& frame)
+{
+    pending.push_back(frame);
+    recordSizes.push_back(0);
+    if (fd == -1)
+        return true;
+
+    // A message the user believes sent must survive a crash, they are rare enough to sync each
+    return write(frame, recordSizes.back()) && fdatasync(fd) == 0;
+}
+
+bool OfflineOutbox::write(const std::string& frame, uint32_t& recordSize)
+{
+    std::string cipher = FreiaEncryption::encryptData(frame, key);
+    if (cipher.empty())
+        return false;
+
+    uint32_t netLen = htonl(static_cast<uint32_t>(cipher.size()));
+    std::string buf(reinterpret_cast<const char*>(&netLen), sizeof(netLen));
+    buf.append(cipher);
+
+    size_t written = 0;
+    while (written < buf.size())
+    {
+        ssize_t w = pwrite(fd, buf.data() + written, buf.size() - written, fileSize + written);
+        if (w <= 0)
+        {
+            if (w == -1 && errno == EINTR)
+                continue;
+
+            // Leave no half record behind for the next load to stumble over
+            if (ftruncate(fd, fileSize) != 0)
+                std::cerr << "Failed to trim outbox, errno: " << errno << "\n";
+            return false;
+        }
+        written += w;
+    }
+    fileSize += buf.size();
+    recordSize = static_cast<uint32_t>(buf.size());
+    return true;
+}
+
+bool OfflineOutbox::writeHead(uint64_t offset)
+{
+    ssize_t w;
+    do
+        w = pwrite(fd, &offset, sizeof(offset), offsetof(Header, head));
+    while (w == -1 && errno == EINTR);
+    if (w != static_cast<ssize_t>(sizeof(offset)))
+        return false;
+    head = offset;
+    return true;
+}
+
+void OfflineOutbox::drop(size_t count)
+{
+    count = std::min(count, pending.size());
+    if (count == 0)
+        return;
+
+    uint64_t sent = 0;
+    for (size_t i = 0; i < count; i++)
+        sent += recordSizes[i];
+    pending.erase(pending.begin(), pending.begin() + count);
+    recordSizes.erase(recordSizes.begin(), recordSizes.begin() + count);
+    if (fd == -1)
+        return;
+
+    // Sent records stay where they are, only the head moves past them. The
+    // file is cut back once nothing is left.
+    bool ok;
+    if (pending.empty())
+    {
+        ok = ftruncate(fd, sizeof(Header)) == 0 && writeHead(sizeof(Header));
+        fileSize = sizeof(Header);
+    }
+    else
+        ok = writeHead(head + sent);
+    if (!ok || fdatasync(fd) != 0)
+        std::cerr << "Failed to update outbox, errno: " << errno << "\n";
+}
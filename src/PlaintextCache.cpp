@@ -0,0 +1,44 @@
+#include "PlaintextCache.h"
+#include <openssl/crypto.h>
+
+bool PlaintextCache::get(const std::string& key, std::string& out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = lookup.find(key);
+    if (it == lookup.end())
+        return false;
+
+    entries.splice(entries.begin(), entries, it->second);
+    out = it->second->second;
+    return true;
+}
+
+void PlaintextCache::put(const std::string& key, const std::string& plaintext)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = lookup.find(key);
+    if (it != lookup.end())
+        evict(it->second);
+
+    entries.emplace_front(key, plaintext);
+    lookup[key] = entries.begin();
+
+    while (entries.size() > capacity)
+        evict(std::prev(entries.end()));
+}
+
+void PlaintextCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!entries.empty())
+        evict(entries.begin());
+}
+
+void PlaintextCache::evict(std::list<Entry>::iterator it)
+{
+    // Caller holds the mutex
+    std::string& text = it->second;
+    OPENSSL_cleanse(text.data(), text.size());
+    lookup.erase(it->first);
+    entries.erase(it);
+}
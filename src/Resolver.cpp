@@ -0,0 +1,181 @@
+#include "Resolver.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+static std::shared_future<Resolver::Result> ready(Resolver::Result result)
+{
+    std::promise<Resolver::Result> promise;
+    promise.set_value(std::move(result));
+    return promise.get_future().share();
+}
+
+Resolver::~Resolver()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    if (worker.joinable())
+        worker.join();
+
+    // Nobody is left to answer these
+    for (auto& pending : queue)
+        pending.promise.set_value(Result{{}, "Resolver stopped"});
+}
+
+Resolver& Resolver::global()
+{
+    static Resolver resolver;
+    return resolver;
+}
+
+std::string Resolver::normalize(const std::string& host)
+{
+    std::string key = host;
+    std::transform(key.begin(), key.end(), key.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return key;
+}
+
+std::shared_future<Resolver::Result> Resolver::resolve(const std::string& host)
+{
+    in_addr literal{};
+    if (inet_pton(AF_INET, host.c_str(), &literal) == 1)
+        return ready(Result{{host}, ""});
+
+    std::string key = normalize(host);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto cached = cache.find(key);
+    if (cached != cache.end())
+    {
+        if (Clock::now() < cached->second.expires)
+            return ready(Result{cached->second.addresses, ""});
+        cache.erase(cached);
+    }
+
+    auto running = inFlight.find(key);
+    if (running != inFlight.end())
+        return running->second;
+
+    Pending pending;
+    pending.host = key;
+    std::shared_future<Result> future = pending.promise.get_future().share();
+    inFlight.emplace(key, future);
+    queue.push_back(std::move(pending));
+
+    // One lookup at a time is plenty for a chat client
+    if (!worker.joinable())
+        worker = std::thread(&Resolver::workerLoop, this);
+    cv.notify_one();
+    return future;
+}
+
+void Resolver::forget(const std::string& host)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.erase(normalize(host));
+}
+
+void Resolver::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        cv.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping)
+            break;
+
+        Pending pending = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+        std::chrono::seconds ttl = defaultTtl;
+        Result result = lookup(pending.host, ttl);
+
+        lock.lock();
+        if (!result.addresses.empty())
+            cache[pending.host] = Entry{result.addresses, Clock::now() + ttl};
+        inFlight.erase(pending.host);
+        pending.promise.set_value(std::move(result));
+    }
+}
+
+Resolver::Result Resolver::lookup(const std::string& host, std::chrono::seconds& ttl)
+{
+    // getaddrinfo decides the addresses, so /etc/hosts and nsswitch still apply
+    Result result;
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* list = nullptr;
+    int rc = getaddrinfo(host.c_str(), nullptr, &hints, &list);
+    if (rc != 0)
+    {
+        result.error = gai_strerror(rc);
+        return result;
+    }
+
+    for (addrinfo* ai = list; ai; ai = ai->ai_next)
+    {
+        char text[INET_ADDRSTRLEN];
+        auto* sa = reinterpret_cast<sockaddr_in*>(ai->ai_addr);
+        if (!inet_ntop(AF_INET, &sa->sin_addr, text, sizeof(text)))
+            continue;
+        if (std::find(result.addresses.begin(), result.addresses.end(), text) == result.addresses.end())
+            result.addresses.push_back(text);
+    }
+    freeaddrinfo(list);
+
+    if (result.addresses.empty())
+        result.error = "No IPv4 address";
+    else if (!queryTtl(host, ttl))
+        ttl = defaultTtl;
+    return result;
+}
+
+bool Resolver::queryTtl(const std::string& host, std::chrono::seconds& ttl)
+{
+    // getaddrinfo does not report TTLs, so ask DNS for the A records directly.
+    // Names that only exist outside DNS fail here quickly and keep the default.
+    struct __res_state state{};
+    if (res_ninit(&state) != 0)
+        return false;
+    state.retry = 1;
+    state.retrans = 2;
+
+    unsigned char answer[4096];
+    int len = res_nquery(&state, host.c_str(), ns_c_in, ns_t_a, answer, sizeof(answer));
+    res_nclose(&state);
+    if (len < 0)
+        return false;
+
+    ns_msg msg;
+    if (ns_initparse(answer, len, &msg) < 0)
+        return false;
+
+    // The shortest TTL along the CNAME chain decides when the answer goes stale
+    bool found = false;
+    uint32_t lowest = UINT32_MAX;
+    for (int i = 0; i < ns_msg_count(msg, ns_s_an); i++)
+    {
+        ns_rr rr;
+        if (ns_parserr(&msg, ns_s_an, i, &rr) < 0)
+            continue;
+        lowest = std::min<uint32_t>(lowest, ns_rr_ttl(rr));
+        found = true;
+    }
+    if (!found)
+        return false;
+
+    ttl = std::clamp(std::chrono::seconds(lowest), minTtl, maxTtl);
+    return true;
+}
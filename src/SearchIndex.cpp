@@ -0,0 +1,181 @@
+#include "SearchIndex.h"
+#include <algorithm>
+#include <iterator>
+#include <cctype>
+
+std::vector<std::string> SearchIndex::tokenize(const std::string& text)
+{
+    // Words are runs of ASCII letters/digits; bytes >= 0x80 count as letters
+    // so UTF-8 words stay in one piece.
+    std::vector<std::string> out;
+    std::string current;
+
+    for (unsigned char c : text)
+    {
+        if (std::isalnum(c) || c >= 0x80)
+        {
+            current += static_cast<char>(std::tolower(c));
+        }
+        else if (!current.empty())
+        {
+            out.push_back(current);
+            current.clear();
+        }
+    }
+    if (!current.empty())
+        out.push_back(current);
+
+    return out;
+}
+
+void SearchIndex::add(uint64_t seq, const std::string& text)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (seq < floor)
+        return;
+    insert(text, seq);
+    lowest = std::min(lowest, seq);
+    highest = std::max(highest, seq);
+    shrink();
+}
+
+void SearchIndex::insert(const std::string& text, uint64_t seq)
+{
+    // Caller holds the mutex
+    auto tokens = tokenize(text);
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+    for (const auto& word : tokens)
+    {
+        auto [it, added] = words.try_emplace(word);
+        if (added)
+            bytes += word.size() + wordOverhead;
+        Posting& p = it->second;
+        if (!p.seqs.empty() && p.seqs.back() == seq)
+            continue;
+        // Live messages arrive in order; background batches break it, and
+        // may repeat one
+        if (!p.seqs.empty() && p.seqs.back() > seq)
+            p.sorted = false;
+        p.seqs.push_back(seq);
+        bytes += sizeof(uint64_t);
+    }
+}
+
+void SearchIndex::prune(uint64_t firstSeq)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    dropBelow(firstSeq);
+}
+
+void SearchIndex::dropBelow(uint64_t seq)
+{
+    // Caller holds the mutex
+    floor = std::max(floor, seq);
+    lowest = std::max(lowest, floor);
+    bytes = 0;
+    for (auto it = words.begin(); it != words.end();)
+    {
+        auto& seqs = it->second.seqs;
+        seqs.erase(std::remove_if(seqs.begin(), seqs.end(),
+                                  [this](uint64_t s) { return s < floor; }),
+                   seqs.end());
+
+        if (seqs.empty())
+            it = words.erase(it);
+        else
+        {
+            bytes += it->first.size() + wordOverhead + seqs.size() * sizeof(uint64_t);
+            ++it;
+        }
+    }
+}
+
+void SearchIndex::shrink()
+{
+    // Caller holds the mutex. The oldest quarter at a time, so a full index
+    // is not walked again for every message.
+    while (bytes > limit && !words.empty())
+        dropBelow(lowest < highest ? lowest + (highest - lowest) / 4 + 1 : highest + 1);
+}
+
+void SearchIndex::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    words.clear();
+    bytes = 0;
+    floor = 0;
+    lowest = UINT64_MAX;
+    highest = 0;
+}
+
+void SearchIndex::setLimit(size_t newLimit)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    limit = newLimit;
+    shrink();
+}
+
+size_t SearchIndex::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes;
+}
+
+uint64_t SearchIndex::coveredFrom() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return floor;
+}
+
+std::vector<uint64_t> SearchIndex::lookupPrefix(const std::string& prefix)
+{
+    // Caller holds the mutex. Union of the postings of every word with this prefix.
+    std::vector<uint64_t> out;
+    for (auto it = words.lower_bound(prefix);
+         it != words.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+         ++it)
+    {
+        Posting& p = it->second;
+        if (!p.sorted)
+        {
+            std::sort(p.seqs.begin(), p.seqs.end());
+            p.seqs.erase(std::unique(p.seqs.begin(), p.seqs.end()), p.seqs.end());
+            p.sorted = true;
+        }
+
+        std::vector<uint64_t> merged;
+        merged.reserve(out.size() + p.seqs.size());
+        std::set_union(out.begin(), out.end(), p.seqs.begin(), p.seqs.end(),
+                       std::back_inserter(merged));
+        out.swap(merged);
+    }
+    return out;
+}
+
+std::vector<uint64_t> SearchIndex::find(const std::string& query, size_t limit)
+{
+    auto terms = tokenize(query);
+    if (terms.empty())
+        return {};
+
+    // Longest term first, it usually has the smallest posting list
+    std::sort(terms.begin(), terms.end(),
+              [](const std::string& a, const std::string& b) { return a.size() > b.size(); });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<uint64_t> hits = lookupPrefix(terms[0]);
+    for (size_t i = 1; i < terms.size() && !hits.empty(); i++)
+    {
+        std::vector<uint64_t> next = lookupPrefix(terms[i]);
+        std::vector<uint64_t> both;
+        std::set_intersection(hits.begin(), hits.end(), next.begin(), next.end(),
+                              std::back_inserter(both));
+        hits.swap(both);
+    }
+
+    if (hits.size() > limit)
+        hits.erase(hits.begin(), hits.end() - limit);
+    return hits;
+}
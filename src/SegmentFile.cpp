@@ -0,0 +1,422 @@
+#include "SegmentFile.h"
+#include <iostream>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+static const char indexMagic[8] = {'F', 'R', 'E', 'I', 'A', 'I', 'X', '1'};
+static const std::string keyCheck = "FREIA-JOURNAL";
+
+static int makeTempFile(const char* name)
+{
+    const char* dir = std::getenv("TMPDIR");
+    std::string pattern = std::string(dir && *dir ? dir : "/tmp") + "/" + name + "-XXXXXX";
+
+    int fd = mkstemp(pattern.data());
+    if (fd != -1)
+        unlink(pattern.c_str());    // the space is released when we close the fd
+    return fd;
+}
+
+SegmentFile::~SegmentFile()
+{
+    close();
+}
+
+bool SegmentFile::open(const std::string& path, const FreiaEncryption::Key& key)
+{
+    close();
+
+    int logFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    int idxFd = ::open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (logFd == -1 || idxFd == -1)
+    {
+        std::cerr << "Failed to open journal " << path << ", errno: " << errno << "\n";
+        if (logFd != -1) ::close(logFd);
+        if (idxFd != -1) ::close(idxFd);
+        return false;
+    }
+
+    struct stat st{};
+    fstat(idxFd, &st);
+
+    this->path = path;
+    this->key = key;
+    if (!attach(logFd, idxFd, st.st_size < static_cast<off_t>(sizeof(IndexHeader))))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool SegmentFile::openTemp(const FreiaEncryption::Key& key)
+{
+    close();
+
+    int logFd = makeTempFile("freia-spill");
+    int idxFd = makeTempFile("freia-spill-idx");
+    if (logFd == -1 || idxFd == -1)
+    {
+        std::cerr << "Failed to create spill file, errno: " << errno << "\n";
+        if (logFd != -1) ::close(logFd);
+        if (idxFd != -1) ::close(idxFd);
+        return false;
+    }
+
+    this->key = key;
+    if (!attach(logFd, idxFd, true))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SegmentFile::removeFiles(const std::string& path)
+{
+    unlink(path.c_str());
+    unlink((path + ".idx").c_str());
+}
+
+void SegmentFile::close()
+{
+    unmap();
+    if (indexMap)
+    {
+        munmap(indexMap, indexMapSize);
+        indexMap = nullptr;
+        indexMapSize = 0;
+    }
+    if (fd != -1)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    if (indexFd != -1)
+    {
+        ::close(indexFd);
+        indexFd = -1;
+    }
+    path.clear();
+    fileSize = 0;
+    indexCapacity = 0;
+    recordCount = 0;
+}
+
+bool SegmentFile::attach(int logFd, int idxFd, bool fresh)
+{
+    fd = logFd;
+    indexFd = idxFd;
+
+    struct stat st{};
+    fstat(fd, &st);
+    fileSize = st.st_size;
+
+    if (!fresh)
+    {
+        fstat(indexFd, &st);
+        indexCapacity = (st.st_size - sizeof(IndexHeader)) / sizeof(uint64_t);
+
+        void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, indexFd, 0);
+        if (p == MAP_FAILED)
+        {
+            std::cerr << "Failed to map journal index, errno: " << errno << "\n";
+            return false;
+        }
+        indexMap = static_cast<unsigned char*>(p);
+        indexMapSize = st.st_size;
+
+        if (std::memcmp(header()->magic, indexMagic, sizeof(indexMagic)) != 0)
+        {
+            fresh = true;   // unreadable index, rebuild it from the log
+        }
+        else if (!verifyKey())
+        {
+            std::cerr << "Journal was written with a different chat key\n";
+            return false;
+        }
+        else
+        {
+            recordCount = header()->count;
+            if (recordCount > indexCapacity)
+            {
+                fresh = true;
+                recordCount = 0;
+            }
+        }
+    }
+
+    if (fresh)
+    {
+        if (!indexMap && !growIndex(1024))
+            return false;
+        recordCount = 0;
+        if (!writeHeader())
+            return false;
+    }
+
+    return recover();
+}
+
+bool SegmentFile::writeHeader()
+{
+    std::string check = FreiaEncryption::encryptData(keyCheck, key);
+    if (check.empty() || check.size() > sizeof(header()->check))
+        return false;
+
+    IndexHeader* h = header();
+    std::memcpy(h->magic, indexMagic, sizeof(indexMagic));
+    h->count = recordCount;
+    h->checkLen = check.size();
+    h->reserved = 0;
+    std::memcpy(h->check, check.data(), check.size());
+    return true;
+}
+
+bool SegmentFile::verifyKey() const
+{
+    const IndexHeader* h = header();
+    if (h->checkLen > sizeof(h->check))
+        return false;
+
+    std::string check(reinterpret_cast<const char*>(h->check), h->checkLen);
+    return FreiaEncryption::decryptData(check, key) == keyCheck;
+}
+
+bool SegmentFile::recover()
+{
+    // Find where the indexed part of the log ends. If the index points past the
+    // log (it reached disk, the log did not) start over from the beginning.
+    uint64_t pos = 0;
+    if (recordCount > 0)
+    {
+        uint64_t last = offsets()[recordCount - 1];
+        uint32_t netLen = 0;
+        if (last + sizeof(netLen) <= fileSize
+            && pread(fd, &netLen, sizeof(netLen), last) == sizeof(netLen)
+            && last + sizeof(netLen) + ntohl(netLen) <= fileSize)
+        {
+            pos = last + sizeof(netLen) + ntohl(netLen);
+        }
+        else
+        {
+            recordCount = 0;
+        }
+    }
+
+    // Index whatever was appended after the last index update
+    while (pos + sizeof(uint32_t) <= fileSize)
+    {
+        uint32_t netLen = 0;
+        if (pread(fd, &netLen, sizeof(netLen), pos) != sizeof(netLen))
+            return false;
+
+        uint64_t next = pos + sizeof(netLen) + ntohl(netLen);
+        if (next > fileSize)
+            break;
+        if (!pushOffset(pos))
+            return false;
+        pos = next;
+    }
+
+    // Drop a torn record left by a crash in the middle of an append
+    if (pos < fileSize)
+    {
+        if (ftruncate(fd, pos) != 0)
+            return false;
+        fileSize = pos;
+    }
+
+    header()->count = recordCount;
+    return true;
+}
+
+bool SegmentFile::growIndex(uint64_t capacity)
+{
+    size_t newSize = sizeof(IndexHeader) + capacity * sizeof(uint64_t);
+    if (ftruncate(indexFd, newSize) != 0)
+    {
+        std::cerr << "Failed to grow journal index, errno: " << errno << "\n";
+        return false;
+    }
+
+    void* p = mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, indexFd, 0);
+    if (p == MAP_FAILED)
+    {
+        std::cerr << "Failed to map journal index, errno: " << errno << "\n";
+        return false;
+    }
+
+    if (indexMap)
+        munmap(indexMap, indexMapSize);
+    indexMap = static_cast<unsigned char*>(p);
+    indexMapSize = newSize;
+    indexCapacity = capacity;
+    return true;
+}
+
+bool SegmentFile::pushOffset(uint64_t offset)
+{
+    if (recordCount == indexCapacity && !growIndex(std::max<uint64_t>(1024, indexCapacity * 2)))
+        return false;
+
+    offsets()[recordCount] = offset;
+    recordCount++;
+    header()->count = recordCount;
+    return true;
+}
+
+bool SegmentFile::append(const std::string& record)
+{
+    if (fd == -1)
+        return false;
+
+    std::string cipher = FreiaEncryption::encryptData(record, key);
+    if (cipher.empty())
+        return false;
+
+    uint32_t netLen = htonl(static_cast<uint32_t>(cipher.size()));
+    std::string buf(reinterpret_cast<const char*>(&netLen), sizeof(netLen));
+    buf.append(cipher);
+
+    size_t written = 0;
+    while (written < buf.size())
+    {
+        ssize_t w = pwrite(fd, buf.data() + written, buf.size() - written, fileSize + written);
+        if (w <= 0)
+        {
+            if (w == -1 && errno == EINTR)
+                continue;
+            return false;
+        }
+        written += w;
+    }
+
+    if (!pushOffset(fileSize))
+        return false;
+    fileSize += buf.size();
+    return true;
+}
+
+bool SegmentFile::read(size_t index, std::string& out)
+{
+    if (index >= recordCount)
+        return false;
+
+    uint64_t off = offsets()[index];
+    uint64_t end = (index + 1 < recordCount) ? offsets()[index + 1] : fileSize;
+    if (!remap(end))
+        return false;
+
+    uint32_t netLen = 0;
+    std::memcpy(&netLen, map + off, sizeof(netLen));
+    uint32_t len = ntohl(netLen);
+    if (off + sizeof(netLen) + len > end)
+        return false;
+
+    std::string cipher(reinterpret_cast<const char*>(map + off + sizeof(netLen)), len);
+    out = FreiaEncryption::decryptData(cipher, key);
+    return !out.empty();
+}
+
+uint64_t SegmentFile::offsetOf(size_t index) const
+{
+    return index < recordCount ? offsets()[index] : fileSize;
+}
+
+bool SegmentFile::decryptAll(std::vector<std::string>& out) const
+{
+    out.clear();
+    if (fd == -1)
+        return false;
+
+    std::string log(fileSize, '\0');
+    uint64_t done = 0;
+    while (done < fileSize)
+    {
+        ssize_t r = pread(fd, log.data() + done, fileSize - done, done);
+        if (r <= 0)
+            return false;
+        done += r;
+    }
+
+    out.reserve(recordCount);
+    for (size_t i = 0; i < recordCount; i++)
+    {
+        uint64_t off = offsets()[i];
+        uint32_t netLen = 0;
+        if (off + sizeof(netLen) <= fileSize)
+            std::memcpy(&netLen, log.data() + off, sizeof(netLen));
+
+        std::string text;
+        uint32_t len = ntohl(netLen);
+        if (len > 0 && off + sizeof(netLen) + len <= fileSize)
+            text = FreiaEncryption::decryptData(log.substr(off + sizeof(netLen), len), key);
+        out.push_back(text.empty() ? "[History unavailable]" : std::move(text));
+    }
+    return true;
+}
+
+bool SegmentFile::dupFds(int& logFd, int& idxFd) const
+{
+    if (fd == -1)
+        return false;
+
+    logFd = dup(fd);
+    idxFd = dup(indexFd);
+    if (logFd == -1 || idxFd == -1)
+    {
+        if (logFd != -1) ::close(logFd);
+        if (idxFd != -1) ::close(idxFd);
+        return false;
+    }
+    return true;
+}
+
+bool SegmentFile::syncFds(int logFd, int idxFd)
+{
+    // fsync on the index also writes back the pages dirtied through our mapping
+    bool ok = fdatasync(logFd) == 0 && fdatasync(idxFd) == 0;
+    ::close(logFd);
+    ::close(idxFd);
+    return ok;
+}
+
+bool SegmentFile::remap(uint64_t needed)
+{
+    if (map && needed <= mapSize)
+        return true;
+
+    unmap();
+    if (fileSize == 0)
+        return false;
+
+    void* p = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        std::cerr << "Failed to map journal, errno: " << errno << "\n";
+        return false;
+    }
+
+    map = static_cast<unsigned char*>(p);
+    mapSize = fileSize;
+    return needed <= mapSize;
+}
+
+void SegmentFile::unmap()
+{
+    if (map)
+    {
+        munmap(map, mapSize);
+        map = nullptr;
+        mapSize = 0;
+    }
+}
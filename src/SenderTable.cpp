@@ -0,0 +1,90 @@
+#include "SenderTable.h"
+#include "Validation.h"
+
+bool SenderTable::readVarint(std::string_view& in, uint64_t& value)
+{
+    value = 0;
+    for (size_t i = 0; i < in.size() && i < 10; ++i)
+    {
+        uint64_t byte = static_cast<unsigned char>(in[i]);
+        if (i == 9 && byte > 1)
+            return false;   // would not fit 64 bits
+
+        value |= (byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80))
+        {
+            in.remove_prefix(i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void SenderTable::writeVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool SenderTable::bind(uint64_t id, std::string_view name, bool isMuted)
+{
+    // Names end up in sealed history entries, which split on the first newline
+    if (id >= maxSenders || !Validation::isValidUser(std::string(name)) || name.find('\n') != std::string_view::npos)
+        return false;
+
+    // Interned names are never dropped, lookup() hands out views of them.
+    // Only a very long-lived session runs out, its new senders go unbound.
+    std::lock_guard<std::mutex> lock(mutex);
+    if (names.size() >= maxSenders && byName.find(name) == byName.end())
+        return false;
+
+    uint32_t index = intern(name);
+    muted[index] = isMuted;
+    if (byWire.size() <= id)
+        byWire.resize(id + 1, 0);
+    byWire[id] = index + 1;
+    return true;
+}
+
+bool SenderTable::lookup(uint64_t id, std::string_view& name, bool& isMuted) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (id >= byWire.size() || byWire[id] == 0)
+        return false;
+
+    uint32_t index = byWire[id] - 1;
+    name = names[index];
+    isMuted = muted[index];
+    return true;
+}
+
+void SenderTable::setMuted(std::string_view name, bool isMuted)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = byName.find(name);
+    if (it != byName.end())
+        muted[it->second] = isMuted;
+}
+
+void SenderTable::resetBindings()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    byWire.clear();
+}
+
+uint32_t SenderTable::intern(std::string_view name)
+{
+    auto it = byName.find(name);
+    if (it != byName.end())
+        return it->second;
+
+    names.emplace_back(name);
+    muted.push_back(false);
+    uint32_t index = static_cast<uint32_t>(names.size() - 1);
+    byName.emplace(names.back(), index);
+    return index;
+}
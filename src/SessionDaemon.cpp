@@ -0,0 +1,376 @@
+#include "SessionDaemon.h"
+#include "DaemonProtocol.h"
+#include "FreiaEncryption.h"
+#include <iostream>
+#include <charconv>
+#include <algorithm>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool parseNumber(std::string_view text, uint64_t& value)
+{
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+SessionDaemon::~SessionDaemon()
+{
+    if (listenFd != -1)
+    {
+        close(listenFd);
+        unlink(path.c_str());
+    }
+}
+
+bool SessionDaemon::listen(const std::string& socketPath)
+{
+    sockaddr_un addr{};
+    if (socketPath.empty())
+        return false;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Daemon socket path too long\n";
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::copy(socketPath.begin(), socketPath.end(), addr.sun_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        std::cerr << "Failed to create daemon socket, errno: " << errno << "\n";
+        return false;
+    }
+
+    // A socket file nobody answers on is left over from a crash
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0)
+    {
+        std::cerr << "Daemon already running on " << socketPath << "\n";
+        close(fd);
+        return false;
+    }
+    unlink(socketPath.c_str());
+
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) == -1 || chmod(socketPath.c_str(), 0600) == -1 ||
+        ::listen(fd, 16) == -1)
+    {
+        std::cerr << "Failed to listen on " << socketPath << ", errno: " << errno << "\n";
+        close(fd);
+        return false;
+    }
+
+    listenFd = fd;
+    path = socketPath;
+    return true;
+}
+
+void SessionDaemon::run()
+{
+    std::map<uint64_t, std::thread> workers;
+    uint64_t nextWorker = 0;
+
+    while (!stopping)
+    {
+        pollfd pfd{listenFd, POLLIN, 0};
+        int ready = poll(&pfd, 1, 200);
+
+        publishStatus();
+
+        // Reap the threads of frontends that went away
+        std::vector<uint64_t> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.swap(finished);
+        }
+        for (uint64_t worker : done)
+        {
+            workers[worker].join();
+            workers.erase(worker);
+        }
+
+        if (ready <= 0 || !(pfd.revents & POLLIN))
+            continue;
+
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1)
+            continue;
+
+        // Only our own user gets to see the sessions
+        if (!DaemonProtocol::peerIsUs(fd))
+        {
+            close(fd);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        frontendFds.insert(fd);
+        uint64_t worker = nextWorker++;
+        workers.emplace(worker, std::thread(&SessionDaemon::serve, this, fd, worker));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int fd : frontendFds)
+            shutdown(fd, SHUT_RDWR);
+    }
+    for (auto& worker : workers)
+        worker.second.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    sessions.clear();
+}
+
+void SessionDaemon::serve(int fd, uint64_t worker)
+{
+    std::shared_ptr<Session> session;
+    std::string request;
+    while (!stopping && DaemonProtocol::recvFrame(fd, request))
+    {
+        if (!DaemonProtocol::sendFrame(fd, handle(request, session)))
+            break;
+    }
+
+    // Deregister before closing, so stop() never shuts down a reused fd
+    std::lock_guard<std::mutex> lock(mutex);
+    frontendFds.erase(fd);
+    finished.push_back(worker);
+    close(fd);
+}
+
+std::string SessionDaemon::handle(std::string_view request, std::shared_ptr<Session>& session)
+{
+    size_t nl = request.find('\n');
+    std::string_view command = request.substr(0, nl);
+    std::string_view rest = nl == std::string_view::npos ? std::string_view() : request.substr(nl + 1);
+    std::vector<std::string_view> fields;
+
+    if (command == "ATTACH")
+    {
+        if (!DaemonProtocol::split(rest, 6, fields))
+            return "ERR\nMalformed request.";
+
+        std::string error;
+        session = attach(fields, error);
+        if (!session)
+            return "ERR\n" + error;
+        return "OK\n" + std::to_string(session->id) + "\n" + session->ring.name();
+    }
+
+    if (command == "LIST")
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string out = "OK";
+        for (const auto& [id, s] : sessions)
+            out += "\n" + std::to_string(id) + "\t" + s->name;
+        return out;
+    }
+
+    if (command == "RESUME")
+    {
+        uint64_t id = 0;
+        if (!parseNumber(rest, id))
+            return "ERR\nMalformed request.";
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = sessions.find(id);
+        if (it == sessions.end())
+            return "ERR\nNo such session.";
+        session = it->second;
+        return "OK\n" + std::to_string(session->id) + "\n" + session->ring.name();
+    }
+
+    if (!session)
+        return "ERR\nNot attached.";
+    ClientConnect& client = session->client;
+
+    if (command == "SEND")
+    {
+        client.sendMessage(std::string(rest));
+        return "OK";
+    }
+
+    if (command == "READ")
+    {
+        uint64_t from = 0, count = 0;
+        if (!DaemonProtocol::split(rest, 2, fields) || !parseNumber(fields[0], from) || !parseNumber(fields[1], count))
+            return "ERR\nMalformed request.";
+
+        std::string out = "OK\n";
+        uint64_t end = std::min<uint64_t>(from + std::min<uint64_t>(count, 1024), client.messageCount());
+        for (uint64_t i = from; i < end && out.size() < DaemonProtocol::maxFrame / 2; i++)
+            DaemonProtocol::appendBlob(out, client.messageAt(i));
+        return out;
+    }
+
+    if (command == "SEARCH")
+    {
+        uint64_t limit = 0;
+        if (!DaemonProtocol::split(rest, 2, fields) || !parseNumber(fields[0], limit))
+            return "ERR\nMalformed request.";
+
+        std::string out = "OK";
+        for (size_t index : client.searchMessages(std::string(fields[1]), limit))
+            out += "\n" + std::to_string(index);
+        return out;
+    }
+
+    if (command == "MUTE" || command == "UNMUTE")
+    {
+        if (command == "MUTE")
+            client.muteSender(std::string(rest));
+        else
+            client.unmuteSender(std::string(rest));
+        return "OK";
+    }
+
+    if (command == "MUTED")
+    {
+        std::string out = "OK";
+        for (const auto& name : client.mutedSenders())
+            out += "\n" + name;
+        return out;
+    }
+
+    if (command == "ERROR")
+        return "OK\n" + client.connectError();
+
+    if (command == "PACE")
+    {
+        uint64_t rate = 0, burst = 0;
+        if (!DaemonProtocol::split(rest, 2, fields) || !parseNumber(fields[0], rate) || !parseNumber(fields[1], burst))
+            return "ERR\nMalformed request.";
+
+        client.setSendRate(static_cast<unsigned>(std::min<uint64_t>(rate, 1000)), static_cast<unsigned>(std::min<uint64_t>(burst, 1000)));
+        return "OK";
+    }
+
+    if (command == "CLOSE")
+    {
+        // Other frontends of this session see it disconnect through the ring
+        client.disconnect();
+        session->ring.setStatus(statusOf(client));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sessions.erase(session->id);
+        }
+        // Tearing the connection down may wait on its threads, not under the lock
+        session.reset();
+        return "OK";
+    }
+
+    return "ERR\nUnknown command.";
+}
+
+std::shared_ptr<SessionDaemon::Session> SessionDaemon::attach(const std::vector<std::string_view>& fields, std::string& error)
+{
+    std::string host(fields[0]), port(fields[1]), user(fields[2]);
+    std::string chatPassword(fields[4]), serverPassword(fields[5]);
+    uint64_t flags = 0;
+    if (!parseNumber(fields[3], flags))
+    {
+        error = "Malformed request.";
+        return nullptr;
+    }
+
+    std::string name = user + "@" + host + ":" + port;
+    std::string secret = FreiaEncryption::hashHex(chatPassword + "\n" + serverPassword);
+
+    auto findExisting = [&]() -> std::shared_ptr<Session> {
+        // Caller holds the mutex
+        for (auto& [id, s] : sessions)
+        {
+            if (s->name != name)
+                continue;
+            if (s->secret != secret)
+            {
+                error = "A session for " + name + " exists with other passwords.";
+                return nullptr;
+            }
+
+            // Re-attaching to a dropped session reconnects it, no KDF needed
+            if (!s->client.isConnectedToServer() && s->client.connectState() != ChatSession::ConnectState::Connecting)
+                s->client.connectToServer();
+            return s;
+        }
+        return nullptr;
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto existing = findExisting(); existing || !error.empty())
+            return existing;
+    }
+
+    // The key derivation is slow, keep the other frontends running meanwhile
+    auto session = std::make_shared<Session>();
+    session->name = name;
+    session->secret = secret;
+    session->client.setPersistHistory(flags & DaemonProtocol::persistHistory);
+    session->client.setLazyDecrypt(flags & DaemonProtocol::lazyDecrypt);
+    session->client.setTlsTransport(flags & DaemonProtocol::tlsTransport);
+    session->client.setDatagramTransport(flags & DaemonProtocol::datagramTransport);
+    session->client.setMultiplexing(flags & DaemonProtocol::multiplexStreams);
+    session->client.setNumberedSenders(flags & DaemonProtocol::numberedSenders);
+    session->client.setLowLatency(flags & DaemonProtocol::lowLatency,
+                                  static_cast<int>((flags >> DaemonProtocol::pinnedCpuShift) & 0xffff) - 1);
+    session->client.setClusterRouting(flags & DaemonProtocol::clusterRouting);
+    session->client.setStripedTransfers(flags & DaemonProtocol::stripedTransfers);
+    if (!session->client.configure(host.c_str(), port.c_str(), user.c_str(), chatPassword.c_str(), serverPassword.c_str()))
+    {
+        error = "Configuration rejected.";
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto existing = findExisting(); existing || !error.empty())
+        return existing;
+
+    session->id = nextId++;
+    std::string ringName = "/freia-thiwi-" + std::to_string(getuid()) + "-" + std::to_string(getpid()) +
+                           "-" + std::to_string(session->id);
+    if (!session->ring.create(ringName, ringCapacity))
+    {
+        error = "Could not create the message ring.";
+        return nullptr;
+    }
+
+    Session* raw = session.get();
+    session->client.setMessageListener([raw](size_t index, const std::string& text) {
+        // Sealed messages never reach shared memory decrypted, frontends READ them
+        std::lock_guard<std::mutex> ringLock(raw->ringMutex);
+        if (MessageStore::isSealed(text))
+            raw->ring.announce(index, raw->client.messageCount());
+        else
+            raw->ring.publish(index, text, raw->client.messageCount());
+    });
+
+    session->client.connectToServer();
+    session->ring.setCount(session->client.messageCount());
+    session->ring.setStatus(statusOf(session->client));
+    sessions.emplace(session->id, session);
+    return session;
+}
+
+void SessionDaemon::publishStatus()
+{
+    // The count also moves without new messages, e.g. when a journal was loaded
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& [id, s] : sessions)
+    {
+        std::lock_guard<std::mutex> ringLock(s->ringMutex);
+        s->ring.setCount(s->client.messageCount());
+        s->ring.setStatus(statusOf(s->client));
+    }
+}
+
+uint32_t SessionDaemon::statusOf(ClientConnect& client)
+{
+    // ConnectState in the low byte, the live connection flag above it and the
+    // number of paced messages still waiting in the top half
+    uint32_t queued = static_cast<uint32_t>(std::min<size_t>(client.queuedMessages(), 0xffff));
+    return static_cast<uint32_t>(client.connectState()) | (client.isConnectedToServer() ? 0x100u : 0u) | (queued << 16);
+}
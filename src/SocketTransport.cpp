@@ -0,0 +1,133 @@
+#include "SocketTransport.h"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static void handleSystemCallError(const std::string& errorMsg)
+{
+    std::cerr << errorMsg << ", errno: " << errno << "\n";
+}
+
+static constexpr int connectTimeoutMs = 3000;
+static constexpr int cancelCheckMs = 100;       // how soon a cancelled attempt ends
+
+// Connects without blocking, with a 3 second limit on the attempt; the
+// connected socket blocks without a timeout
+static std::unique_ptr<SocketTransport> connectSocket(int domain, const sockaddr* address, socklen_t addressLen,
+                                                      const std::atomic<bool>* cancel)
+{
+    int sock = socket(domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        handleSystemCallError("Failed to create socket");
+        return nullptr;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(connectTimeoutMs);
+    int error = connect(sock, address, addressLen) == -1 ? errno : 0;
+    while (error == EINPROGRESS || error == EINTR || error == EAGAIN)
+    {
+        int remaining = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count());
+        if (cancel && *cancel)
+            error = ECANCELED;
+        else if (remaining <= 0)
+            error = ETIMEDOUT;
+        else if (error == EAGAIN)
+        {
+            // A UNIX socket whose listener's backlog is full, try again shortly
+            poll(nullptr, 0, std::min(remaining, cancelCheckMs));
+            error = connect(sock, address, addressLen) == -1 ? errno : 0;
+        }
+        else
+        {
+            pollfd pfd{sock, POLLOUT, 0};
+            if (poll(&pfd, 1, std::min(remaining, cancelCheckMs)) <= 0)
+                continue;
+            socklen_t errorLen = sizeof(error);
+            if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1)
+                error = errno;
+        }
+    }
+
+    if (error != 0)
+    {
+        errno = error;
+        if (error != ECANCELED)
+            handleSystemCallError("Connection failed");
+        close(sock);
+        return nullptr;
+    }
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+    return std::make_unique<SocketTransport>(sock);
+}
+
+std::unique_ptr<SocketTransport> SocketTransport::connectTcp(const std::string& address, int port,
+                                                             const std::atomic<bool>* cancel)
+{
+    sockaddr_in serverAddress{};
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, address.c_str(), &serverAddress.sin_addr) <= 0)
+    {
+        handleSystemCallError("Invalid IP address or unsupported format");
+        return nullptr;
+    }
+    return connectSocket(AF_INET, reinterpret_cast<const sockaddr*>(&serverAddress), sizeof(serverAddress), cancel);
+}
+
+std::unique_ptr<SocketTransport> SocketTransport::connectUnix(const std::string& path, const std::atomic<bool>* cancel)
+{
+    sockaddr_un serverAddress{};
+    serverAddress.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(serverAddress.sun_path))
+    {
+        std::cerr << "Invalid UNIX socket path " << path << "\n";
+        return nullptr;
+    }
+    std::memcpy(serverAddress.sun_path, path.data(), path.size());
+    return connectSocket(AF_UNIX, reinterpret_cast<const sockaddr*>(&serverAddress), sizeof(serverAddress), cancel);
+}
+
+SocketTransport::~SocketTransport()
+{
+    if (sock != -1)
+        close(sock);
+}
+
+ssize_t SocketTransport::read(void* buffer, size_t len)
+{
+    // A blocking socket hands over the whole request in one call when it can
+    return recv(sock, buffer, len, MSG_WAITALL);
+}
+
+ssize_t SocketTransport::write(const void* data, size_t len)
+{
+    return send(sock, data, len, MSG_NOSIGNAL);
+}
+
+bool SocketTransport::wait(short events, int timeoutMs)
+{
+    pollfd pfd{sock, events, 0};
+    int rc;
+    do
+        rc = poll(&pfd, 1, timeoutMs);
+    while (rc < 0 && errno == EINTR);
+    return rc > 0;
+}
+
+void SocketTransport::shutdown()
+{
+    ::shutdown(sock, SHUT_RDWR);
+}
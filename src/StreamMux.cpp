@@ -0,0 +1,326 @@
+#include "StreamMux.h"
+#include <algorithm>
+#include <cstring>
+#include <arpa/inet.h>
+
+std::string StreamMux::makeFrame(uint32_t stream, uint8_t flags, std::string_view payload)
+{
+    uint32_t netStream = htonl(stream);
+    std::string frame(reinterpret_cast<const char*>(&netStream), sizeof(netStream));
+    frame += static_cast<char>(flags);
+    frame.append(payload);
+    return frame;
+}
+
+bool StreamMux::openStream(uint32_t stream, unsigned weight)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stream == sessionStream)
+        return false;
+    auto [it, inserted] = outbound.try_emplace(stream);
+    it->second.weight = std::max(1u, weight);
+    if (inserted)
+        it->second.credit = window;
+    return inserted;
+}
+
+bool StreamMux::setStreamRate(uint32_t stream, double bytesPerSecond, double burstBytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = outbound.find(stream);
+    if (it == outbound.end())
+        return false;
+
+    // A burst below one chunk would cut every chunk short
+    it->second.pace.configure(bytesPerSecond, std::max<double>(burstBytes, chunkSize));
+    wake.notify_one();
+    return true;
+}
+
+void StreamMux::closeStream(uint32_t stream)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = outbound.find(stream);
+    if (stream == chatStream || it == outbound.end())
+        return;
+
+    Outbound& closing = it->second;
+    if (closing.offset > 0 && multiChunk(closing.queue.front()))
+        started -= closing.queue.front().size();
+    outbound.erase(it);
+}
+
+bool StreamMux::enqueue(uint32_t stream, std::string message)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = outbound.find(stream);
+    if (it == outbound.end() || message.empty() || message.size() > window ||
+        it->second.queuedBytes + message.size() > maxQueued)
+        return false;
+
+    it->second.queuedBytes += message.size();
+    it->second.queue.push_back(std::move(message));
+    wake.notify_one();
+    return true;
+}
+
+void StreamMux::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    wake.notify_all();
+}
+
+void StreamMux::interrupt()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    interrupted = true;
+    wake.notify_all();
+}
+
+bool StreamMux::bulkWaiting()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [id, stream] : outbound)
+    {
+        if (id != chatStream && stream.queuedBytes > 0)
+            return true;
+    }
+    return false;
+}
+
+void StreamMux::reset(uint32_t streamWindow, uint32_t sessionLimit)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    window = streamWindow;
+    sessionWindow = sessionLimit;
+    sessionCredit = sessionLimit;
+    sessionConsumed = 0;
+    for (auto& [id, stream] : outbound)
+    {
+        Outbound fresh;
+        fresh.weight = stream.weight;
+        fresh.pace = stream.pace;
+        fresh.credit = streamWindow;
+        stream = std::move(fresh);
+    }
+    inbound.clear();
+    control.clear();
+    started = 0;
+    reassembling = 0;
+    cursor = 0;
+    turnStarted = false;
+    stopping = false;
+    interrupted = false;
+}
+
+bool StreamMux::nextFrame(std::string& frame, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto deadline = Clock::now() + timeout;
+    while (!stopping)
+    {
+        if (interrupted)
+        {
+            interrupted = false;
+            return false;
+        }
+
+        // Credit updates unblock the peer, they never wait behind data
+        if (!control.empty())
+        {
+            frame = std::move(control.front());
+            control.pop_front();
+            return true;
+        }
+
+        Clock::time_point now = Clock::now();
+        nextRefill = Clock::time_point::max();
+        if (pickChunk(frame, now))
+            return true;
+
+        // A paced stream may be able to go again before anything else happens
+        if (now >= deadline)
+            return false;
+        wake.wait_until(lock, std::min(deadline, nextRefill));
+    }
+    return false;
+}
+
+size_t StreamMux::sendable(uint32_t id, Outbound& stream, Clock::time_point now)
+{
+    bool bounded = sessionWindow > 0 && id != chatStream;
+    if (stream.queue.empty() || stream.credit <= 0 || (bounded && sessionCredit <= static_cast<int64_t>(headerSize)))
+        return 0;
+
+    // The peer holds the start of a long message until its end arrives
+    const std::string& message = stream.queue.front();
+    if (stream.offset == 0 && multiChunk(message) && started + message.size() > maxReassembly)
+        return 0;
+
+    size_t remaining = message.size() - stream.offset;
+    size_t chunk = std::min({chunkSize, remaining, static_cast<size_t>(stream.credit)});
+    if (bounded)
+        chunk = std::min(chunk, static_cast<size_t>(sessionCredit) - headerSize);
+
+    Clock::duration wait = stream.pace.delayFor(static_cast<double>(chunk), now);
+    if (wait > Clock::duration::zero())
+    {
+        nextRefill = std::min(nextRefill, now + wait);
+        return 0;
+    }
+    return chunk;
+}
+
+bool StreamMux::pickChunk(std::string& frame, Clock::time_point now)
+{
+    // Deficit round robin: a stream's turn adds weight * chunkSize to its
+    // deficit and lasts until the deficit no longer covers the next chunk
+    for (size_t visited = 0; visited <= outbound.size() && !outbound.empty(); ++visited)
+    {
+        auto it = outbound.lower_bound(cursor);
+        if (it == outbound.end())
+            it = outbound.begin();
+        if (it->first != cursor)
+        {
+            cursor = it->first;
+            turnStarted = false;
+        }
+
+        Outbound& stream = it->second;
+        size_t chunk = sendable(it->first, stream, now);
+        if (chunk > 0)
+        {
+            if (!turnStarted)
+            {
+                stream.deficit += stream.weight * chunkSize;
+                turnStarted = true;
+            }
+
+            if (stream.deficit >= chunk)
+            {
+                const std::string& message = stream.queue.front();
+                bool last = stream.offset + chunk == message.size();
+                frame = makeFrame(it->first, last ? endFlag : 0,
+                                  std::string_view(message).substr(stream.offset, chunk));
+
+                if (stream.offset == 0 && multiChunk(message))
+                    started += message.size();
+                stream.deficit -= chunk;
+                stream.credit -= chunk;
+                if (sessionWindow > 0 && it->first != chatStream)
+                    sessionCredit -= headerSize + chunk;
+                stream.pace.tryTake(static_cast<double>(chunk), now);
+                stream.offset += chunk;
+                if (last)
+                {
+                    if (multiChunk(message))
+                        started -= message.size();
+                    stream.queuedBytes -= message.size();
+                    stream.queue.pop_front();
+                    stream.offset = 0;
+                }
+                return true;
+            }
+        }
+        else
+        {
+            // Idle or blocked streams do not save up for later
+            stream.deficit = 0;
+        }
+
+        ++it;
+        cursor = it == outbound.end() ? outbound.begin()->first : it->first;
+        turnStarted = false;
+    }
+    return false;
+}
+
+bool StreamMux::receive(std::string_view frame, std::vector<Delivery>& delivered)
+{
+    if (frame.size() < headerSize)
+        return false;
+
+    uint32_t stream;
+    std::memcpy(&stream, frame.data(), sizeof(stream));
+    stream = ntohl(stream);
+    uint8_t flags = static_cast<uint8_t>(frame[4]);
+    std::string_view payload = frame.substr(headerSize);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (flags & creditFlag)
+    {
+        if (payload.size() != sizeof(uint32_t))
+            return false;
+
+        uint32_t bytes;
+        std::memcpy(&bytes, payload.data(), sizeof(bytes));
+        if (stream == sessionStream)
+        {
+            sessionCredit = std::min<int64_t>(sessionCredit + ntohl(bytes), sessionWindow);
+            wake.notify_one();
+            return true;
+        }
+
+        auto it = outbound.find(stream);
+        if (it != outbound.end())
+        {
+            it->second.credit = std::min<int64_t>(it->second.credit + ntohl(bytes), window);
+            wake.notify_one();
+        }
+        return true;
+    }
+
+    if (stream == sessionStream)
+        return false;
+
+    auto it = inbound.find(stream);
+    if (it == inbound.end())
+    {
+        if (inbound.size() >= maxInbound)
+            return false;
+        it = inbound.emplace(stream, Inbound{}).first;
+    }
+
+    Inbound& in = it->second;
+    bool last = (flags & endFlag) != 0;
+    if (in.partial.size() + payload.size() > window ||
+        (!last && reassembling + payload.size() > maxReassembly))
+        return false;
+    in.partial.append(payload);
+
+    if (last)
+    {
+        reassembling -= in.partial.size() - payload.size();
+        in.consumed += in.partial.size();
+        delivered.push_back(Delivery{stream, std::move(in.partial)});
+        in.partial.clear();
+    }
+    else
+        reassembling += payload.size();
+
+    // The session window only covers frames on their way here
+    if (sessionWindow > 0 && stream != chatStream)
+    {
+        sessionConsumed += static_cast<uint32_t>(frame.size());
+        if (sessionConsumed >= sessionWindow / 2)
+        {
+            uint32_t netBytes = htonl(sessionConsumed);
+            control.push_back(makeFrame(sessionStream, creditFlag, std::string_view(reinterpret_cast<const char*>(&netBytes), sizeof(netBytes))));
+            sessionConsumed = 0;
+            wake.notify_one();
+        }
+    }
+
+    // Credit comes back once a message is delivered, in batches of half a
+    // window, and right away when the peer is partway through the next one
+    // and may be waiting for it
+    if (in.consumed > 0 && (in.consumed >= window / 2 || !in.partial.empty()))
+    {
+        uint32_t netBytes = htonl(in.consumed);
+        control.push_back(makeFrame(stream, creditFlag, std::string_view(reinterpret_cast<const char*>(&netBytes), sizeof(netBytes))));
+        in.consumed = 0;
+        wake.notify_one();
+    }
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,484 @@
+#include "StripeSet.h"
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <openssl/rand.h>
+
+static constexpr std::string_view laneHello = "LANE1\n";
+static constexpr std::string_view stripeAnnouncement = "STRP1\n";
+
+static std::string packet(const std::string& payload)
+{
+    uint32_t netLen = htonl(static_cast<uint32_t>(payload.size()));
+    std::string out(reinterpret_cast<const char*>(&netLen), sizeof(netLen));
+    out += payload;
+    return out;
+}
+
+static bool writeAll(Transport& transport, const std::string& data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = transport.write(data.data() + sent, data.size() - sent);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN && transport.wait(POLLOUT, -1))
+            continue;
+        if (n <= 0)
+            return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// eof is set when the peer closed before the first byte
+static bool readAll(Transport& transport, void* buffer, size_t len, bool& eof)
+{
+    char* out = static_cast<char*>(buffer);
+    size_t got = 0;
+    eof = false;
+    while (got < len)
+    {
+        ssize_t n = transport.read(out + got, len - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN && transport.wait(POLLIN, -1))
+            continue;
+        if (n <= 0)
+        {
+            eof = n == 0 && got == 0;
+            return false;
+        }
+        got += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+StripeSet::~StripeSet()
+{
+    stop();
+    join();
+}
+
+void StripeSet::start(Callbacks newCallbacks)
+{
+    callbacks = std::move(newCallbacks);
+
+    unsigned char bytes[16];
+    if (RAND_bytes(bytes, sizeof(bytes)) != 1)
+        std::memset(bytes, 0, sizeof(bytes));
+    static constexpr char digits[] = "0123456789abcdef";
+    token.clear();
+    for (unsigned char byte : bytes)
+    {
+        token += digits[byte >> 4];
+        token += digits[byte & 0x0f];
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.clear();
+        openLanes = 0;
+        stopping = false;
+    }
+    cancelConnect = false;
+    {
+        std::lock_guard<std::mutex> lock(receiveMutex);
+        early.clear();
+        earlyBytes = 0;
+        nextIn = 0;
+    }
+    nextOut = 0;
+    sentBytes = 0;
+    measuredRate = 0;
+    baseRate = 0;
+    trialLane = false;
+    hold = 0;
+    failing = false;
+
+    controller = std::thread(&StripeSet::control, this);
+}
+
+void StripeSet::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    cancelConnect = true;
+    for (const std::unique_ptr<Lane>& lane : lanes)
+        lane->transport->shutdown();
+    queue.clear();
+    openLanes = 0;
+    queueReady.notify_all();
+    controlWake.notify_all();
+}
+
+void StripeSet::join()
+{
+    if (controller.joinable())
+        controller.join();
+    reap(true);
+}
+
+std::string StripeSet::announcement() const
+{
+    return std::string(stripeAnnouncement) + token + "\n";
+}
+
+bool StripeSet::carries(std::string_view muxFrame)
+{
+    if (muxFrame.size() < StreamMux::headerSize)
+        return false;
+
+    uint32_t stream;
+    std::memcpy(&stream, muxFrame.data(), sizeof(stream));
+    uint8_t flags = static_cast<uint8_t>(muxFrame[4]);
+    return ntohl(stream) != StreamMux::chatStream && !(flags & StreamMux::creditFlag);
+}
+
+bool StripeSet::onStripeStream(std::string_view muxFrame)
+{
+    if (muxFrame.size() < StreamMux::headerSize)
+        return false;
+
+    uint32_t stream;
+    std::memcpy(&stream, muxFrame.data(), sizeof(stream));
+    return ntohl(stream) == stripeStream;
+}
+
+bool StripeSet::send(std::string muxFrame)
+{
+    uint64_t seq = htobe64(nextOut++);
+    std::string frame(reinterpret_cast<const char*>(&seq), sizeof(seq));
+    frame += muxFrame;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (openLanes > 0 && !stopping)
+        {
+            queue.push_back(std::move(frame));
+            queueReady.notify_one();
+            return true;
+        }
+    }
+    return sendOnPrimary(frame);
+}
+
+bool StripeSet::sendOnPrimary(const std::string& stripeFrame)
+{
+    uint32_t netStream = htonl(stripeStream);
+    std::string frame(reinterpret_cast<const char*>(&netStream), sizeof(netStream));
+    frame += static_cast<char>(0);
+    frame += stripeFrame;
+    return callbacks.sendPrimary(frame);
+}
+
+bool StripeSet::receive(std::string_view frame)
+{
+    if (frame.size() < seqSize + StreamMux::headerSize)
+        return false;
+
+    uint64_t seq;
+    std::memcpy(&seq, frame.data(), sizeof(seq));
+    seq = be64toh(seq);
+    std::string_view muxFrame = frame.substr(seqSize);
+
+    std::lock_guard<std::mutex> lock(receiveMutex);
+    if (seq < nextIn || early.count(seq))
+        return true;
+
+    // Ahead of a chunk still on another lane
+    if (seq > nextIn)
+    {
+        if (earlyBytes + muxFrame.size() > reorderWindow)
+            return false;
+        earlyBytes += muxFrame.size();
+        early.emplace(seq, std::string(muxFrame));
+        return true;
+    }
+
+    if (!callbacks.deliver(muxFrame))
+        return false;
+    ++nextIn;
+
+    // It may have been the one the others were waiting for
+    for (auto it = early.begin(); it != early.end() && it->first == nextIn; it = early.erase(it))
+    {
+        if (!callbacks.deliver(it->second))
+            return false;
+        earlyBytes -= it->second.size();
+        ++nextIn;
+    }
+    return true;
+}
+
+size_t StripeSet::laneCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return openLanes;
+}
+
+void StripeSet::control()
+{
+    for (size_t i = 0; i < initialLanes; i++)
+    {
+        if (!openLane())
+        {
+            hold = holdIntervals;
+            break;
+        }
+    }
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            controlWake.wait_for(lock, adaptInterval, [this] { return stopping; });
+            if (stopping)
+                return;
+        }
+
+        reap(false);
+        bool saturated = callbacks.backlogged();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            saturated = saturated || !queue.empty();
+        }
+        adapt(saturated, sentBytes.exchange(0));
+    }
+}
+
+void StripeSet::adapt(bool saturated, uint64_t bytes)
+{
+    // Lanes that could not be opened are tried again now and then, the
+    // session's connection carries everything meanwhile
+    if (laneCount() == 0)
+    {
+        trialLane = false;
+        if (hold > 0)
+            --hold;
+        else if (!openLane())
+            hold = holdIntervals;
+        return;
+    }
+
+    // With nothing waiting, the rate is what the streams asked for and says
+    // nothing about the lanes
+    if (!saturated || bytes == 0)
+    {
+        trialLane = false;
+        return;
+    }
+
+    double rate = bytes / std::chrono::duration<double>(adaptInterval).count();
+    measuredRate = rate;
+
+    if (trialLane)
+    {
+        trialLane = false;
+        if (rate < baseRate * (1 + minGain))
+        {
+            retireNewest();
+            hold = holdIntervals;
+            return;
+        }
+    }
+
+    if (hold > 0)
+    {
+        --hold;
+        return;
+    }
+
+    if (laneCount() < maxLanes)
+    {
+        baseRate = rate;
+        trialLane = openLane();
+        if (!trialLane)
+            hold = holdIntervals;
+    }
+}
+
+bool StripeSet::openLane()
+{
+    std::unique_ptr<Transport> transport = callbacks.connect(cancelConnect);
+    if (!transport)
+        return false;
+
+    std::string hello = callbacks.seal(std::string(laneHello) + token + "\n");
+    if (hello.empty() || !writeAll(*transport, packet(hello)))
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping)
+        return false;
+
+    auto lane = std::make_unique<Lane>();
+    lane->transport = std::move(transport);
+    lane->reader = std::thread(&StripeSet::readLane, this, lane.get());
+    lane->writer = std::thread(&StripeSet::writeLane, this, lane.get());
+    lanes.push_back(std::move(lane));
+    ++openLanes;
+    return true;
+}
+
+std::deque<std::string> StripeSet::retire(Lane* lane)
+{
+    // Under mutex. With the last lane gone, what it would have sent goes to
+    // the session's connection.
+    std::deque<std::string> stranded;
+    if (lane->retiring || stopping)
+        return stranded;
+
+    lane->retiring = true;
+    --openLanes;
+    if (openLanes == 0)
+        stranded.swap(queue);
+    queueReady.notify_all();
+    return stranded;
+}
+
+void StripeSet::sendStranded(std::deque<std::string> frames)
+{
+    for (const std::string& frame : frames)
+    {
+        if (!sendOnPrimary(frame))
+        {
+            failed("[Error] Striped data could not be sent.");
+            return;
+        }
+    }
+}
+
+void StripeSet::retireNewest()
+{
+    std::deque<std::string> stranded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = lanes.rbegin(); it != lanes.rend(); ++it)
+        {
+            if (!(*it)->retiring)
+            {
+                stranded = retire(it->get());
+                break;
+            }
+        }
+    }
+    sendStranded(std::move(stranded));
+}
+
+void StripeSet::reap(bool all)
+{
+    std::vector<std::unique_ptr<Lane>> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = lanes.begin(); it != lanes.end();)
+        {
+            if (all || ((*it)->finished && (*it)->writerDone))
+            {
+                done.push_back(std::move(*it));
+                it = lanes.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+    for (const std::unique_ptr<Lane>& lane : done)
+    {
+        lane->reader.join();
+        lane->writer.join();
+    }
+}
+
+void StripeSet::writeLane(Lane* lane)
+{
+    std::string frame;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queueReady.wait(lock, [&] { return !queue.empty() || lane->retiring || stopping; });
+            if (lane->retiring || stopping)
+                break;
+            frame = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        // Written is not delivered, a chunk in a broken lane is lost
+        std::string payload = callbacks.seal(frame);
+        if (payload.empty() || !writeAll(*lane->transport, packet(payload)))
+        {
+            failed("[Disconnected from server: a striping lane failed]");
+            break;
+        }
+        sentBytes += frame.size();
+    }
+
+    // Our half is done, the peer answers with its own once it read the rest
+    if (lane->transport->fd() != -1)
+        ::shutdown(lane->transport->fd(), SHUT_WR);
+    lane->writerDone = true;
+}
+
+void StripeSet::readLane(Lane* lane)
+{
+    std::vector<char> cipher;
+    while (true)
+    {
+        uint32_t netLen = 0;
+        bool eof = false;
+        if (!readAll(*lane->transport, &netLen, sizeof(netLen), eof))
+        {
+            if (!eof)
+                failed("[Disconnected from server: a striping lane failed]");
+            break;
+        }
+
+        // A stripe frame, plus IV and padding
+        uint32_t len = ntohl(netLen);
+        if (len == 0 || len > maxFrame + 32)
+        {
+            failed("[Error] Invalid message length received on a striping lane.");
+            break;
+        }
+
+        cipher.resize(len);
+        if (!readAll(*lane->transport, cipher.data(), len, eof))
+        {
+            failed("[Disconnected from server: a striping lane failed]");
+            break;
+        }
+
+        std::string plain = callbacks.open(cipher.data(), len);
+        if (plain.empty() || !receive(plain))
+        {
+            failed("[Protocol error] malformed stripe frame.");
+            break;
+        }
+    }
+
+    // The peer retired the lane, or it is gone: no more frames for it
+    std::deque<std::string> stranded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stranded = retire(lane);
+    }
+    sendStranded(std::move(stranded));
+    lane->finished = true;
+}
+
+void StripeSet::failed(const std::string& reason)
+{
+    bool ending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ending = stopping;
+    }
+    if (ending || failing.exchange(true))
+        return;
+    callbacks.fail(reason);
+}
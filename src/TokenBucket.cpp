@@ -0,0 +1,45 @@
+#include "TokenBucket.h"
+#include <algorithm>
+
+void TokenBucket::configure(double rate, double burst)
+{
+    ratePerSecond = std::max(0.0, rate);
+    capacity = std::max(1.0, burst);
+    tokens = capacity;
+    last = Clock::now();
+}
+
+void TokenBucket::refill(Clock::time_point now)
+{
+    if (now <= last)
+        return;
+
+    std::chrono::duration<double> elapsed = now - last;
+    tokens = std::min(capacity, tokens + elapsed.count() * ratePerSecond);
+    last = now;
+}
+
+TokenBucket::Clock::duration TokenBucket::delayFor(double cost, Clock::time_point now)
+{
+    if (!limited())
+        return Clock::duration::zero();
+
+    refill(now);
+    double missing = std::min(cost, capacity) - tokens;
+    if (missing <= 0)
+        return Clock::duration::zero();
+
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(missing / ratePerSecond));
+}
+
+bool TokenBucket::tryTake(double cost, Clock::time_point now)
+{
+    if (!limited())
+        return true;
+
+    if (delayFor(cost, now) > Clock::duration::zero())
+        return false;
+
+    tokens -= cost;
+    return true;
+}
@@ -24,6 +24,92 @@ bool Validation::isValidIP(const std::string& ip)
     return true;
 }
 
+bool Validation::isUnixSocketAddress(const std::string& host)
+{
+    // "unix:/path/to/socket", a server on this machine; sun_path holds 107 characters
+    return host.rfind("unix:/", 0) == 0 && host.size() - 5 < 108;
+}
+
+bool Validation::isValidHost(const std::string& host)
+{
+    // Dotted IPv4, an RFC 1123 host name, or a UNIX socket
+    if (isValidIP(host) || isUnixSocketAddress(host))
+        return true;
+    if (host.empty() || host.size() > 253)
+        return false;
+
+    size_t labelStart = 0;
+    while (labelStart <= host.size())
+    {
+        size_t labelEnd = host.find('.', labelStart);
+        if (labelEnd == std::string::npos)
+            labelEnd = host.size();
+
+        size_t len = labelEnd - labelStart;
+        if (len == 0 || len > 63)
+            return false;
+        if (host[labelStart] == '-' || host[labelEnd - 1] == '-')
+            return false;
+
+        bool hasLetter = false;
+        for (size_t i = labelStart; i < labelEnd; i++)
+        {
+            if (isalpha(host[i]))
+                hasLetter = true;
+            else if (!isdigit(host[i]) && host[i] != '-')
+                return false;
+        }
+
+        // The top-level label is never all digits, so "1.2.3" is not a host name
+        if (labelEnd == host.size())
+            return hasLetter;
+        labelStart = labelEnd + 1;
+    }
+    return false;
+}
+
+std::vector<Validation::ServerAddress> Validation::parseServerList(const std::string& list)
+{
+    std::vector<ServerAddress> servers;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+
+        std::string entry = list.substr(start, end - start);
+        size_t first = entry.find_first_not_of(" \t");
+        size_t last = entry.find_last_not_of(" \t");
+        entry = first == std::string::npos ? "" : entry.substr(first, last - first + 1);
+
+        ServerAddress server;
+        size_t colon = entry.rfind(':');
+        if (!isUnixSocketAddress(entry) && colon != std::string::npos)
+        {
+            std::string port = entry.substr(colon + 1);
+            if (port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos)
+                return {};
+            server.port = std::atoi(port.c_str());
+            if (server.port < 1 || server.port > 65535)
+                return {};
+            entry.resize(colon);
+        }
+        if (!isValidHost(entry))
+            return {};
+
+        server.host = entry;
+        servers.push_back(server);
+        start = end + 1;
+    }
+    return servers;
+}
+
+bool Validation::isValidServerList(const std::string& list)
+{
+    return !parseServerList(list).empty();
+}
+
 bool Validation::isValidPort(const std::string& portStr)
 {
     if (portStr.empty())
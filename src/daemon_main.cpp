@@ -0,0 +1,26 @@
+#include "SessionDaemon.h"
+#include "DaemonProtocol.h"
+#include <csignal>
+
+static SessionDaemon* running = nullptr;
+
+static void onSignal(int)
+{
+    if (running)
+        running->stop();
+}
+
+int main()
+{
+    SessionDaemon daemon;
+    if (!daemon.listen(DaemonProtocol::socketPath()))
+        return 1;
+
+    running = &daemon;
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    daemon.run();
+    return 0;
+}
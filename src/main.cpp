@@ -1,13 +1,21 @@
 #include "FreiaUI.h"
 #include "ClientConnect.h"
+#include "DaemonClient.h"
+#include <csignal>
 
 int main()
 {
-    
+    // A TLS peer that hangs up must not kill the UI mid-write
+    std::signal(SIGPIPE, SIG_IGN);
+
     FreiaUI ui;
     ClientConnect client;
 
-    ui.setClient(&client);
+    // Pick up a session the daemon kept running, no reconnect or KDF needed
+    if (DaemonClient* resumed = DaemonClient::resume())
+        ui.setClient(resumed);
+    else
+        ui.setClient(&client);
 
     while (ui.render()) {}
     return 0;
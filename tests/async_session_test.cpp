@@ -0,0 +1,173 @@
+// AsyncSession: many sessions on one EventLoop against the stand-in server.
+// Every session joins, waits for the others, then sends one message and reads
+// until it has everyone's, its own echo included, so every connect, send and
+// receive runs interleaved on the loop's one thread.
+//
+//   freia-thiwi-async-session-test path/to/freia-thiwi-standin
+#include "AsyncSession.h"
+#include "EventLoop.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <csignal>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static constexpr int sessions = 32;
+
+static int check(bool ok, const std::string& what)
+{
+    if (ok)
+        return 0;
+    std::cerr << "FAIL: " << what << "\n";
+    return 1;
+}
+
+// A port nobody listens on right now, for the stand-in to take
+static int freePort()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(address);
+    int port = 0;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), len) == 0 &&
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &len) == 0)
+        port = ntohs(address.sin_port);
+    close(fd);
+    return port;
+}
+
+static bool listening(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bool ok = connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    close(fd);
+    return ok;
+}
+
+struct Result
+{
+    bool connected = false;
+    bool sent = false;
+    std::set<std::string> texts;
+};
+
+static Task<void> chat(EventLoop& loop, int index, const std::string& port, const FreiaEncryption::Key& chatKey,
+                       const FreiaEncryption::Key& serverKey, int& joined, Result& result)
+{
+    AsyncSession session(loop);
+    std::string user = "user" + std::to_string(index);
+    if (!session.configure("127.0.0.1", port.c_str(), user.c_str(), chatKey, serverKey))
+        co_return;
+    result.connected = co_await session.connect();
+    if (!result.connected || !co_await session.send("join"))
+        co_return;
+
+    // The stand-in relays to a client only once it has taken it on, which the
+    // echo of our own first message proves
+    std::optional<AsyncSession::Message> message;
+    while ((message = co_await session.next()) && !(message->sender == user && message->text == "join"))
+        ;
+    if (!message)
+        co_return;
+
+    // Nobody says hello before everyone is there to hear it
+    joined++;
+    while (joined < sessions)
+        co_await loop.sleep(std::chrono::milliseconds(5));
+
+    result.sent = co_await session.send("hello from " + user);
+    while (result.texts.size() < static_cast<size_t>(sessions) && (message = co_await session.next()) &&
+           !message->sender.empty())
+    {
+        if (message->text != "join")
+            result.texts.insert(message->sender + ": " + message->text);
+    }
+    session.close();
+}
+
+static Task<void> deadline(EventLoop& loop, bool& timedOut)
+{
+    co_await loop.sleep(std::chrono::seconds(20));
+    timedOut = true;
+    loop.stop();
+}
+
+// The deadline keeps run() going, so this stops it once every session is done
+static Task<void> finish(EventLoop& loop, const std::vector<Result>& results)
+{
+    while (true)
+    {
+        co_await loop.sleep(std::chrono::milliseconds(10));
+        size_t done = 0;
+        for (const Result& result : results)
+            done += result.texts.size() == results.size();
+        if (done == results.size())
+            break;
+    }
+    loop.stop();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " path/to/freia-thiwi-standin\n";
+        return 2;
+    }
+
+    int port = freePort();
+    std::string portText = std::to_string(port);
+    pid_t server = fork();
+    if (server == 0)
+    {
+        execl(argv[1], argv[1], "--port", portText.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    for (int i = 0; i < 500 && !listening(port); i++)
+        usleep(10000);
+
+    // One key derivation shared by every session
+    FreiaEncryption::Key chatKey = FreiaEncryption::deriveKey("chatpw123");
+    FreiaEncryption::Key serverKey = FreiaEncryption::deriveKey("serverpw1");
+
+    EventLoop loop;
+    std::vector<Result> results(sessions);
+    int joined = 0;
+    bool timedOut = false;
+    for (int i = 0; i < sessions; i++)
+        loop.spawn(chat(loop, i, portText, chatKey, serverKey, joined, results[i]));
+    loop.spawn(deadline(loop, timedOut));
+
+    loop.spawn(finish(loop, results));
+    loop.run();
+
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+
+    int failures = check(!timedOut, "finished in time");
+    std::set<std::string> expected;
+    for (int i = 0; i < sessions; i++)
+        expected.insert("user" + std::to_string(i) + ": hello from user" + std::to_string(i));
+    for (int i = 0; i < sessions; i++)
+    {
+        std::string who = "session " + std::to_string(i);
+        failures += check(results[i].connected, who + " connected");
+        failures += check(results[i].sent, who + " sent");
+        failures += check(results[i].texts == expected, who + " got every message");
+    }
+
+    if (failures == 0)
+        std::cout << "ok: " << sessions << " sessions on one loop\n";
+    return failures == 0 ? 0 : 1;
+}
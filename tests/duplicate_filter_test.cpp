@@ -0,0 +1,78 @@
+// DuplicateFilter: repeats within the window are caught, also after the
+// exact table has overflowed; new IDs get through; the window expires; the
+// message ID depends on the sender and the IV only.
+#include "DuplicateFilter.h"
+#include <iostream>
+#include <string>
+
+using namespace std::chrono_literals;
+
+static int check(bool ok, const std::string& what)
+{
+    if (ok)
+        return 0;
+    std::cerr << "FAIL: " << what << "\n";
+    return 1;
+}
+
+static uint64_t id(uint64_t n)
+{
+    return DuplicateFilter::messageId("sender", std::string(8, 'x') + std::string(reinterpret_cast<const char*>(&n), 8));
+}
+
+int main()
+{
+    int failures = 0;
+
+    std::string iv(DuplicateFilter::ivSize, 'i');
+    failures += check(DuplicateFilter::messageId("alice", iv + "body") == DuplicateFilter::messageId("alice", iv + "other"),
+                      "only the IV counts");
+    failures += check(DuplicateFilter::messageId("alice", iv) != DuplicateFilter::messageId("bob", iv), "the sender counts");
+
+    {
+        DuplicateFilter filter(10min);
+        DuplicateFilter::Clock::time_point now = DuplicateFilter::Clock::now();
+        failures += check(!filter.seen(id(1), now), "first sight");
+        failures += check(filter.seen(id(1), now + 1s), "repeat caught");
+        failures += check(filter.seen(id(1), now + 6min), "still caught in the next generation");
+        failures += check(!filter.seen(id(1), now + 25min), "forgotten after the window");
+    }
+
+    {
+        // Well past the 8192 IDs the exact table holds
+        DuplicateFilter filter(10min);
+        DuplicateFilter::Clock::time_point now = DuplicateFilter::Clock::now();
+        size_t wronglyDropped = 0;
+        for (uint64_t n = 0; n < 20000; n++)
+            wronglyDropped += filter.seen(id(n), now);
+        failures += check(wronglyDropped < 200, "new IDs get through");
+
+        size_t caught = 0;
+        for (uint64_t n = 0; n < 1000; n++)
+            caught += filter.seen(id(n), now + 1s);
+        failures += check(caught == 1000, "early repeats caught after the table overflowed");
+    }
+
+    {
+        // Below the table's size a false positive never drops a message
+        DuplicateFilter filter(10min);
+        DuplicateFilter::Clock::time_point now = DuplicateFilter::Clock::now();
+        for (uint64_t n = 0; n < 1000; n++)
+            filter.seen(id(n), now);
+        size_t wronglyDropped = 0;
+        for (uint64_t n = 1000; n < 1500; n++)
+            wronglyDropped += filter.seen(id(n), now);
+        failures += check(wronglyDropped == 0, "no false drops while the table holds everything");
+    }
+
+    {
+        DuplicateFilter filter;
+        filter.seen(id(7));
+        filter.clear();
+        failures += check(!filter.seen(id(7)), "clear forgets");
+    }
+
+    if (failures == 0)
+        std::cout << "ok: duplicate filter\n";
+    return failures == 0 ? 0 : 1;
+}
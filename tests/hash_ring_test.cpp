@@ -0,0 +1,99 @@
+// HashRing: every client puts a key on the same node, a route names every
+// node once, the load is spread evenly, and adding or removing a node only
+// moves the keys it takes or gives up.
+#include "HashRing.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static constexpr size_t keys = 20000;
+
+static int check(bool ok, const std::string& what)
+{
+    if (ok)
+        return 0;
+    std::cerr << "FAIL: " << what << "\n";
+    return 1;
+}
+
+static uint64_t key(size_t i)
+{
+    return HashRing::position("chat " + std::to_string(i));
+}
+
+static std::vector<std::string> names(size_t count)
+{
+    std::vector<std::string> out;
+    for (size_t i = 0; i < count; i++)
+        out.push_back("node" + std::to_string(i) + ".example:7000");
+    return out;
+}
+
+int main()
+{
+    int failures = 0;
+
+    // The first 64 bits of SHA-256("abc"), the same for every client
+    failures += check(HashRing::position("abc") == 0xba7816bf8f01cfeaULL, "positions are SHA-256 based");
+    failures += check(HashRing().route(key(0)).empty(), "an empty ring routes nowhere");
+
+    HashRing four(names(4));
+    HashRing again(names(4));
+    std::vector<size_t> load(4, 0);
+    bool sameRoutes = true;
+    bool everyNodeOnce = true;
+    for (size_t i = 0; i < keys; i++)
+    {
+        std::vector<size_t> route = four.route(key(i));
+        sameRoutes = sameRoutes && route == again.route(key(i));
+        std::vector<size_t> sorted = route;
+        std::sort(sorted.begin(), sorted.end());
+        everyNodeOnce = everyNodeOnce && sorted == std::vector<size_t>{0, 1, 2, 3};
+        load[route.front()]++;
+    }
+    failures += check(sameRoutes, "the same nodes give the same routes");
+    failures += check(everyNodeOnce, "a route names every node once");
+    for (size_t node = 0; node < load.size(); node++)
+        failures += check(load[node] > keys / 4 / 2 && load[node] < keys / 4 * 3 / 2,
+                          "node " + std::to_string(node) + " owns about a quarter of the keys");
+
+    {
+        // A fifth node takes about a fifth of the keys, all from the others
+        HashRing five(names(5));
+        size_t moved = 0;
+        bool onlyToNew = true;
+        for (size_t i = 0; i < keys; i++)
+        {
+            size_t before = four.route(key(i)).front();
+            size_t after = five.route(key(i)).front();
+            if (before != after)
+            {
+                moved++;
+                onlyToNew = onlyToNew && after == 4;
+            }
+        }
+        failures += check(onlyToNew, "keys only move to the added node");
+        failures += check(moved > keys / 5 / 2 && moved < keys / 5 * 3 / 2, "about a fifth of the keys move");
+    }
+
+    {
+        // Without node 3 its keys go to where their routes went next, the
+        // rest stay put
+        std::vector<std::string> three = names(4);
+        three.pop_back();
+        HashRing smaller(three);
+        bool stable = true;
+        for (size_t i = 0; i < keys; i++)
+        {
+            std::vector<size_t> route = four.route(key(i));
+            size_t expected = route[0] != 3 ? route[0] : route[1];
+            stable = stable && smaller.route(key(i)).front() == expected;
+        }
+        failures += check(stable, "removing a node only moves its own keys, to their next node");
+    }
+
+    if (failures == 0)
+        std::cout << "ok: hash ring over " << keys << " keys\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+// ClientConnect over a MemoryTransport whose reads and writes come back short,
+// split frames anywhere and fail with EINTR, on both ends. A relay on the
+// other end sends every chat frame back under another name; each message has
+// to come back intact and in order.
+#include "ClientConnect.h"
+#include "MemoryTransport.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <arpa/inet.h>
+
+static const char* serverPassword = "serverpw1";
+static constexpr int messages = 200;
+static constexpr std::chrono::seconds giveUp{60};
+
+static bool readAll(Transport& transport, void* buffer, size_t len)
+{
+    char* out = static_cast<char*>(buffer);
+    while (len > 0)
+    {
+        ssize_t n = transport.read(out, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        out += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool writeAll(Transport& transport, const std::string& data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = transport.write(data.data() + sent, data.size() - sent);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+// "PROT1\n<user>\n..." comes back from bob, so it is not our own echo
+static void relay(Transport& transport, const FreiaEncryption::Key& key)
+{
+    while (true)
+    {
+        uint32_t netLen = 0;
+        if (!readAll(transport, &netLen, sizeof(netLen)))
+            return;
+        std::string cipher(ntohl(netLen), '\0');
+        if (!readAll(transport, cipher.data(), cipher.size()))
+            return;
+
+        std::string frame = FreiaEncryption::decryptData(cipher, key);
+        size_t userStart = frame.find('\n');
+        size_t userEnd = frame.find('\n', userStart + 1);
+        if (userEnd == std::string::npos)
+            return;
+        frame = frame.substr(0, userStart + 1) + "bob" + frame.substr(userEnd);
+
+        std::string payload = FreiaEncryption::encryptData(frame, key);
+        netLen = htonl(static_cast<uint32_t>(payload.size()));
+        if (!writeAll(transport, std::string(reinterpret_cast<const char*>(&netLen), sizeof(netLen)) + payload))
+            return;
+    }
+}
+
+static std::string message(int i)
+{
+    return "message " + std::to_string(i) + " " + std::string(static_cast<size_t>(i * 37 % 3000), 'a' + i % 26);
+}
+
+int main()
+{
+    std::signal(SIGPIPE, SIG_IGN);
+
+    MemoryTransport::LinkOptions link;
+    link.latency = std::chrono::milliseconds(20);
+    link.bytesPerSecond = 1000000;
+    auto [client, server] = MemoryTransport::pair(link);
+
+    // Headers and bodies split over several calls, now and then an EINTR
+    client->setReadScript({2, 0, 5000, 1, 3});
+    client->setWriteScript({1, 0, 100, 7});
+    server->setReadScript({1, 3, 7, 0, 4096});
+    server->setWriteScript({13, 0, 64, 2});
+
+    MemoryTransport* serverEnd = server.get();
+    FreiaEncryption::Key key = FreiaEncryption::deriveKey(serverPassword);
+    std::thread relayThread([&] { relay(*serverEnd, key); });
+
+    ClientConnect session;
+    session.setPersistHistory(false);
+    session.setSendRate(0, 1);
+    if (!session.configure("127.0.0.1", "1", "alice", "chatpw123", serverPassword))
+    {
+        std::cerr << "FAIL: configure\n";
+        return 1;
+    }
+
+    std::atomic<int> received{0};
+    std::atomic<int> wrong{0};
+    session.setMessageListener([&](size_t, const std::string& line) {
+        if (line.rfind("bob: ", 0) != 0)
+            return;
+        if (line != "bob: " + message(received))
+            wrong++;
+        received++;
+    });
+
+    int failures = 0;
+    if (!session.connectTransport(std::move(client)))
+    {
+        std::cerr << "FAIL: connectTransport\n";
+        failures++;
+    }
+
+    for (int i = 0; i < messages && failures == 0; i++)
+        session.sendMessage(message(i));
+
+    auto start = std::chrono::steady_clock::now();
+    while (failures == 0 && received < messages && std::chrono::steady_clock::now() - start < giveUp)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    if (received != messages)
+    {
+        std::cerr << "FAIL: " << received << " of " << messages << " messages came back\n";
+        failures++;
+    }
+    if (wrong > 0)
+    {
+        std::cerr << "FAIL: " << wrong << " messages came back changed or out of order\n";
+        failures++;
+    }
+    if (!session.isConnectedToServer())
+    {
+        std::cerr << "FAIL: session dropped\n";
+        failures++;
+    }
+
+    session.disconnect();
+    relayThread.join();
+
+    if (failures == 0)
+        std::cout << "ok: " << messages << " messages over split reads and writes\n";
+    return failures == 0 ? 0 : 1;
+}
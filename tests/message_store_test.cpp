@@ -0,0 +1,116 @@
+// MessageStore over a persistent MessageJournal: messages survive a reopen,
+// are read back past the memory limit, and retention drops whole old
+// segments without renumbering what is left.
+#include "MessageStore.h"
+#include "MessageJournal.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+
+static constexpr size_t messages = 20000;       // a few sealed segments and an active one
+
+static std::string message(size_t i)
+{
+    return "message " + std::to_string(i) + " " + std::string(i % 200, 'a' + i % 26);
+}
+
+static int check(bool ok, const std::string& what)
+{
+    if (ok)
+        return 0;
+    std::cerr << "FAIL: " << what << "\n";
+    return 1;
+}
+
+int main()
+{
+    char dir[] = "/tmp/freia-store-test-XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        std::cerr << "FAIL: no temporary directory\n";
+        return 1;
+    }
+    std::string base = std::string(dir) + "/history";
+    FreiaEncryption::Key key = FreiaEncryption::deriveKey("chatpw123");
+    int failures = 0;
+
+    {
+        MessageStore store;
+        store.setMemoryLimit(64 * 1024);
+        store.setDiskLimit(UINT64_MAX);
+        failures += check(store.open(base, key), "open");
+        for (size_t i = 0; i < messages; i++)
+            store.append(message(i));
+
+        failures += check(store.size() == messages, "size after appends");
+        failures += check(store.at(0) == message(0), "oldest message read back past the memory limit");
+        failures += check(store.at(messages / 2) == message(messages / 2), "middle message read back");
+        failures += check(store.at(messages - 1) == message(messages - 1), "newest message");
+        failures += check(store.at(messages).empty(), "nothing past the end");
+    }
+
+    {
+        MessageStore store;
+        store.setMemoryLimit(16 * 1024 * 1024);     // room to index it all
+        store.setDiskLimit(UINT64_MAX);
+        failures += check(store.open(base, key), "reopen");
+        failures += check(store.size() == messages, "size after reopen");
+        failures += check(store.at(123) == message(123), "message from an earlier run");
+
+        // Nothing from the earlier run is indexed until the first search asks
+        failures += check(!store.isPreloading(), "no history decrypted before a search");
+        store.search("message", 1);
+        while (store.isPreloading())
+            usleep(1000);
+        std::vector<size_t> hits = store.search("message 123", 200);
+        failures += check(std::find(hits.begin(), hits.end(), 123) != hits.end(), "search finds a message from an earlier run");
+
+        // Retention drops the oldest segments and keeps indexes relative to what is left
+        store.setDiskLimit(256 * 1024);
+        size_t left = store.size();
+        failures += check(left < messages && left > 0, "retention dropped old messages");
+        failures += check(store.at(left - 1) == message(messages - 1), "newest message kept");
+        failures += check(store.at(0) == message(messages - left), "oldest kept message is where it was");
+    }
+
+    {
+        // A small limit keeps the index to the newest messages
+        MessageStore store;
+        store.setMemoryLimit(64 * 1024);
+        failures += check(store.open(base, key), "reopen with a small limit");
+        store.search("message", 1);
+        while (store.isPreloading())
+            usleep(1000);
+        size_t newest = store.size() - 1;
+        std::vector<size_t> hits = store.search("message " + std::to_string(messages - 1), 10);
+        failures += check(std::find(hits.begin(), hits.end(), newest) != hits.end(), "newest message found with a small limit");
+        failures += check(store.search("message " + std::to_string(messages - store.size()), 10).empty(),
+                          "oldest message left out of a small index");
+    }
+
+    {
+        MessageStore store;
+        failures += check(!store.open(base, FreiaEncryption::deriveKey("wrong")) || store.at(0) != message(0),
+                          "a wrong key reads nothing back");
+    }
+
+    {
+        // The journal alone: a sealed segment stays readable through reopening
+        MessageJournal journal;
+        failures += check(journal.openTemp(key), "temporary journal");
+        for (size_t i = 0; i < 10000; i++)
+            journal.append(message(i));
+        std::string text;
+        failures += check(journal.read(5, text) && text == message(5), "journal read from a sealed segment");
+        failures += check(journal.read(9999, text) && text == message(9999), "journal read from the active segment");
+        failures += check(!journal.sealedSegments().empty(), "journal sealed a segment");
+    }
+
+    std::system(("rm -rf " + std::string(dir)).c_str());
+    if (failures == 0)
+        std::cout << "ok: " << messages << " messages through reopen and retention\n";
+    return failures == 0 ? 0 : 1;
+}
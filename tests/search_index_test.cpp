@@ -0,0 +1,63 @@
+// SearchIndex: words and prefixes, several terms, the newest hits first to
+// go over the limit, out of order and repeated input, retention, and the
+// byte limit dropping the oldest messages.
+#include "SearchIndex.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+static int check(bool ok, const std::string& what)
+{
+    if (ok)
+        return 0;
+    std::cerr << "FAIL: " << what << "\n";
+    return 1;
+}
+
+int main()
+{
+    int failures = 0;
+
+    std::vector<std::string> words = SearchIndex::tokenize("Hello, W\xc3\xb6rld! x2--y");
+    failures += check(words == std::vector<std::string>{"hello", "w\xc3\xb6rld", "x2", "y"}, "tokenize");
+
+    {
+        SearchIndex index;
+        index.add(1, "the quick brown fox");
+        index.add(2, "a quick reply");
+        index.add(3, "Brown bread");
+        index.add(0, "quicksand");          // a background batch, older
+        index.add(2, "a quick reply");      // a batch overlapping live ones
+
+        failures += check(index.find("quick", 10) == std::vector<uint64_t>{0, 1, 2}, "prefix query, oldest first, no repeats");
+        failures += check(index.find("QUICK brown", 10) == std::vector<uint64_t>{1}, "every term has to match");
+        failures += check(index.find("br", 10) == std::vector<uint64_t>{1, 3}, "short prefix");
+        failures += check(index.find("quick", 2) == std::vector<uint64_t>{1, 2}, "only the newest hits past the limit");
+        failures += check(index.find("missing", 10).empty(), "no hits");
+        failures += check(index.find("  ,, ", 10).empty(), "empty query");
+
+        index.prune(2);
+        failures += check(index.find("quick", 10) == std::vector<uint64_t>{2}, "pruned messages are gone");
+        index.add(1, "quick again");
+        failures += check(index.find("quick", 10) == std::vector<uint64_t>{2}, "nothing older than the pruned point comes back");
+    }
+
+    {
+        SearchIndex index;
+        index.setLimit(64 * 1024);
+        for (uint64_t seq = 0; seq < 20000; seq++)
+            index.add(seq, "message " + std::to_string(seq) + " common");
+
+        failures += check(index.size() <= 64 * 1024, "index stays within its limit");
+        failures += check(index.coveredFrom() > 0, "oldest messages were dropped");
+        failures += check(index.find("19999", 10) == std::vector<uint64_t>{19999}, "newest message still found");
+        failures += check(index.find("0", 10).empty() || index.find("0", 10).front() >= index.coveredFrom(),
+                          "nothing below the covered range");
+        index.add(0, "late arrival");
+        failures += check(index.find("late", 10).empty(), "messages below the covered range are not taken");
+    }
+
+    if (failures == 0)
+        std::cout << "ok: search index\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+// SenderTable: LEB128 varints round trip and reject what does not fit,
+// bindings map wire IDs to interned names and mute state, and looked up
+// names stay valid however many senders are bound later.
+#include "SenderTable.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+static int check(bool ok, const std::string& what)
+{
+    if (ok)
+        return 0;
+    std::cerr << "FAIL: " << what << "\n";
+    return 1;
+}
+
+int main()
+{
+    int failures = 0;
+
+    {
+        std::vector<uint64_t> values = {0, 1, 127, 128, 300, 16383, 16384, UINT32_MAX, UINT64_MAX};
+        std::string wire;
+        for (uint64_t v : values)
+            SenderTable::writeVarint(wire, v);
+
+        std::string_view in(wire);
+        bool same = true;
+        for (uint64_t v : values)
+        {
+            uint64_t got = 0;
+            same = same && SenderTable::readVarint(in, got) && got == v;
+        }
+        failures += check(same && in.empty(), "varints round trip");
+
+        std::string one;
+        SenderTable::writeVarint(one, 300);
+        failures += check(one == "\xac\x02", "LEB128 layout");
+        SenderTable::writeVarint(one = "", UINT64_MAX);
+        failures += check(one.size() == 10, "64 bits take ten bytes");
+
+        uint64_t value = 0;
+        std::string_view truncated("\x80\x80", 2);
+        failures += check(!SenderTable::readVarint(truncated, value) && truncated.size() == 2, "truncated varint refused");
+        std::string overlong(9, '\xff');
+        overlong += '\x02';
+        std::string_view tooBig(overlong);
+        failures += check(!SenderTable::readVarint(tooBig, value), "varint over 64 bits refused");
+    }
+
+    {
+        SenderTable table;
+        std::string_view name;
+        bool muted = false;
+        failures += check(table.bind(3, "alice", false) && table.bind(7, "bob", true), "bind");
+        failures += check(table.lookup(3, name, muted) && name == "alice" && !muted, "lookup");
+        failures += check(table.lookup(7, name, muted) && name == "bob" && muted, "muted sender");
+        failures += check(!table.lookup(4, name, muted), "unbound id");
+        failures += check(!table.bind(SenderTable::maxSenders, "carol", false), "id out of range refused");
+        failures += check(!table.bind(5, "two\nlines", false), "name with a newline refused");
+
+        table.setMuted("alice", true);
+        failures += check(table.lookup(3, name, muted) && muted, "mute by name");
+        table.resetBindings();
+        failures += check(!table.lookup(3, name, muted), "bindings end with the connection");
+        failures += check(table.bind(9, "alice", false) && table.lookup(9, name, muted) && name == "alice",
+                          "rebound on the next connection");
+    }
+
+    {
+        // Filling the table never moves a name handed out earlier
+        SenderTable table;
+        std::string_view first;
+        bool muted = false;
+        table.bind(0, "first", false);
+        table.lookup(0, first, muted);
+        bool bound = true;
+        for (size_t i = 1; i < SenderTable::maxSenders; i++)
+            bound = bound && table.bind(i % 1000, "user" + std::to_string(i), false);
+        failures += check(bound, "bound up to the cap");
+        failures += check(!table.bind(1, "oneTooMany", false), "new names past the cap refused");
+        failures += check(table.bind(2, "user5", false), "known names still bind past the cap");
+        failures += check(first == "first", "earlier lookup still valid");
+    }
+
+    if (failures == 0)
+        std::cout << "ok: sender table\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+// StreamMux framing between two ends: messages are cut into chunks and put
+// back together, chat is not held up by a bulk transfer, credit comes back
+// as messages are delivered, a session window bounds the bulk data of all
+// streams in flight, and frames the peer should not have sent are refused.
+#include "StreamMux.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+
+static int check(bool ok, const std::string& what)
+{
+    if (ok)
+        return 0;
+    std::cerr << "FAIL: " << what << "\n";
+    return 1;
+}
+
+static std::string frame(uint32_t stream, uint8_t flags, const std::string& payload)
+{
+    uint32_t netStream = htonl(stream);
+    std::string out(reinterpret_cast<const char*>(&netStream), sizeof(netStream));
+    out += static_cast<char>(flags);
+    return out + payload;
+}
+
+// Moves frames both ways until neither end has anything left to send
+static bool pump(StreamMux& a, StreamMux& b, std::vector<StreamMux::Delivery>& delivered)
+{
+    std::vector<StreamMux::Delivery> ignored;
+    std::string next;
+    bool moved = true;
+    while (moved)
+    {
+        moved = false;
+        while (a.nextFrame(next, std::chrono::milliseconds(0)))
+        {
+            if (!b.receive(next, delivered))
+                return false;
+            moved = true;
+        }
+        while (b.nextFrame(next, std::chrono::milliseconds(0)))
+        {
+            if (!a.receive(next, ignored))
+                return false;
+            moved = true;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    int failures = 0;
+
+    {
+        StreamMux a, b;
+        a.openStream(2, 1);
+        std::string bulk(StreamMux::initialCredit, 'b');
+        for (size_t i = 0; i < bulk.size(); i++)
+            bulk[i] = static_cast<char>('a' + i % 26);
+
+        failures += check(a.enqueue(2, bulk), "bulk message up to a window");
+        failures += check(a.enqueue(StreamMux::chatStream, "hello"), "chat message");
+        failures += check(!a.enqueue(2, std::string(StreamMux::initialCredit + 1, 'x')), "message over a window refused");
+        failures += check(!a.enqueue(3, "x"), "unknown stream refused");
+        failures += check(!a.enqueue(2, ""), "empty message refused");
+
+        // Chat goes out within the first chunks, not after the transfer
+        std::string first;
+        std::vector<StreamMux::Delivery> delivered;
+        for (int i = 0; i < 2 && a.nextFrame(first, std::chrono::milliseconds(0)); i++)
+            failures += check(b.receive(first, delivered), "chunk accepted");
+        bool chatFirst = !delivered.empty() && delivered.front().stream == StreamMux::chatStream;
+        failures += check(chatFirst, "chat not held up by the bulk stream");
+
+        failures += check(pump(a, b, delivered), "frames accepted");
+        failures += check(delivered.size() == 2 && delivered.back().stream == 2 && delivered.back().message == bulk,
+                          "bulk message put back together");
+
+        // The window came back with the delivery, the next one goes out too
+        failures += check(a.enqueue(2, bulk), "second window queued");
+        delivered.clear();
+        failures += check(pump(a, b, delivered) && delivered.size() == 1 && delivered[0].message == bulk,
+                          "credit returned on delivery");
+    }
+
+    {
+        // Messages of 0.4 and 0.9 windows: the credit for the first has to
+        // come back while the second is still arriving
+        StreamMux a, b;
+        a.openStream(2, 1);
+        std::string small(StreamMux::initialCredit * 4 / 10, 's');
+        std::string large(StreamMux::initialCredit * 9 / 10, 'l');
+        a.enqueue(2, small);
+        a.enqueue(2, large);
+        std::vector<StreamMux::Delivery> delivered;
+        failures += check(pump(a, b, delivered) && delivered.size() == 2 && delivered[1].message == large,
+                          "no stall across messages of one stream");
+    }
+
+    {
+        // Without credit coming back the sender stops at one window
+        StreamMux a, b;
+        a.openStream(2, 1);
+        a.enqueue(2, std::string(StreamMux::initialCredit, 'x'));
+        a.enqueue(2, std::string(StreamMux::initialCredit, 'y'));
+        std::string next;
+        size_t sent = 0;
+        std::vector<StreamMux::Delivery> delivered;
+        while (a.nextFrame(next, std::chrono::milliseconds(0)))
+        {
+            sent += next.size() - StreamMux::headerSize;
+            b.receive(next, delivered);
+        }
+        failures += check(sent == StreamMux::initialCredit, "sender stops at the window");
+        failures += check(b.nextFrame(next, std::chrono::milliseconds(0)), "receiver owes credit");
+        failures += check(a.receive(next, delivered), "credit frame accepted");
+        failures += check(a.nextFrame(next, std::chrono::milliseconds(0)), "sender goes on after credit");
+    }
+
+    {
+        // With a session window the streams together stop there, chat does
+        // not, and the window comes back as frames are taken in
+        uint32_t window = 64 * 1024;
+        uint32_t session = 4 * StreamMux::chunkSize;
+        StreamMux a, b;
+        a.reset(window, session);
+        b.reset(window, session);
+        a.openStream(2, 1);
+        a.openStream(3, 1);
+        a.enqueue(2, std::string(window, 'x'));
+        a.enqueue(3, std::string(window, 'y'));
+        std::string next;
+        std::vector<std::string> held;
+        size_t bulk = 0;
+        while (a.nextFrame(next, std::chrono::milliseconds(0)))
+        {
+            bulk += next.size();
+            held.push_back(next);
+        }
+        failures += check(bulk <= session && bulk + StreamMux::chunkSize > session, "streams stop at the session window");
+        failures += check(a.enqueue(StreamMux::chatStream, "chat") && a.nextFrame(next, std::chrono::milliseconds(0)),
+                          "chat goes past the session window");
+
+        std::vector<StreamMux::Delivery> delivered;
+        for (const std::string& frame : held)
+            b.receive(frame, delivered);
+        failures += check(b.nextFrame(next, std::chrono::milliseconds(0)) && a.receive(next, delivered),
+                          "session credit returned once frames are taken in");
+        failures += check(a.nextFrame(next, std::chrono::milliseconds(0)), "streams go on after session credit");
+
+        delivered.clear();
+        failures += check(pump(a, b, delivered) && delivered.size() == 2, "both streams complete within the session window");
+        failures += check(!a.openStream(StreamMux::sessionStream, 1), "session stream is not a data stream");
+        failures += check(!b.receive(frame(StreamMux::sessionStream, 0, "x"), delivered), "data on the session stream refused");
+    }
+
+    {
+        // Frames the peer should not have sent
+        StreamMux b;
+        std::vector<StreamMux::Delivery> delivered;
+        failures += check(!b.receive(std::string(3, '\0'), delivered), "short frame refused");
+        failures += check(!b.receive(frame(2, StreamMux::creditFlag, "ab"), delivered), "bad credit frame refused");
+        failures += check(!b.receive(frame(2, 0, std::string(StreamMux::initialCredit + 1, 'x')), delivered),
+                          "message over a window refused");
+
+        // Unfinished messages over all streams stop at maxReassembly, which
+        // takes a few large windows to reach
+        uint32_t window = StreamMux::maxReassembly / 4;
+        b.reset(window);
+        std::string chunk(StreamMux::chunkSize, 'p');
+        size_t held = 0;
+        bool refused = false;
+        for (uint32_t stream = 2; stream < 2 + StreamMux::maxInbound && !refused; stream++)
+        {
+            for (size_t i = 0; i + 1 < window / StreamMux::chunkSize; i++)
+            {
+                if (!b.receive(frame(stream, 0, chunk), delivered))
+                {
+                    refused = true;
+                    break;
+                }
+                held += chunk.size();
+            }
+        }
+        failures += check(refused && held <= StreamMux::maxReassembly, "reassembly stops at its cap");
+        failures += check(b.receive(frame(StreamMux::chatStream, StreamMux::endFlag, "chat"), delivered) &&
+                          !delivered.empty() && delivered.back().message == "chat",
+                          "single-chunk messages still get through");
+    }
+
+    {
+        // The sender only starts long messages the peer has room to reassemble
+        StreamMux a, b;
+        uint32_t window = StreamMux::maxReassembly / 4;
+        a.reset(window);
+        b.reset(window);
+        std::vector<StreamMux::Delivery> delivered;
+        size_t streams = StreamMux::maxReassembly / window + 4;
+        for (uint32_t stream = 2; stream < 2 + streams; stream++)
+        {
+            a.openStream(stream, 1);
+            a.enqueue(stream, std::string(window, 'm'));
+        }
+        failures += check(pump(a, b, delivered), "sender stays within the peer's reassembly cap");
+        failures += check(delivered.size() == streams, "every long message delivered");
+    }
+
+    if (failures == 0)
+        std::cout << "ok: stream mux\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+// TokenBucket: a full bucket lets a burst through, then tokens flow in at
+// the rate; an oversized cost goes once the bucket is full and leaves it in
+// debt; rate 0 never limits.
+#include "TokenBucket.h"
+#include <iostream>
+#include <string>
+
+using namespace std::chrono_literals;
+
+static int check(bool ok, const std::string& what)
+{
+    if (ok)
+        return 0;
+    std::cerr << "FAIL: " << what << "\n";
+    return 1;
+}
+
+int main()
+{
+    int failures = 0;
+
+    {
+        TokenBucket off;
+        TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+        failures += check(!off.limited(), "default bucket is off");
+        bool all = true;
+        for (int i = 0; i < 1000; i++)
+            all = all && off.tryTake(1, now);
+        failures += check(all && off.delayFor(1e9, now) == TokenBucket::Clock::duration::zero(), "rate 0 never limits");
+    }
+
+    {
+        TokenBucket bucket(5, 10);
+        TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+        int taken = 0;
+        while (taken < 100 && bucket.tryTake(1, now))
+            taken++;
+        failures += check(taken == 10, "a full bucket lets the burst through");
+        failures += check(!bucket.tryTake(1, now), "empty after the burst");
+
+        auto wait = bucket.delayFor(1, now);
+        failures += check(wait > 150ms && wait <= 200ms, "one token takes 1/rate");
+        failures += check(!bucket.tryTake(1, now + 150ms), "not before the token is in");
+        failures += check(bucket.tryTake(1, now + 200ms), "taken once it is");
+
+        // Tokens never pile up beyond the burst
+        taken = 0;
+        while (taken < 100 && bucket.tryTake(1, now + 1h))
+            taken++;
+        failures += check(taken == 10, "refill stops at the burst");
+    }
+
+    {
+        // A cost above the burst waits for a full bucket, then leaves it in debt
+        TokenBucket bucket(10, 4);
+        TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+        failures += check(bucket.tryTake(8, now), "oversized cost goes on a full bucket");
+        failures += check(!bucket.tryTake(1, now + 100ms), "the bucket is in debt");
+        auto wait = bucket.delayFor(1, now + 100ms);
+        failures += check(wait > 350ms && wait <= 400ms, "debt is paid back at the rate");
+    }
+
+    {
+        TokenBucket bucket(5, 10);
+        TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+        while (bucket.tryTake(1, now))
+            ;
+        bucket.configure(0, 10);
+        failures += check(bucket.tryTake(1, now), "switching the rate off lifts the limit");
+    }
+
+    if (failures == 0)
+        std::cout << "ok: token bucket\n";
+    return failures == 0 ? 0 : 1;
+}
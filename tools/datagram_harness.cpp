@@ -0,0 +1,192 @@
+// Drives the datagram transport through a bad link on one machine. Two
+// DatagramLinks meet at a small UDP reflector that answers HELLOs and passes
+// every other datagram to the other link; both links drop and delay what they
+// receive through the fault injection hook. Messages of mixed sizes, some of
+// them many fragments long, go one way and are checked on arrival.
+//
+//   freia-thiwi-udp-harness [--loss 0.2] [--delay 50] [--messages 500]
+//
+// Exits 0 once every message arrived intact, exactly once.
+#include "DatagramLink.h"
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+
+static constexpr uint8_t helloType = 3;
+static constexpr std::chrono::seconds giveUp{120};
+
+static std::atomic<bool> stopping{false};
+
+static void reflect(int sock)
+{
+    std::vector<sockaddr_storage> peers;
+    char buffer[2048];
+    while (!stopping)
+    {
+        pollfd pfd{sock, POLLIN, 0};
+        if (poll(&pfd, 1, 50) <= 0)
+            continue;
+
+        sockaddr_storage from{};
+        socklen_t fromLen = sizeof(from);
+        ssize_t n = recvfrom(sock, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &fromLen);
+        if (n < 12)
+            continue;
+
+        auto known = std::find_if(peers.begin(), peers.end(),
+                                  [&](const sockaddr_storage& peer) { return std::memcmp(&peer, &from, fromLen) == 0; });
+        if (static_cast<uint8_t>(buffer[0]) == helloType)
+        {
+            sendto(sock, buffer, n, 0, reinterpret_cast<sockaddr*>(&from), fromLen);
+            if (known == peers.end() && peers.size() < 2)
+                peers.push_back(from);
+            continue;
+        }
+
+        if (peers.size() < 2 || known == peers.end())
+            continue;
+        const sockaddr_storage& other = peers[known == peers.begin() ? 1 : 0];
+        sendto(sock, buffer, n, 0, reinterpret_cast<const sockaddr*>(&other), fromLen);
+    }
+}
+
+// Sizes from one byte to about 50 KB; every seventh needs dozens of fragments
+static std::string makeMessage(int id)
+{
+    size_t len = id % 7 == 0 ? 1 + (id * 7919) % 50000 : 1 + (id * 31) % 900;
+    std::string message = std::to_string(id) + ":";
+    message.append(len, static_cast<char>('a' + id % 26));
+    return message;
+}
+
+int main(int argc, char** argv)
+{
+    double loss = 0.2;
+    int delayMs = 50;
+    int count = 500;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--loss" && i + 1 < argc)
+            loss = std::atof(argv[++i]);
+        else if (arg == "--delay" && i + 1 < argc)
+            delayMs = std::atoi(argv[++i]);
+        else if (arg == "--messages" && i + 1 < argc)
+            count = std::atoi(argv[++i]);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--loss 0.2] [--delay 50] [--messages 500]\n";
+            return 2;
+        }
+    }
+
+    // The reflector, on an ephemeral loopback port
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock == -1 || bind(sock, reinterpret_cast<sockaddr*>(&addr), addrLen) == -1 ||
+        getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &addrLen) == -1)
+    {
+        std::cerr << "Failed to bind the reflector, errno: " << errno << "\n";
+        return 1;
+    }
+    int port = ntohs(addr.sin_port);
+    std::thread reflector(reflect, sock);
+
+    DatagramLink sender;
+    DatagramLink receiver;
+    sender.setFaultInjection(loss, delayMs);
+    receiver.setFaultInjection(loss, delayMs);
+
+    const char* host = "127.0.0.1";
+    bool senderOpen = false;
+    std::thread opener([&] { senderOpen = sender.open(host, port, 5000); });
+    bool receiverOpen = receiver.open(host, port, 5000);
+    opener.join();
+
+    int failures = 0;
+    if (!senderOpen || !receiverOpen)
+    {
+        std::cerr << "Handshake failed: " << (senderOpen ? receiver.error() : sender.error()) << "\n";
+        failures++;
+    }
+
+    // The sender's own thread takes in the ACKs
+    std::atomic<bool> sent{false};
+    std::thread senderPoll([&] {
+        std::vector<std::string> ignored;
+        while (!sent && senderOpen && sender.poll(50, ignored)) {}
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count && senderOpen; i++)
+    {
+        while (!sender.send(makeMessage(i)))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::set<int> received;
+    int duplicates = 0;
+    int corrupt = 0;
+    int reordered = 0;
+    int newest = -1;
+    while (failures == 0 && static_cast<int>(received.size()) < count)
+    {
+        std::vector<std::string> messages;
+        if (!receiver.poll(50, messages))
+        {
+            std::cerr << "Receiving link died: " << receiver.error() << "\n";
+            failures++;
+            break;
+        }
+
+        for (const std::string& message : messages)
+        {
+            int id = std::atoi(message.c_str());
+            if (received.count(id))
+                duplicates++;
+            if (id < 0 || id >= count || message != makeMessage(id))
+                corrupt++;
+            if (id < newest)
+                reordered++;
+            newest = std::max(newest, id);
+            received.insert(id);
+        }
+
+        if (std::chrono::steady_clock::now() - start > giveUp)
+        {
+            std::cerr << "Gave up waiting\n";
+            failures++;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    sent = true;
+    senderPoll.join();
+    sender.close();
+    receiver.close();
+    stopping = true;
+    reflector.join();
+    close(sock);
+
+    std::cout << "loss " << loss << ", delay " << delayMs << " ms: " << received.size() << "/" << count
+              << " messages in " << seconds << " s, " << reordered << " out of order, "
+              << duplicates << " duplicates, " << corrupt << " corrupt\n";
+    return failures == 0 && duplicates == 0 && corrupt == 0 ? 0 : 1;
+}
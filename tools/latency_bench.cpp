@@ -0,0 +1,152 @@
+// One-way chat latency, default against low latency mode. Two sessions join
+// the same chat through a server, usually freia-thiwi-standin on this
+// machine; one sends messages carrying the time they were sent, the other
+// notes when each one shows up. Both run in this process, so they share a
+// clock.
+//
+//   freia-thiwi-standin --port 7000 &
+//   freia-thiwi-latency-bench [--host 127.0.0.1] [--port 7000]
+//                             [--messages 2000] [--gap-us 100] [--cpu -1]
+//
+// --cpu pins the receiving session's thread in low latency mode.
+#include "ClientConnect.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr std::chrono::seconds connectTimeout{10};
+static constexpr std::chrono::seconds drainTimeout{5};
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    std::string port = "7000";
+    int messages = 2000;
+    int gapUs = 100;
+    int cpu = -1;
+};
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+static bool connect(ClientConnect& session, const Options& options, const char* user, bool lowLatency, int cpu)
+{
+    session.setPersistHistory(false);
+    session.setSendRate(0, 1);
+    session.setLowLatency(lowLatency, cpu);
+    if (!session.configure(options.host.c_str(), options.port.c_str(), user, "latency-bench-chat", "latency-bench-server"))
+        return false;
+
+    session.connectToServer();
+    Clock::time_point deadline = Clock::now() + connectTimeout;
+    while (session.connectState() == ChatSession::ConnectState::Connecting && Clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    return session.isConnectedToServer();
+}
+
+static void report(const char* name, std::vector<double>& micros, int sent)
+{
+    std::sort(micros.begin(), micros.end());
+    auto at = [&](double q) { return micros.empty() ? 0.0 : micros[std::min(micros.size() - 1, static_cast<size_t>(q * micros.size()))]; };
+
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(1)
+              << " n " << std::setw(5) << micros.size() << "/" << sent
+              << "  p50 " << std::setw(7) << at(0.5)
+              << "  p90 " << std::setw(7) << at(0.9)
+              << "  p99 " << std::setw(7) << at(0.99)
+              << "  max " << std::setw(8) << (micros.empty() ? 0.0 : micros.back()) << " us\n";
+}
+
+static bool run(const char* name, const Options& options, bool lowLatency)
+{
+    ClientConnect sender;
+    ClientConnect receiver;
+
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::vector<double> micros;
+    receiver.setMessageListener([&](size_t, const std::string& line) {
+        int64_t now = nowNs();
+        if (line.rfind("bench-send: ", 0) != 0)
+            return;
+        int64_t sentAt = std::atoll(line.c_str() + 12);
+        std::lock_guard<std::mutex> lock(mutex);
+        micros.push_back((now - sentAt) / 1000.0);
+        arrived.notify_all();
+    });
+
+    if (!connect(receiver, options, "bench-recv", lowLatency, options.cpu) ||
+        !connect(sender, options, "bench-send", lowLatency, -1))
+    {
+        std::cerr << "Could not connect to " << options.host << ":" << options.port << ": "
+                  << receiver.connectError() << sender.connectError() << "\n";
+        return false;
+    }
+
+    // Both sessions settle before the clock starts
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    for (int i = 0; i < options.messages; i++)
+    {
+        Clock::time_point next = Clock::now() + std::chrono::microseconds(options.gapUs);
+        sender.sendMessage(std::to_string(nowNs()));
+        while (Clock::now() < next)
+            std::this_thread::yield();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        arrived.wait_for(lock, drainTimeout, [&] { return static_cast<int>(micros.size()) >= options.messages; });
+    }
+
+    sender.disconnect();
+    receiver.disconnect();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    report(name, micros, options.messages);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc)
+            options.host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc)
+            options.port = argv[++i];
+        else if (arg == "--messages" && i + 1 < argc)
+            options.messages = std::atoi(argv[++i]);
+        else if (arg == "--gap-us" && i + 1 < argc)
+            options.gapUs = std::atoi(argv[++i]);
+        else if (arg == "--cpu" && i + 1 < argc)
+            options.cpu = std::atoi(argv[++i]);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--host 127.0.0.1] [--port 7000] [--messages 2000]"
+                      << " [--gap-us 100] [--cpu -1]\n";
+            return 2;
+        }
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::cout << options.messages << " messages, one every " << options.gapUs << " us\n";
+    if (!run("default", options, false) || !run("low latency", options, true))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,309 @@
+// Stand-in for the chat server, to try the client on one machine. The real
+// server is not public; this one only relays: every frame ([u32 netLen]
+// [payload]) a client sends goes to all connected clients, the sender too,
+// without being looked into. Multiplexed streams, lanes and datagrams are not
+// served.
+//
+//   freia-thiwi-standin [--port 7000] [--tls cert.pem key.pem]
+//
+// A client is relayed to from a queue, so one that reads slowly holds up
+// nobody; past maxQueued it is dropped.
+//
+// With --tls it speaks TLS 1.3 with SSL_OP_ENABLE_KTLS and prints, for every
+// client, whether the kernel took over the record layer. The client verifies
+// the certificate, so start it with SSL_CERT_FILE=cert.pem and connect to the
+// name or address the certificate was made for.
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static constexpr uint32_t maxFrame = 64 * 1024 * 1024;
+static constexpr size_t maxQueued = 256 * 1024 * 1024;     // then the client is dropped
+
+// Every client is served by its own thread, the only one to touch its SSL
+// object; others hand it frames through `outgoing` and wake it
+struct Client
+{
+    int fd = -1;
+    int wakeFd = -1;
+    SSL* ssl = nullptr;
+
+    std::mutex mutex;
+    std::string outgoing;
+    bool dropped = false;
+
+    ~Client()
+    {
+        if (ssl)
+            SSL_free(ssl);
+        close(fd);
+        close(wakeFd);
+    }
+};
+
+static std::mutex clientsMutex;
+static std::vector<std::shared_ptr<Client>> clients;
+
+// Bytes moved, 0 when the peer is gone or failed, -1 when it would block
+static ssize_t readSome(Client& client, char* data, size_t len)
+{
+    if (!client.ssl)
+    {
+        ssize_t n = recv(client.fd, data, len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            return -1;
+        return n < 0 ? 0 : n;
+    }
+
+    int n = SSL_read(client.ssl, data, static_cast<int>(len));
+    if (n > 0)
+        return n;
+    int error = SSL_get_error(client.ssl, n);
+    return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ? -1 : 0;
+}
+
+static ssize_t writeSome(Client& client, const char* data, size_t len)
+{
+    if (!client.ssl)
+    {
+        ssize_t n = send(client.fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            return -1;
+        return n < 0 ? 0 : n;
+    }
+
+    int n = SSL_write(client.ssl, data, static_cast<int>(std::min<size_t>(len, 1 << 30)));
+    if (n > 0)
+        return n;
+    int error = SSL_get_error(client.ssl, n);
+    return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ? -1 : 0;
+}
+
+static void relay(const std::string& frame)
+{
+    std::vector<std::shared_ptr<Client>> targets;
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        targets = clients;
+    }
+
+    for (const std::shared_ptr<Client>& target : targets)
+    {
+        {
+            std::lock_guard<std::mutex> lock(target->mutex);
+            if (target->outgoing.size() + frame.size() > maxQueued)
+                target->dropped = true;
+            else
+                target->outgoing += frame;
+        }
+        uint64_t one = 1;
+        if (write(target->wakeFd, &one, sizeof(one)) < 0) {}
+    }
+}
+
+// Complete frames at the front of `in` go to everyone
+static bool relayFrames(std::string& in, int id)
+{
+    size_t used = 0;
+    while (in.size() - used >= sizeof(uint32_t))
+    {
+        uint32_t netLen;
+        std::memcpy(&netLen, in.data() + used, sizeof(netLen));
+        uint32_t len = ntohl(netLen);
+        if (len == 0 || len > maxFrame)
+        {
+            std::cerr << "client " << id << ": bad frame length " << len << "\n";
+            return false;
+        }
+        if (in.size() - used < sizeof(netLen) + len)
+            break;
+
+        relay(in.substr(used, sizeof(netLen) + len));
+        used += sizeof(netLen) + len;
+    }
+    in.erase(0, used);
+    return true;
+}
+
+static void serve(std::shared_ptr<Client> client, int id)
+{
+    std::string in;
+    std::string out;
+    std::vector<char> buffer(64 * 1024);
+    bool open = true;
+
+    while (open)
+    {
+        {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            if (client->dropped)
+                break;
+            out += client->outgoing;
+            client->outgoing.clear();
+        }
+
+        // Records OpenSSL already holds do not show up in poll()
+        if (!client->ssl || SSL_pending(client->ssl) == 0)
+        {
+            pollfd fds[2] = {{client->fd, static_cast<short>(POLLIN | (out.empty() ? 0 : POLLOUT)), 0},
+                             {client->wakeFd, POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0 && errno != EINTR)
+                break;
+
+            uint64_t count;
+            if (fds[1].revents & POLLIN)
+                if (read(client->wakeFd, &count, sizeof(count)) < 0) {}
+        }
+
+        while (true)
+        {
+            ssize_t n = readSome(*client, buffer.data(), buffer.size());
+            if (n == -1)
+                break;
+            if (n == 0 || !relayFrames(in.append(buffer.data(), n), id))
+            {
+                open = false;
+                break;
+            }
+        }
+
+        while (open && !out.empty())
+        {
+            ssize_t n = writeSome(*client, out.data(), out.size());
+            if (n == -1)
+                break;
+            if (n == 0)
+                open = false;
+            else
+                out.erase(0, n);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+    std::cout << "client " << id << " left" << std::endl;
+}
+
+static SSL_CTX* makeContext(const char* cert, const char* key)
+{
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+        return nullptr;
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+    return ctx;
+}
+
+int main(int argc, char** argv)
+{
+    int port = 7000;
+    const char* cert = nullptr;
+    const char* key = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc)
+            port = std::atoi(argv[++i]);
+        else if (arg == "--tls" && i + 2 < argc)
+        {
+            cert = argv[++i];
+            key = argv[++i];
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--port 7000] [--tls cert.pem key.pem]\n";
+            return 2;
+        }
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+
+    SSL_CTX* ctx = nullptr;
+    if (cert && !(ctx = makeContext(cert, key)))
+        return 1;
+
+    // Loopback only, this is not a server for other machines
+    int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) == -1 || listen(listenFd, 16) == -1)
+    {
+        std::cerr << "Failed to listen on 127.0.0.1:" << port << ", errno: " << errno << "\n";
+        return 1;
+    }
+    std::cout << "Relaying on 127.0.0.1:" << port << (ctx ? " over TLS 1.3" : "") << std::endl;
+
+    for (int id = 1;; id++)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::cerr << "accept failed, errno: " << errno << "\n";
+            return 1;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        auto client = std::make_shared<Client>();
+        client->fd = fd;
+        client->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (ctx)
+        {
+            client->ssl = SSL_new(ctx);
+            SSL_set_fd(client->ssl, fd);
+            if (SSL_accept(client->ssl) != 1)
+            {
+                std::cout << "client " << id << ": TLS handshake failed\n";
+                ERR_print_errors_fp(stderr);
+                continue;
+            }
+
+            bool ktlsSend = BIO_get_ktls_send(SSL_get_wbio(client->ssl)) > 0;
+            bool ktlsRecv = BIO_get_ktls_recv(SSL_get_rbio(client->ssl)) > 0;
+            std::cout << "client " << id << ": " << SSL_get_version(client->ssl) << " " << SSL_get_cipher(client->ssl)
+                      << ", kTLS send " << (ktlsSend ? "yes" : "no") << ", recv " << (ktlsRecv ? "yes" : "no") << std::endl;
+        }
+        else
+            std::cout << "client " << id << " joined" << std::endl;
+
+        // Blocking only for the handshake
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            clients.push_back(client);
+        }
+        std::thread(serve, client, id).detach();
+    }
+}